@@ -0,0 +1,40 @@
+#ifndef GL3DS_BENCH
+#define GL3DS_BENCH
+
+#include <stdio.h>
+#include <time.h>
+
+/** Minimum time each kernel runs for, in nanoseconds */
+#define BENCH_MIN_NS 200000000.0
+
+static inline double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Run \p body in batches until BENCH_MIN_NS have passed and set \p ns to
+ * the average time of one run in the fastest batch, which other processes
+ * disturbed the least.
+ */
+#define BENCH(ns, body)								\
+	do {											\
+		double start_ = bench_now(), batch_start_, best_ = 0, elapsed_;	\
+		long batch_;								\
+		do {										\
+			batch_start_ = bench_now();				\
+			for (batch_ = 0; batch_ < 1024; batch_++) { body; }	\
+			elapsed_ = bench_now() - batch_start_;	\
+			if (best_ == 0 || elapsed_ < best_)		\
+				best_ = elapsed_;					\
+		} while (bench_now() - start_ < BENCH_MIN_NS);	\
+		(ns) = best_ / 1024;						\
+	} while (0)
+
+/** Keep the compiler from dropping results nobody reads */
+static volatile unsigned bench_sink;
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Float uniform uploads: the cost of packing registers to float24 against
+ * copying them as four 32-bit floats, and the command buffer bytes saved.
+ * The packing is checked against a plain reference conversion first.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "float24.h"
+
+/** Registers of a burst, as upload_uniforms() sends at most */
+#define REGS 85
+
+/** The conversion spelled out, with a branch per case */
+static u32 ref_float24(GLfloat f)
+{
+	union { GLfloat f; u32 i; } u = { f };
+	u32 sign = (u.i >> 8) & 0x800000;
+	s32 exp = (s32) ((u.i >> 23) & 0xFF) - (127 - 63);
+
+	if (isnan(f))
+		return sign | 0x7F8000 | ((u.i >> 7) & 0xFFFF);
+	if (exp <= 0)
+		return sign;
+	if (exp >= 0x7F)
+		return sign | 0x7F0000;
+	return sign | (u32) exp << 16 | ((u.i >> 7) & 0xFFFF);
+}
+
+static void ref_pack_float24(u32 *dst, const GLfloat (*regs)[4], int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++, dst += 3) {
+		u32 w = ref_float24(regs[i][0]);
+		u32 z = ref_float24(regs[i][1]);
+		u32 y = ref_float24(regs[i][2]);
+		u32 x = ref_float24(regs[i][3]);
+
+		dst[0] = w << 8 | z >> 16;
+		dst[1] = z << 16 | y >> 8;
+		dst[2] = y << 24 | x;
+	}
+}
+
+static GLfloat from_bits(u32 i)
+{
+	union { u32 i; GLfloat f; } u = { i };
+	return u.f;
+}
+
+int main(void)
+{
+	static const u32 special[] = {
+		0x00000000, 0x80000000, 0x3F800000, 0xBF800000,	/* +-0, +-1 */
+		0x00000001, 0x00800000, 0x1F800000, 0x20000000,	/* denormal, too small, edges */
+		0x20800000, 0x5F000000, 0x5F7FFFFF, 0x5F800000,	/* smallest, largest, too large */
+		0x7F7FFFFF, 0x7F800000, 0xFF800000, 0x7FC00000,	/* max, +-inf, NaN */
+		0x7F800001, 0xFFFFFFFF, 0x7F80007F, 0x3F80007F,	/* NaNs with low payloads */
+	};
+	static GLfloat regs[REGS][4];
+	static u32 packed[REGS * 3], expected[REGS * 3], copied[REGS * 4];
+	double pack_ns, ref_ns, copy_ns;
+	unsigned i, j;
+
+	srand(1);
+	for (i = 0; i < REGS; i++) {
+		for (j = 0; j < 4; j++)
+			regs[i][j] = (GLfloat) (rand() - RAND_MAX / 2) / 1024.0F;
+	}
+	for (i = 0; i < sizeof(special) / sizeof(special[0]); i++)
+		regs[i / 4][i % 4] = from_bits(special[i]);
+
+	for (i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+		u32 got = _gl3ds_float24(from_bits(special[i]));
+		u32 want = ref_float24(from_bits(special[i]));
+		if (got != want) {
+			printf("float24 of %08x: got %06x, expected %06x\n", special[i], got, want);
+			return 1;
+		}
+	}
+	_gl3ds_pack_float24(packed, regs, REGS);
+	ref_pack_float24(expected, regs, REGS);
+	if (memcmp(packed, expected, sizeof(packed))) {
+		printf("float24 pack differs from the reference\n");
+		return 1;
+	}
+
+	BENCH(pack_ns, _gl3ds_pack_float24(packed, regs, REGS); bench_sink += packed[0]);
+	BENCH(ref_ns, ref_pack_float24(expected, regs, REGS); bench_sink += expected[0]);
+	BENCH(copy_ns, memcpy(copied, regs, sizeof(regs)); bench_sink += copied[0]);
+
+	printf("%-24s %10s %10s %12s\n", "upload of 85 registers", "ns", "ns/reg", "bytes");
+	printf("%-24s %10.1f %10.2f %12d\n", "float32 copy", copy_ns, copy_ns / REGS, REGS * 16);
+	printf("%-24s %10.1f %10.2f %12d\n", "float24 pack, branches", ref_ns, ref_ns / REGS, REGS * 12);
+	printf("%-24s %10.1f %10.2f %12d\n", "float24 pack, table", pack_ns, pack_ns / REGS, REGS * 12);
+	printf("%-24s %10.1f %10.2f %12d\n", "difference", pack_ns - copy_ns, (pack_ns - copy_ns) / REGS, -REGS * 4);
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Matrix multiplication and point transforms: the kernels picked by matrix
+ * type against the generic matmul4() and TRANSFORM_POINT() paths.  The
+ * typed results are checked against the generic ones first.
+ */
+
+#include <math.h>
+#include "bench.h"
+
+/* The kernels are static, build the matrix code in */
+#include "math/m_matrix.c"
+
+/** Points of a transform batch */
+#define POINTS 1024
+
+/** Relative difference allowed between typed and generic results */
+#define EPSILON 1e-5F
+
+struct bench_matrix {
+	const char *name;
+	GLmatrix m;
+};
+
+static void setup_matrices(struct bench_matrix *mats)
+{
+	static const GLfloat scale_2d[16] = {
+		2, 0, 0, 0,  0, 3, 0, 0,  0, 0, 1, 0,  4, 5, 0, 1
+	};
+	static const GLfloat scale_3d[16] = {
+		2, 0, 0, 0,  0, 3, 0, 0,  0, 0, 4, 0,  4, 5, 6, 1
+	};
+	GLfloat m[16];
+	int i;
+
+	mats[0].name = "identity";
+	mats[1].name = "2d no rot";
+	mats[2].name = "3d no rot";
+	mats[3].name = "3d";
+	mats[4].name = "perspective";
+	mats[5].name = "general";
+	for (i = 0; i < 6; i++)
+		_math_matrix_ctr(&mats[i].m);
+
+	// Loaded rather than translated, the types come from the analysis
+	_math_matrix_loadf(&mats[1].m, scale_2d);
+	_math_matrix_loadf(&mats[2].m, scale_3d);
+	_math_matrix_rotate(&mats[3].m, 30.0F, 1.0F, 2.0F, 3.0F);
+	memcpy(m, mats[3].m.m, sizeof(m));
+	m[12] = 4.0F;
+	m[13] = 5.0F;
+	m[14] = 6.0F;
+	_math_matrix_loadf(&mats[3].m, m);
+	_math_matrix_frustum(&mats[4].m, -1.0F, 1.0F, -1.0F, 1.0F, 1.0F, 100.0F);
+	_math_matrix_frustum(&mats[5].m, -1.0F, 1.0F, -1.0F, 1.0F, 1.0F, 100.0F);
+	_math_matrix_rotate(&mats[5].m, 30.0F, 1.0F, 2.0F, 3.0F);
+	for (i = 0; i < 6; i++)
+		_math_matrix_analyse(&mats[i].m);
+}
+
+/** Are \p n floats of \p got within EPSILON of \p want? */
+static int same_floats(const GLfloat *got, const GLfloat *want, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (fabsf(got[i] - want[i]) > EPSILON * fmaxf(1.0F, fabsf(want[i])))
+			return 0;
+	}
+	return 1;
+}
+
+static int bench_matmul(const struct bench_matrix *mats, const GLmatrix *a)
+{
+	GLfloat product[16], expected[16];
+	double generic_ns, typed_ns;
+	int i;
+
+	printf("%-24s %10s %10s %8s\n", "multiply", "matmul4", "typed", "speedup");
+	for (i = 0; i < 6; i++) {
+		const GLmatrix *b = &mats[i].m;
+
+		matmul4(expected, a->m, b->m);
+		matmul_typed(product, a->m, b);
+		if (!same_floats(product, expected, 16)) {
+			printf("%s: typed product differs from matmul4\n", mats[i].name);
+			return 0;
+		}
+
+		BENCH(generic_ns, matmul4(product, a->m, b->m); bench_sink += product[5] != 0.0F);
+		BENCH(typed_ns, matmul_typed(product, a->m, b); bench_sink += product[5] != 0.0F);
+		printf("%-24s %10.1f %10.1f %7.2fx\n", mats[i].name, generic_ns, typed_ns,
+			   generic_ns / typed_ns);
+	}
+	return 1;
+}
+
+static void transform_generic(GLfloat (*to)[4], const GLfloat *m, const GLfloat *from,
+							  GLuint stride, GLuint size, GLuint count)
+{
+	GLuint i;
+
+	if (size == 4) {
+		for (i = 0; i < count; i++, from = (const GLfloat *) ((const GLubyte *) from + stride)) {
+			TRANSFORM_POINT(to[i], m, from);
+		}
+	}
+	else {
+		for (i = 0; i < count; i++, from = (const GLfloat *) ((const GLubyte *) from + stride)) {
+			TRANSFORM_POINT3(to[i], m, from);
+		}
+	}
+}
+
+static int bench_transform(const struct bench_matrix *mats, GLuint size)
+{
+	static GLfloat from[POINTS * 4], to[POINTS][4], expected[POINTS][4];
+	const GLuint stride = size * sizeof(GLfloat);
+	double generic_ns, typed_ns;
+	int i, j;
+
+	for (i = 0; i < POINTS; i++) {
+		for (j = 0; j < 4; j++)
+			from[i * 4 + j] = (GLfloat) ((i * 7 + j * 3) % 97) / 8.0F;
+	}
+
+	printf("%-20s vec%u %10s %10s %8s\n", "transform, ns/point", size, "generic", "typed", "speedup");
+	for (i = 0; i < 6; i++) {
+		const GLmatrix *m = &mats[i].m;
+
+		transform_generic(expected, m->m, from, stride, size, POINTS);
+		_math_transform_points(to, m, from, stride, size, POINTS);
+		if (!same_floats(&to[0][0], &expected[0][0], POINTS * 4)) {
+			printf("%s: typed vec%u transform differs from the generic one\n", mats[i].name, size);
+			return 0;
+		}
+
+		BENCH(generic_ns, transform_generic(to, m->m, from, stride, size, POINTS); bench_sink += to[9][1] != 0.0F);
+		BENCH(typed_ns, _math_transform_points(to, m, from, stride, size, POINTS); bench_sink += to[9][1] != 0.0F);
+		printf("%-24s %10.2f %10.2f %7.2fx\n", mats[i].name, generic_ns / POINTS, typed_ns / POINTS,
+			   generic_ns / typed_ns);
+	}
+	return 1;
+}
+
+int main(void)
+{
+	struct bench_matrix mats[6];
+
+	setup_matrices(mats);
+
+	// A modelview with rotation is what usually gets multiplied on
+	if (!bench_matmul(mats, &mats[3].m))
+		return 1;
+	printf("\n");
+	if (!bench_transform(mats, 3))
+		return 1;
+	printf("\n");
+	if (!bench_transform(mats, 4))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include "3ds.h"
+
+/* Plain heap memory stands in for the linear heap */
+
+void *linearMemAlign(size_t size, size_t alignment)
+{
+	void *mem;
+
+	if (posix_memalign(&mem, alignment < sizeof(void *) ? sizeof(void *) : alignment, size))
+		return NULL;
+	return mem;
+}
+
+void linearFree(void *mem)
+{
+	free(mem);
+}
+
+/* The CPU and the GPU share one view of memory on the host */
+
+s32 GSPGPU_FlushDataCache(const void *adr, u32 size)
+{
+	return 0;
+}
+
+s32 GSPGPU_InvalidateDataCache(const void *adr, u32 size)
+{
+	return 0;
+}
+
+/* Programs are run by the benches themselves */
+
+void DVLE_GenerateOutmap(DVLE_s *dvle)
+{
+}
+
+s32 shaderProgramInit(shaderProgram_s *sp)
+{
+	sp->vertexShader = sp->geometryShader = NULL;
+	return 0;
+}
+
+s32 shaderProgramFree(shaderProgram_s *sp)
+{
+	return 0;
+}
+
+s32 shaderProgramSetVsh(shaderProgram_s *sp, DVLE_s *dvle)
+{
+	sp->vertexShader = dvle;
+	return 0;
+}
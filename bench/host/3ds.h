@@ -0,0 +1,87 @@
+#ifndef GL3DS_BENCH_3DS
+#define GL3DS_BENCH_3DS
+
+/*
+ * Host stand-in for the parts of ctrulib the library headers name, so the
+ * CPU-side code can be built and timed off the console.  Nothing here
+ * talks to a GPU.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef u32 Handle;
+
+typedef enum {
+	GFX_TOP = 0,
+	GFX_BOTTOM = 1
+} gfxScreen_t;
+
+typedef struct DVLB_s DVLB_s;
+
+typedef enum {
+	VERTEX_SHDR = 0,
+	GEOMETRY_SHDR = 1
+} DVLE_type;
+
+typedef enum {
+	RESULT_POSITION = 0x0,
+	RESULT_NORMALQUAT = 0x1,
+	RESULT_COLOR = 0x2,
+	RESULT_TEXCOORD0 = 0x3,
+	RESULT_TEXCOORD0W = 0x4,
+	RESULT_TEXCOORD1 = 0x5,
+	RESULT_TEXCOORD2 = 0x6,
+	RESULT_VIEW = 0x8
+} DVLE_outputAttribute_t;
+
+typedef struct {
+	u32 codeSize;
+	u32 *codeData;
+	u32 opdescSize;
+	u32 *opcdescData;
+} DVLP_s;
+
+typedef struct {
+	u16 type, regID;
+	u8 mask;
+	u8 unk[3];
+} DVLE_outEntry_s;
+
+typedef struct {
+	DVLE_type type;
+	DVLP_s *dvlp;
+	u32 mainOffset, endmainOffset;
+	u32 outTableSize;
+	DVLE_outEntry_s *outTableData;
+	u8 outmapMask;
+	u32 outmapData[8];
+} DVLE_s;
+
+typedef struct {
+	void *vertexShader;
+	void *geometryShader;
+} shaderProgram_s;
+
+void *linearMemAlign(size_t size, size_t alignment);
+void linearFree(void *mem);
+
+s32 GSPGPU_FlushDataCache(const void *adr, u32 size);
+s32 GSPGPU_InvalidateDataCache(const void *adr, u32 size);
+
+void DVLE_GenerateOutmap(DVLE_s *dvle);
+s32 shaderProgramInit(shaderProgram_s *sp);
+s32 shaderProgramFree(shaderProgram_s *sp);
+s32 shaderProgramSetVsh(shaderProgram_s *sp, DVLE_s *dvle);
+
+#endif
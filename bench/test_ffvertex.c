@@ -0,0 +1,241 @@
+/*
+ * Fixed-function vertex programs: the key made from the array state and
+ * the program generated for it, run through an interpreter of the PICA200
+ * instructions the generator emits.  Exits non-zero on a wrong result.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+/* The generator is static, build it in */
+#include "ffvertex.c"
+
+/** Uniform registers, as _gl3ds_set_uniforms() stores them */
+static GLfloat uniform_regs[96][4];
+
+void _gl3ds_set_uniforms(struct gl_context *ctx, struct gl_program_uniforms *uniforms,
+						 GLint location, GLsizei count, const GLfloat *value)
+{
+	if (location >= 0)
+		memcpy(uniform_regs[location], value, count * 4 * sizeof(GLfloat));
+}
+
+void _gl3ds_upload_matrix(struct gl_context *ctx, const struct gl_matrix_stack *stack,
+						  GLint uniform)
+{
+	static const GLfloat identity[4][4] = {
+		{ 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 }
+	};
+
+	memcpy(uniform_regs[uniform], identity, sizeof(identity));
+}
+
+uint32_t _mesa_hash_data(const void *data, size_t size)
+{
+	const GLubyte *bytes = data;
+	uint32_t hash = 2166136261u;
+
+	while (size--)
+		hash = (hash ^ *bytes++) * 16777619u;
+	return hash;
+}
+
+#ifndef HAVE___BUILTIN_POPCOUNTLL
+unsigned int _mesa_bitcount_64(uint64_t n)
+{
+	return __builtin_popcountll(n);
+}
+#endif
+
+void _mesa_error(struct gl_context *ctx, GLenum error, const char *fmtString, ...)
+{
+	printf("unexpected GL error 0x%x: %s\n", error, fmtString);
+	exit(1);
+}
+
+
+/** Read a source operand with the swizzle and negation of its descriptor */
+static void read_src(GLfloat v[4], int reg, u32 bits,
+					 GLfloat in[16][4], GLfloat temp[16][4])
+{
+	const GLfloat *r = reg < R(0) ? in[reg] : reg < C(0) ? temp[reg - R(0)] : uniform_regs[reg - C(0)];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		v[i] = r[(bits >> (7 - 2 * i)) & 3];
+		if (bits & 1)
+			v[i] = -v[i];
+	}
+}
+
+/** Run a generated program on one vertex, 0 if it has an unknown opcode */
+static int run_program(const struct ff_builder *b, GLfloat in[16][4], GLfloat out[16][4])
+{
+	GLfloat temp[16][4];
+	GLuint pc;
+	int i;
+
+	memset(temp, 0, sizeof(temp));
+
+	for (pc = 0; pc < b->NumCode; pc++) {
+		u32 inst = b->Code[pc];
+		u32 desc = b->Opdesc[inst & 0x7F];
+		int op = inst >> 26, dst = (inst >> 21) & 0x1F;
+		GLfloat s1[4], s2[4], r[4];
+
+		if (op == OP_END)
+			return 1;
+
+		read_src(s1, (inst >> 12) & 0x7F, desc >> 4, in, temp);
+		read_src(s2, (inst >> 7) & 0x1F, desc >> 13, in, temp);
+
+		for (i = 0; i < 4; i++) {
+			switch (op) {
+			case OP_ADD: r[i] = s1[i] + s2[i]; break;
+			case OP_DP3: r[i] = s1[0] * s2[0] + s1[1] * s2[1] + s1[2] * s2[2]; break;
+			case OP_DP4: r[i] = s1[0] * s2[0] + s1[1] * s2[1] + s1[2] * s2[2] + s1[3] * s2[3]; break;
+			case OP_MUL: r[i] = s1[i] * s2[i]; break;
+			case OP_MAX: r[i] = s1[i] > s2[i] ? s1[i] : s2[i]; break;
+			case OP_MIN: r[i] = s1[i] < s2[i] ? s1[i] : s2[i]; break;
+			case OP_RCP: r[i] = 1.0F / s1[0]; break;
+			case OP_RSQ: r[i] = 1.0F / sqrtf(s1[0]); break;
+			case OP_MOV: r[i] = s1[i]; break;
+			default:
+				printf("unknown opcode 0x%02x\n", op);
+				return 0;
+			}
+		}
+
+		for (i = 0; i < 4; i++) {
+			if (desc & (MASK_X >> i))
+				(dst < R(0) ? out[dst] : temp[dst - R(0)])[i] = r[i];
+		}
+	}
+
+	printf("program has no END\n");
+	return 0;
+}
+
+
+static struct gl_context ctx;
+static struct gl_vertex_array_object vao;
+static struct gl_shared_state shared;
+static struct gl_shader_program shader;
+
+static void set_array(GLuint attrib, GLint size, GLenum type, GLboolean normalized)
+{
+	struct gl_client_array *array = &vao._VertexAttrib[attrib];
+
+	vao._Enabled |= BITFIELD64_BIT(attrib);
+	array->Size = size;
+	array->Type = type;
+	array->Normalized = normalized;
+}
+
+static int check(const char *what, const GLfloat *got, const GLfloat *want)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (fabsf(got[i] - want[i]) > 1e-5F) {
+			printf("%s: got (%g, %g, %g, %g), expected (%g, %g, %g, %g)\n", what,
+				   got[0], got[1], got[2], got[3], want[0], want[1], want[2], want[3]);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Generate the program for the arrays set up, run it on \p in and compare
+ * the position, color and first texcoord it outputs.
+ */
+static int test_program(const char *name, GLuint normalize, GLfloat in[16][4],
+						const GLfloat *pos, const GLfloat *color, const GLfloat *tex)
+{
+	struct ff_vertex_key key;
+	struct ff_builder b;
+	GLfloat out[16][4];
+	int ok;
+
+	make_key(&ctx, &key);
+	if (key.Normalize != normalize) {
+		printf("%s: key normalization 0x%x, expected 0x%x\n", name, key.Normalize, normalize);
+		return 0;
+	}
+
+	memset(&b, 0, sizeof(b));
+	emit_program(&b, &key);
+	if (b.Overflow) {
+		printf("%s: program overflows\n", name);
+		return 0;
+	}
+
+	memset(out, 0, sizeof(out));
+	if (!run_program(&b, in, out))
+		return 0;
+
+	ok = check(name, out[0], pos) && check(name, out[1], color);
+	if (ok && tex)
+		ok = check(name, out[2], tex);
+	printf("%-32s %s, %u instructions\n", name, ok ? "ok" : "FAILED", b.NumCode);
+	return ok;
+}
+
+int main(void)
+{
+	static const GLfloat identity[4][4] = {
+		{ 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 }
+	};
+	GLfloat in[16][4];
+	int ok = 1;
+
+	ctx.Array.VAO = &vao;
+	ctx.Shared = &shared;
+	shared.Shader = &shader;
+	_gl3ds_ff_vertex_uniforms(&ctx);
+	memcpy(uniform_regs[FF_PROJECTION], identity, sizeof(identity));
+	memcpy(uniform_regs[FF_MODELVIEW], identity, sizeof(identity));
+
+	// Floats are read as they are
+	set_array(VERT_ATTRIB_POS, 3, GL_FLOAT, GL_FALSE);
+	set_array(VERT_ATTRIB_COLOR0, 4, GL_FLOAT, GL_FALSE);
+	memcpy(in[0], (GLfloat[4]) { 0.5F, -2.0F, 3.0F, 1.0F }, sizeof(in[0]));
+	memcpy(in[1], (GLfloat[4]) { 0.25F, 0.5F, 0.75F, 1.0F }, sizeof(in[1]));
+	ok &= test_program("float position and color", 0, in, in[0], in[1], NULL);
+
+	// Normalized unsigned bytes map to [0, 1]
+	set_array(VERT_ATTRIB_COLOR0, 4, GL_UNSIGNED_BYTE, GL_TRUE);
+	memcpy(in[1], (GLfloat[4]) { 255, 0, 51, 255 }, sizeof(in[1]));
+	ok &= test_program("normalized ubyte color", (FF_NORM_UBYTE | 3 << 2) << (FF_INPUT_COLOR * 4),
+					   in, in[0], (GLfloat[4]) { 1.0F, 0.0F, 0.2F, 1.0F }, NULL);
+
+	// Three components: the alpha the loader fills in stays 1
+	set_array(VERT_ATTRIB_COLOR0, 3, GL_UNSIGNED_BYTE, GL_TRUE);
+	memcpy(in[1], (GLfloat[4]) { 255, 0, 51, 1 }, sizeof(in[1]));
+	ok &= test_program("normalized ubyte rgb color", (FF_NORM_UBYTE | 2 << 2) << (FF_INPUT_COLOR * 4),
+					   in, in[0], (GLfloat[4]) { 1.0F, 0.0F, 0.2F, 1.0F }, NULL);
+
+	// Not normalized, bytes are read as integers
+	set_array(VERT_ATTRIB_COLOR0, 4, GL_UNSIGNED_BYTE, GL_FALSE);
+	memcpy(in[1], (GLfloat[4]) { 255, 0, 51, 255 }, sizeof(in[1]));
+	ok &= test_program("unnormalized ubyte color", 0, in, in[0], in[1], NULL);
+
+	// Normalized shorts map to [-1, 1], w the loader fills in stays 1
+	set_array(VERT_ATTRIB_POS, 3, GL_SHORT, GL_TRUE);
+	set_array(VERT_ATTRIB_COLOR0, 4, GL_FLOAT, GL_FALSE);
+	memcpy(in[0], (GLfloat[4]) { 32767, -32768, -1, 1 }, sizeof(in[0]));
+	memcpy(in[1], (GLfloat[4]) { 0.25F, 0.5F, 0.75F, 1.0F }, sizeof(in[1]));
+	ok &= test_program("normalized short position", (FF_NORM_SHORT | 2 << 2) << (FF_INPUT_POS * 4),
+					   in, (GLfloat[4]) { 1.0F, -1.0F, -1.0F / 65535.0F, 1.0F }, in[1], NULL);
+
+	// Normalized signed bytes map to [-1, 1], through the texture matrix
+	set_array(VERT_ATTRIB_POS, 3, GL_FLOAT, GL_FALSE);
+	set_array(VERT_ATTRIB_TEX0, 2, GL_BYTE, GL_TRUE);
+	memcpy(in[0], (GLfloat[4]) { 0.5F, -2.0F, 3.0F, 1.0F }, sizeof(in[0]));
+	memcpy(in[2], (GLfloat[4]) { 127, -128, 0, 1 }, sizeof(in[2]));
+	ok &= test_program("normalized byte texcoord", (FF_NORM_BYTE | 1 << 2) << (FF_INPUT_TEX0 * 4),
+					   in, in[0], in[1], (GLfloat[4]) { 1.0F, -1.0F, 0.0F, 0.0F });
+
+	return ok ? 0 : 1;
+}
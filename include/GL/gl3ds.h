@@ -61,6 +61,8 @@ extern "C" {
 #define GL_MAP_INVALIDATE_BUFFER_BIT      0x0008
 #define GL_MAP_FLUSH_EXPLICIT_BIT         0x0010
 #define GL_MAP_UNSYNCHRONIZED_BIT         0x0020
+#define GL_MAP_PERSISTENT_BIT             0x0040
+#define GL_MAP_COHERENT_BIT               0x0080
 #define GL_STREAM_DRAW                    0x88E0
 #define GL_STREAM_READ                    0x88E1
 #define GL_STREAM_COPY                    0x88E2
@@ -363,6 +365,10 @@ extern "C" {
 #define GL_RGB10_A2				0x8059
 #define GL_RGBA12				0x805A
 #define GL_RGBA16				0x805B
+#define GL_RGB565				0x8D62
+#define GL_DEPTH_COMPONENT16			0x81A5
+#define GL_DEPTH_COMPONENT24			0x81A6
+#define GL_DEPTH24_STENCIL8			0x88F0
 
 #define GL_RED					0x1903
 #define GL_GREEN				0x1904
@@ -814,6 +820,17 @@ extern "C" {
 #define GL_COLOR_MATERIAL_PARAMETER		0x0B56
 #define GL_NORMALIZE				0x0BA1
 
+// Fog
+#define GL_FOG					0x0B60
+#define GL_FOG_MODE				0x0B65
+#define GL_FOG_DENSITY				0x0B62
+#define GL_FOG_COLOR				0x0B66
+#define GL_FOG_INDEX				0x0B61
+#define GL_FOG_START				0x0B63
+#define GL_FOG_END				0x0B64
+#define GL_EXP					0x0800
+#define GL_EXP2					0x0801
+
 
 /*
  * CTRULIB specific constants below
@@ -894,6 +911,8 @@ extern "C" {
 #define GL_UNSIGNED_SHORT       0x1403  // Not in ctrulib
 #define GL_INT                  0x1404
 #define GL_UNSIGNED_INT         0x1405
+#define GL_DOUBLE               0x140A
+#define GL_FIXED                0x140C
 
 // GPU_TEVSRC
 #define GL_PRIMARY_COLOR        GPU_PRIMARY_COLOR
@@ -945,12 +964,54 @@ typedef void* GLeglImageOES;
 typedef unsigned short GLhalfARB;
 typedef struct __GLsync *GLsync;
 
+/* Linear memory held for buffer object storage by a share group */
+typedef struct {
+	GLuint slabCount;   // 64 KiB slabs small buffers are carved from
+	GLuint slabBytes;
+	GLuint smallCount;  // Buffers living in slabs
+	GLuint smallBytes;  // Bytes requested by them
+	GLuint chunkBytes;  // Bytes of slab space they occupy
+	GLuint largeCount;  // Buffers allocated straight from the linear heap
+	GLuint largeBytes;
+	GLuint retiredCount; // Storage replaced while the GPU could read it
+	GLuint retiredBytes;
+} gl3ds_bufferPoolStats;
+
+/* Formats of the buffers a context renders to.  With 2 samples they are
+ * twice the screen's size across its height, with 4 twice both ways, and
+ * are scaled down as they are presented.
+ */
+typedef struct {
+	GLenum colorFormat;  // GL_RGBA8, GL_RGB8, GL_RGB565, GL_RGB5_A1 or GL_RGBA4
+	GLenum depthFormat;  // GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT24 or GL_DEPTH24_STENCIL8
+	GLuint samples;      // 0 or 1 for none, 2 or 4
+} gl3ds_contextConfig;
+
 /* Non-standard GL functions specific to the needs of the 3DS and ctrulib */
 GLuint gl3ds_createContext(GLuint sharedContext, gfxScreen_t screen);
+GLuint gl3ds_createContextWithConfig(GLuint sharedContext, gfxScreen_t screen, const gl3ds_contextConfig* config);
 GLboolean gl3ds_makeCurrent(GLuint context);
 void gl3ds_deleteContext(GLuint context);
 void gl3ds_flushContext(GLuint context);
 void gl3ds_swapBuffers();
+void gl3ds_getBufferPoolStats(GLuint context, gl3ds_bufferPoolStats* stats);
+
+/* Only the rows of the color buffer drawn to since the last flush are
+ * transferred to the screen, found from the viewport and scissor box of
+ * each draw.  Once damage is added, in the coordinates of glScissor(), it
+ * is used instead until the next flush.
+ */
+void gl3ds_addDamage(GLuint context, GLint x, GLint y, GLsizei width, GLsizei height);
+
+/* Frustum culling of bounding volumes in object space against the current
+ * modelview and projection.  Spheres are x, y, z, radius, boxes are the
+ * minimum then maximum corner.  Bit i % 32 of visible[i / 32] is set for
+ * each volume that may be seen, the count of those is returned.
+ */
+#define GL3DS_CULL_SKIP_DRAW 0x1  // Drop the next draw if nothing is visible
+void gl3ds_getFrustumPlanes(GLfloat planes[6][4]);
+GLsizei gl3ds_cullSpheres(const GLfloat* spheres, GLsizei count, GLuint* visible, GLbitfield flags);
+GLsizei gl3ds_cullBoxes(const GLfloat* boxes, GLsizei count, GLuint* visible, GLbitfield flags);
 
 // arrayobj.c
 void glBindVertexArray( GLuint id );
@@ -1133,6 +1194,12 @@ void glInvalidateFramebuffer(GLenum target, GLsizei numAttachments, const GLenum
 void glInvalidateNamedFramebufferData(GLuint framebuffer, GLsizei numAttachments, const GLenum *attachments);
 void glDiscardFramebufferEXT(GLenum target, GLsizei numAttachments, const GLenum *attachments);
 
+// fog.c
+void glFogf( GLenum pname, GLfloat param );
+void glFogi( GLenum pname, GLint param );
+void glFogfv( GLenum pname, const GLfloat *params );
+void glFogiv( GLenum pname, const GLint *params );
+
 // get.c
 void glGetBooleanv( GLenum pname, GLboolean *params );
 void glGetDoublev( GLenum pname, GLdouble *params );
@@ -1457,6 +1524,7 @@ void glGetVertexArrayIndexediv(GLuint vaobj, GLuint index, GLenum pname, GLint *
 void glGetVertexArrayIndexed64iv(GLuint vaobj, GLuint index, GLenum pname, GLint64 *param);
 void glInterleavedArrays(GLenum format, GLsizei stride, const GLvoid *pointer);
 void glMultiDrawArrays( GLenum mode, const GLint *first, const GLsizei *count, GLsizei primcount );
+void glMultiDrawElements( GLenum mode, const GLsizei *count, GLenum type, const GLvoid * const *indices, GLsizei primcount );
 void glMultiDrawElementsEXT( GLenum mode, const GLsizei *count, GLenum type, const GLvoid **indices, GLsizei primcount );
 void glMultiDrawElementsBaseVertex( GLenum mode, const GLsizei *count, GLenum type, const GLvoid **indices, GLsizei primcount, const GLint *basevertex);
 void glMultiModeDrawArraysIBM( const GLenum * mode, const GLint * first, const GLsizei * count, GLsizei primcount, GLint modestride );
@@ -1466,6 +1534,7 @@ void glUnlockArraysEXT( void );
 void glDrawArrays(GLenum mode, GLint first, GLsizei count);
 void glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
 void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices);
+void glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount);
 void glDrawRangeElements(GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices);
 void glDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex);
 void glDrawRangeElementsBaseVertex(GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex);
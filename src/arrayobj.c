@@ -280,9 +280,6 @@ _mesa_initialize_vao(struct gl_context *ctx,
    mtx_init(&obj->Mutex, mtx_plain);
    obj->RefCount = 1;
 
-	obj->AttributeFormats = 0;
-	obj->AttributePermutation = 0;
-
    /* Init the individual arrays */
    for (i = 0; i < ARRAY_SIZE(obj->VertexAttrib); i++) {
       switch (i) {
@@ -0,0 +1,365 @@
+#include "glheader.h"
+#include "imports.h"
+#include "hash.h"
+#include "bufferalloc.h"
+
+/*
+ * Buffer object storage has to live in linear memory for the GPU to read
+ * it.  Small buffers are carved out of 64 KiB slabs, each slab serving a
+ * single power of two size class, so that creating and respecifying
+ * thousands of small VBOs doesn't fragment the linear heap.  Buffers above
+ * the largest class are allocated straight from the heap.
+ */
+
+#define SLAB_SHIFT      16
+#define SLAB_SIZE       (1 << SLAB_SHIFT)
+#define MIN_CLASS_SHIFT 6       /* 64 bytes, ctx->Const.MinMapBufferAlignment */
+#define NUM_CLASSES     8       /* 64 .. 8192 bytes */
+#define MAX_CLASS_SIZE  (1 << (MIN_CLASS_SHIFT + NUM_CLASSES - 1))
+#define LARGE_ALIGNMENT 64
+
+
+struct gl_buffer_slab
+{
+	struct gl_buffer_slab *Prev, *Next;  /**< Slabs of the class with free chunks */
+	GLubyte *Base;
+	GLuint Class;
+	GLuint Used;         /**< Chunks handed out */
+	GLuint Untouched;    /**< Chunks never handed out, past the free list */
+	void *FreeList;      /**< Released chunks, linked through their first word */
+};
+
+struct gl_buffer_pool
+{
+	struct gl_buffer_slab *Partial[NUM_CLASSES];
+	struct _mesa_HashTable *Slabs;   /**< Keyed by Base >> SLAB_SHIFT */
+	struct gl_retired_storage *Retired;
+	gl3ds_bufferPoolStats Stats;
+	mtx_t *Mutex;        /**< Of the shared state, held by the entry points */
+};
+
+
+static inline GLuint
+size_class(GLsizeiptr size)
+{
+	GLuint class = 0;
+
+	while ((GLsizeiptr) 1 << (MIN_CLASS_SHIFT + class) < size)
+		class++;
+	return class;
+}
+
+static inline GLuint
+class_size(GLuint class)
+{
+	return 1 << (MIN_CLASS_SHIFT + class);
+}
+
+
+static void
+unlink_slab(struct gl_buffer_pool *pool, struct gl_buffer_slab *slab)
+{
+	if (slab->Prev)
+		slab->Prev->Next = slab->Next;
+	else
+		pool->Partial[slab->Class] = slab->Next;
+	if (slab->Next)
+		slab->Next->Prev = slab->Prev;
+	slab->Prev = slab->Next = NULL;
+}
+
+static void
+link_slab(struct gl_buffer_pool *pool, struct gl_buffer_slab *slab)
+{
+	slab->Prev = NULL;
+	slab->Next = pool->Partial[slab->Class];
+	if (slab->Next)
+		slab->Next->Prev = slab;
+	pool->Partial[slab->Class] = slab;
+}
+
+
+static struct gl_buffer_slab *
+new_slab(struct gl_buffer_pool *pool, GLuint class)
+{
+	struct gl_buffer_slab *slab = CALLOC_STRUCT(gl_buffer_slab);
+
+	if (!slab)
+		return NULL;
+
+	/* Slabs are aligned to their size so a chunk finds its slab by masking */
+	slab->Base = linearMemAlign(SLAB_SIZE, SLAB_SIZE);
+	if (!slab->Base) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->Class = class;
+	slab->Untouched = SLAB_SIZE / class_size(class);
+	_mesa_HashInsert(pool->Slabs, (u32) slab->Base >> SLAB_SHIFT, slab);
+	link_slab(pool, slab);
+
+	pool->Stats.slabCount++;
+	pool->Stats.slabBytes += SLAB_SIZE;
+	return slab;
+}
+
+
+static void
+delete_slab(struct gl_buffer_pool *pool, struct gl_buffer_slab *slab)
+{
+	unlink_slab(pool, slab);
+	_mesa_HashRemove(pool->Slabs, (u32) slab->Base >> SLAB_SHIFT);
+	linearFree(slab->Base);
+	free(slab);
+
+	pool->Stats.slabCount--;
+	pool->Stats.slabBytes -= SLAB_SIZE;
+}
+
+
+/**
+ * Create a pool for the contexts sharing the state \p mutex belongs to.
+ */
+struct gl_buffer_pool *
+_gl3ds_new_buffer_pool(mtx_t *mutex)
+{
+	struct gl_buffer_pool *pool = CALLOC_STRUCT(gl_buffer_pool);
+
+	if (pool) {
+		pool->Slabs = _mesa_NewHashTable();
+		pool->Mutex = mutex;
+	}
+	return pool;
+}
+
+
+static void
+delete_slab_cb(GLuint key, void *data, void *userData)
+{
+	struct gl_buffer_slab *slab = (struct gl_buffer_slab *) data;
+	linearFree(slab->Base);
+	free(slab);
+}
+
+
+/**
+ * Release the pool's slabs.  Buffers still allocated from them, and large
+ * buffers, are not tracked and must have been freed already.
+ */
+void
+_gl3ds_delete_buffer_pool(struct gl_buffer_pool *pool)
+{
+	while (pool->Retired) {
+		struct gl_retired_storage *retired = pool->Retired;
+		pool->Retired = retired->Next;
+		if (retired->Size > MAX_CLASS_SIZE)
+			linearFree(retired->Data);
+		free(retired);
+	}
+
+	_mesa_HashDeleteAll(pool->Slabs, delete_slab_cb, NULL);
+	_mesa_DeleteHashTable(pool->Slabs);
+	free(pool);
+}
+
+
+static void *
+pool_alloc(struct gl_buffer_pool *pool, GLsizeiptr size)
+{
+	struct gl_buffer_slab *slab;
+	GLuint class;
+	void *chunk;
+
+	if (size > MAX_CLASS_SIZE) {
+		chunk = linearMemAlign(size, LARGE_ALIGNMENT);
+		if (chunk) {
+			pool->Stats.largeCount++;
+			pool->Stats.largeBytes += size;
+		}
+		return chunk;
+	}
+
+	class = size_class(size);
+	slab = pool->Partial[class];
+	if (!slab) {
+		slab = new_slab(pool, class);
+		if (!slab)
+			return NULL;
+	}
+
+	if (slab->FreeList) {
+		chunk = slab->FreeList;
+		slab->FreeList = *(void **) chunk;
+	}
+	else {
+		chunk = slab->Base + SLAB_SIZE - slab->Untouched * class_size(class);
+		slab->Untouched--;
+	}
+
+	slab->Used++;
+	if (!slab->FreeList && !slab->Untouched)
+		unlink_slab(pool, slab);
+
+	pool->Stats.smallCount++;
+	pool->Stats.smallBytes += size;
+	pool->Stats.chunkBytes += class_size(class);
+	return chunk;
+}
+
+
+static void
+pool_free(struct gl_buffer_pool *pool, void *ptr, GLsizeiptr size)
+{
+	struct gl_buffer_slab *slab;
+
+	if (!ptr)
+		return;
+
+	if (size > MAX_CLASS_SIZE) {
+		linearFree(ptr);
+		pool->Stats.largeCount--;
+		pool->Stats.largeBytes -= size;
+		return;
+	}
+
+	slab = _mesa_HashLookup(pool->Slabs, (u32) ptr >> SLAB_SHIFT);
+	assert(slab && slab->Class == size_class(size));
+
+	if (!slab->FreeList && !slab->Untouched)
+		link_slab(pool, slab);
+
+	*(void **) ptr = slab->FreeList;
+	slab->FreeList = ptr;
+	slab->Used--;
+
+	pool->Stats.smallCount--;
+	pool->Stats.smallBytes -= size;
+	pool->Stats.chunkBytes -= class_size(slab->Class);
+
+	/* Give empty slabs back to the heap, but keep the last one of a class
+	 * around so alternating create/delete doesn't thrash.
+	 */
+	if (!slab->Used && (slab->Prev || slab->Next))
+		delete_slab(pool, slab);
+}
+
+
+/**
+ * Allocate linear memory for \p size bytes of buffer object storage.
+ */
+void *
+_gl3ds_buffer_alloc(struct gl_buffer_pool *pool, GLsizeiptr size)
+{
+	void *ptr;
+
+	mtx_lock(pool->Mutex);
+	ptr = pool_alloc(pool, size);
+	mtx_unlock(pool->Mutex);
+	return ptr;
+}
+
+
+/**
+ * Release storage returned by _gl3ds_buffer_alloc() for \p size bytes.
+ */
+void
+_gl3ds_buffer_free(struct gl_buffer_pool *pool, void *ptr, GLsizeiptr size)
+{
+	mtx_lock(pool->Mutex);
+	pool_free(pool, ptr, size);
+	mtx_unlock(pool->Mutex);
+}
+
+
+/**
+ * Respecify buffer storage of \p oldSize bytes to hold \p newSize bytes.
+ * The storage is kept when the new size falls in the same size class.
+ * Contents are not preserved otherwise.
+ */
+void *
+_gl3ds_buffer_realloc(struct gl_buffer_pool *pool, void *ptr,
+					  GLsizeiptr oldSize, GLsizeiptr newSize)
+{
+	mtx_lock(pool->Mutex);
+	if (ptr && oldSize <= MAX_CLASS_SIZE && newSize <= MAX_CLASS_SIZE &&
+		size_class(oldSize) == size_class(newSize)) {
+		pool->Stats.smallBytes += newSize - oldSize;
+	}
+	else if (!ptr || oldSize != newSize) {
+		pool_free(pool, ptr, oldSize);
+		ptr = pool_alloc(pool, newSize);
+	}
+	mtx_unlock(pool->Mutex);
+	return ptr;
+}
+
+
+/**
+ * Hand storage back to the pool once the GPU is past \p fence.
+ */
+void
+_gl3ds_buffer_retire(struct gl_buffer_pool *pool, void *ptr,
+					 GLsizeiptr size, GLuint fence)
+{
+	struct gl_retired_storage *retired;
+
+	if (!ptr)
+		return;
+
+	retired = MALLOC_STRUCT(gl_retired_storage);
+
+	mtx_lock(pool->Mutex);
+	if (!retired) {
+		/* Better a glitch on screen than leaking the storage */
+		pool_free(pool, ptr, size);
+	}
+	else {
+		retired->Data = ptr;
+		retired->Size = size;
+		retired->Fence = fence;
+		retired->Next = pool->Retired;
+		pool->Retired = retired;
+
+		pool->Stats.retiredCount++;
+		pool->Stats.retiredBytes += size;
+	}
+	mtx_unlock(pool->Mutex);
+}
+
+
+/**
+ * Release the retired storage the GPU is done with, that is whose fence is
+ * before \p fence.
+ */
+void
+_gl3ds_buffer_collect(struct gl_buffer_pool *pool, GLuint fence)
+{
+	struct gl_retired_storage **prev = &pool->Retired;
+	struct gl_retired_storage *retired;
+
+	mtx_lock(pool->Mutex);
+	while ((retired = *prev)) {
+		if ((GLint) (fence - retired->Fence) > 0) {
+			*prev = retired->Next;
+			pool->Stats.retiredCount--;
+			pool->Stats.retiredBytes -= retired->Size;
+			pool_free(pool, retired->Data, retired->Size);
+			free(retired);
+		}
+		else {
+			prev = &retired->Next;
+		}
+	}
+	mtx_unlock(pool->Mutex);
+}
+
+
+void
+_gl3ds_buffer_pool_stats(const struct gl_buffer_pool *pool,
+						 gl3ds_bufferPoolStats *stats)
+{
+	mtx_lock(pool->Mutex);
+	*stats = pool->Stats;
+	mtx_unlock(pool->Mutex);
+}
@@ -0,0 +1,24 @@
+#ifndef GL3DS_BUFFERALLOC
+#define GL3DS_BUFFERALLOC
+
+#include "glheader.h"
+#include "c11/threads.h"
+
+struct gl_buffer_pool;
+
+struct gl_buffer_pool *_gl3ds_new_buffer_pool(mtx_t *mutex);
+void _gl3ds_delete_buffer_pool(struct gl_buffer_pool *pool);
+
+void *_gl3ds_buffer_alloc(struct gl_buffer_pool *pool, GLsizeiptr size);
+void _gl3ds_buffer_free(struct gl_buffer_pool *pool, void *ptr, GLsizeiptr size);
+void *_gl3ds_buffer_realloc(struct gl_buffer_pool *pool, void *ptr,
+							GLsizeiptr oldSize, GLsizeiptr newSize);
+
+void _gl3ds_buffer_retire(struct gl_buffer_pool *pool, void *ptr,
+						  GLsizeiptr size, GLuint fence);
+void _gl3ds_buffer_collect(struct gl_buffer_pool *pool, GLuint fence);
+
+void _gl3ds_buffer_pool_stats(const struct gl_buffer_pool *pool,
+							  gl3ds_bufferPoolStats *stats);
+
+#endif
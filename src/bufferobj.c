@@ -39,10 +39,13 @@
 #include "imports.h"
 //#include "image.h"
 #include "bufferobj.h"
+#include "bufferalloc.h"
 //#include "fbobject.h"
 #include "mtypes.h"
 //#include "texobj.h"
-//#include "teximage.h"
+#include "teximage.h"
+#include "texstore.h"
+#include "formats.h"
 #include "glformats.h"
 #include "shared.h"
 #include "context.h"
@@ -260,8 +263,8 @@ buffer_object_subdata_range_good(struct gl_context *ctx,
       return false;
    }
 
-//   if (bufObj->Mappings[MAP_USER].AccessFlags & GL_MAP_PERSISTENT_BIT)
-//      return true;
+   if (bufObj->Mappings[MAP_USER].AccessFlags & GL_MAP_PERSISTENT_BIT)
+      return true;
 
    if (mappedRange) {
       if (bufferobj_range_mapped(bufObj, offset, size)) {
@@ -298,48 +301,48 @@ buffer_object_subdata_range_good(struct gl_context *ctx,
  *
  * \sa glClearBufferData and glClearBufferSubData
  */
-//static mesa_format
-//validate_clear_buffer_format(struct gl_context *ctx,
-//                             GLenum internalformat,
-//                             GLenum format, GLenum type,
-//                             const char *caller)
-//{
-//   mesa_format mesaFormat;
-//   GLenum errorFormatType;
-//
-//   mesaFormat = _mesa_validate_texbuffer_format(ctx, internalformat);
-//   if (mesaFormat == MESA_FORMAT_NONE) {
-//      _mesa_error(ctx, GL_INVALID_ENUM,
-//                  "%s(invalid internalformat)", caller);
-//      return MESA_FORMAT_NONE;
-//   }
-//
-//   /* NOTE: not mentioned in ARB_clear_buffer_object but according to
-//    * EXT_texture_integer there is no conversion between integer and
-//    * non-integer formats
-//   */
-//   if (_mesa_is_enum_format_signed_int(format) !=
-//       _mesa_is_format_integer_color(mesaFormat)) {
-//      _mesa_error(ctx, GL_INVALID_OPERATION,
-//                  "%s(integer vs non-integer)", caller);
-//      return MESA_FORMAT_NONE;
-//   }
-//
-//   if (!_mesa_is_color_format(format)) {
-//      _mesa_error(ctx, GL_INVALID_ENUM,
-//                  "%s(format is not a color format)", caller);
-//      return MESA_FORMAT_NONE;
-//   }
-//
-//   errorFormatType = _mesa_error_check_format_and_type(ctx, format, type);
-//   if (errorFormatType != GL_NO_ERROR) {
-//      _mesa_error(ctx, GL_INVALID_ENUM,
-//                  "%s(invalid format or type)", caller);
-//      return MESA_FORMAT_NONE;
-//   }
-//
-//   return mesaFormat;
-//}
+static mesa_format
+validate_clear_buffer_format(struct gl_context *ctx,
+                             GLenum internalformat,
+                             GLenum format, GLenum type,
+                             const char *caller)
+{
+   mesa_format mesaFormat;
+   GLenum errorFormatType;
+
+   mesaFormat = _mesa_validate_texbuffer_format(ctx, internalformat);
+   if (mesaFormat == MESA_FORMAT_NONE) {
+      _mesa_error(ctx, GL_INVALID_ENUM,
+                  "%s(invalid internalformat)", caller);
+      return MESA_FORMAT_NONE;
+   }
+
+   /* NOTE: not mentioned in ARB_clear_buffer_object but according to
+    * EXT_texture_integer there is no conversion between integer and
+    * non-integer formats
+   */
+   if (_mesa_is_enum_format_signed_int(format) !=
+       _mesa_is_format_integer_color(mesaFormat)) {
+      _mesa_error(ctx, GL_INVALID_OPERATION,
+                  "%s(integer vs non-integer)", caller);
+      return MESA_FORMAT_NONE;
+   }
+
+   if (!_mesa_is_color_format(format)) {
+      _mesa_error(ctx, GL_INVALID_ENUM,
+                  "%s(format is not a color format)", caller);
+      return MESA_FORMAT_NONE;
+   }
+
+   errorFormatType = _mesa_error_check_format_and_type(ctx, format, type);
+   if (errorFormatType != GL_NO_ERROR) {
+      _mesa_error(ctx, GL_INVALID_ENUM,
+                  "%s(invalid format or type)", caller);
+      return MESA_FORMAT_NONE;
+   }
+
+   return mesaFormat;
+}
 
 
 /**
@@ -356,24 +359,24 @@ buffer_object_subdata_range_good(struct gl_context *ctx,
  *
  * \sa glClearBufferData, glClearBufferSubData
  */
-//static bool
-//convert_clear_buffer_data(struct gl_context *ctx,
-//                          mesa_format internalformat,
-//                          GLubyte *clearValue, GLenum format, GLenum type,
-//                          const GLvoid *data, const char *caller)
-//{
-//   GLenum internalformatBase = _mesa_get_format_base_format(internalformat);
-//
-//   if (_mesa_texstore(ctx, 1, internalformatBase, internalformat,
-//                      0, &clearValue, 1, 1, 1,
-//                      format, type, data, &ctx->Unpack)) {
-//      return true;
-//   }
-//   else {
-//      _mesa_error(ctx, GL_OUT_OF_MEMORY, "%s", caller);
-//      return false;
-//   }
-//}
+static bool
+convert_clear_buffer_data(struct gl_context *ctx,
+                          mesa_format internalformat,
+                          GLubyte *clearValue, GLenum format, GLenum type,
+                          const GLvoid *data, const char *caller)
+{
+   GLenum internalformatBase = _mesa_get_format_base_format(internalformat);
+
+   if (_mesa_texstore(ctx, 1, internalformatBase, internalformat,
+                      0, &clearValue, 1, 1, 1,
+                      format, type, data, &ctx->Unpack)) {
+      return true;
+   }
+   else {
+      _mesa_error(ctx, GL_OUT_OF_MEMORY, "%s", caller);
+      return false;
+   }
+}
 
 
 /**
@@ -394,6 +397,358 @@ _mesa_new_buffer_object(struct gl_context *ctx, GLuint name)
 }
 
 
+/**
+ * Free the converted copies of vertex arrays sourced from a buffer object.
+ * Their storage goes back to the pool once the draws reading it executed.
+ */
+void
+_gl3ds_free_converted_arrays(struct gl_context *ctx,
+                             struct gl_buffer_object *bufObj)
+{
+   while (bufObj->Converted) {
+      struct gl_converted_array *conv = bufObj->Converted;
+      bufObj->Converted = conv->Next;
+      _gl3ds_buffer_retire(ctx->Shared->BufferPool, conv->Data,
+                           conv->Count * conv->Size * sizeof(GLfloat),
+                           conv->LastUseFence);
+      free(conv);
+   }
+}
+
+
+/**
+ * Mark the converted arrays overlapping a modified range of a buffer object
+ * as stale, so they're regenerated the next time they're drawn from.
+ */
+void
+_gl3ds_invalidate_converted_arrays(struct gl_context *ctx,
+                                   struct gl_buffer_object *bufObj,
+                                   GLintptr offset, GLsizeiptr size)
+{
+   struct gl_converted_array *conv;
+
+   for (conv = bufObj->Converted; conv; conv = conv->Next) {
+      const GLintptr end = conv->Offset + (GLintptr) conv->StrideB *
+         (conv->Count - 1) + _mesa_bytes_per_vertex_attrib(conv->Size, conv->Type);
+
+      if (!conv->Stale && offset < end && conv->Offset < offset + size) {
+         conv->Stale = GL_TRUE;
+         ctx->NewState |= _NEW_BUFFER_OBJECT;
+      }
+   }
+}
+
+
+/** Retired GL_STREAM_DRAW storages a buffer keeps around to cycle through */
+#define MAX_SPARE_STORAGE 3
+
+/** Smallest copy or clear worth handing to the GX engines */
+#define MIN_GX_TRANSFER_SIZE 4096
+
+
+static inline GLboolean
+fence_passed(const struct gl_context *ctx, GLuint fence)
+{
+   return (GLint) (ctx->Shared->PendingFence - fence) > 0;
+}
+
+
+/**
+ * Retire the storage of a buffer object the GPU may still read.
+ * GL_STREAM_DRAW buffers keep a few storages to cycle through, the others
+ * hand it back to the pool, which releases it once the frame has executed.
+ */
+static void
+retire_storage(struct gl_context *ctx, struct gl_buffer_object *bufObj)
+{
+   struct gl_retired_storage *spare;
+   GLuint spares = 0;
+
+   for (spare = bufObj->Spare; spare; spare = spare->Next)
+      spares++;
+
+   spare = NULL;
+   if (bufObj->Usage == GL_STREAM_DRAW && spares < MAX_SPARE_STORAGE)
+      spare = MALLOC_STRUCT(gl_retired_storage);
+
+   if (spare) {
+      spare->Data = bufObj->Data;
+      spare->Size = bufObj->Size;
+      spare->Fence = bufObj->LastUseFence;
+      spare->Next = bufObj->Spare;
+      bufObj->Spare = spare;
+   }
+   else {
+      _gl3ds_buffer_retire(ctx->Shared->BufferPool, bufObj->Data,
+                           bufObj->Size, bufObj->LastUseFence);
+   }
+
+   bufObj->Data = NULL;
+   bufObj->Size = 0;
+   /* No command or transfer uses the storage that replaces it yet */
+   bufObj->LastUseFence = ctx->Shared->PendingFence - 1;
+   bufObj->TransferSerial = ctx->Shared->TransferDone;
+   bufObj->InvalidBegin = bufObj->InvalidEnd = 0;
+
+   /* Vertex and index loaders point at the old storage */
+   ctx->NewState |= _NEW_BUFFER_OBJECT;
+}
+
+
+/**
+ * Take a spare storage of \p size bytes the GPU is done with, if any.
+ */
+static GLubyte *
+take_spare_storage(struct gl_context *ctx, struct gl_buffer_object *bufObj,
+                   GLsizeiptr size)
+{
+   struct gl_retired_storage **prev = &bufObj->Spare;
+   struct gl_retired_storage *spare;
+
+   while ((spare = *prev)) {
+      if (spare->Size == size && fence_passed(ctx, spare->Fence)) {
+         GLubyte *data = spare->Data;
+         *prev = spare->Next;
+         free(spare);
+         return data;
+      }
+      prev = &spare->Next;
+   }
+
+   return NULL;
+}
+
+
+/**
+ * Hand all of a buffer object's spare storage back to the pool.
+ */
+static void
+release_spare_storage(struct gl_context *ctx, struct gl_buffer_object *bufObj)
+{
+   while (bufObj->Spare) {
+      struct gl_retired_storage *spare = bufObj->Spare;
+      bufObj->Spare = spare->Next;
+      _gl3ds_buffer_retire(ctx->Shared->BufferPool, spare->Data,
+                           spare->Size, spare->Fence);
+      free(spare);
+   }
+}
+
+
+/**
+ * Wait for the queued GX work to complete.
+ *
+ * The GSP events don't count how often they were signalled, so each has
+ * to be waited for before it is queued again.  Buffer transfers aren't
+ * waited for one by one: the GX queue runs in order, so they are done once
+ * the commands run after them have executed, when the signals they left
+ * are cleared.
+ */
+void
+_gl3ds_finish_transfer(struct gl_context *ctx)
+{
+   struct gl_shared_state *shared = ctx->Shared;
+   GLuint event, serial;
+
+   for (event = 0; event < GSPGPU_EVENT_MAX; event++) {
+      if (ctx->TransferEvents & (1 << event))
+         gspWaitForEvent((GSPGPU_Event) event, false);
+   }
+   ctx->TransferEvents = 0;
+
+   if (!ctx->TransferStray)
+      return;
+
+   mtx_lock(&shared->Mutex);
+   serial = shared->TransferSerial;
+   mtx_unlock(&shared->Mutex);
+
+   _gl3ds_run_commands(ctx);
+   gspWaitForP3D();
+
+   for (event = 0; event < GSPGPU_EVENT_MAX; event++) {
+      if (ctx->TransferStray & (1 << event))
+         gspWaitForEvent((GSPGPU_Event) event, false);
+   }
+   ctx->TransferStray = 0;
+
+   mtx_lock(&shared->Mutex);
+   if ((GLint) (serial - shared->TransferDone) > 0)
+      shared->TransferDone = serial;
+   mtx_unlock(&shared->Mutex);
+}
+
+
+/**
+ * Get ready to queue a GX buffer transfer signalling \p event.  GX work
+ * queued before with the same event is waited for first, so its waiter
+ * can't take the transfer's signal for its own.
+ */
+static void
+begin_transfer(struct gl_context *ctx, GSPGPU_Event event)
+{
+   if (ctx->TransferEvents & (1 << event))
+      _gl3ds_finish_transfer(ctx);
+}
+
+
+/**
+ * Record the GX transfer just queued, which writes [begin, end) of the
+ * storage of \p bufObj, reading from \p src if not NULL.  The CPU waits
+ * for it only when it touches either storage, which stays allocated until
+ * the frame running after it has executed.
+ */
+static void
+queue_transfer(struct gl_context *ctx, struct gl_buffer_object *bufObj,
+               struct gl_buffer_object *src, GSPGPU_Event event,
+               GLintptr begin, GLintptr end)
+{
+   struct gl_shared_state *shared = ctx->Shared;
+   GLuint serial;
+
+   mtx_lock(&shared->Mutex);
+   serial = ++shared->TransferSerial;
+   mtx_unlock(&shared->Mutex);
+
+   ctx->TransferStray |= 1 << event;
+
+   _gl3ds_bufferobj_use(ctx, bufObj);
+   bufObj->TransferSerial = serial;
+   if (bufObj->InvalidEnd > bufObj->InvalidBegin) {
+      if (bufObj->InvalidBegin < begin)
+         begin = bufObj->InvalidBegin;
+      if (bufObj->InvalidEnd > end)
+         end = bufObj->InvalidEnd;
+   }
+   bufObj->InvalidBegin = begin;
+   bufObj->InvalidEnd = end;
+
+   if (src) {
+      _gl3ds_bufferobj_use(ctx, src);
+      src->TransferSerial = serial;
+   }
+}
+
+
+/**
+ * Will part of [begin, end) of a storage be copied by the CPU?
+ */
+static inline GLboolean
+cpu_copied(GLintptr begin, GLintptr end)
+{
+   return begin < end &&
+          (end - begin < MIN_GX_TRANSFER_SIZE || ((begin | end) & 15));
+}
+
+
+/**
+ * Copy [begin, end) of \p old, the storage a buffer object's new storage
+ * replaced.  The 16-byte aligned part of a large range is copied with a GX
+ * texture copy, behind the transfers still writing \p old, the bytes
+ * around it by the CPU.
+ */
+static void
+copy_storage(struct gl_context *ctx, struct gl_buffer_object *bufObj,
+             const GLubyte *old, GLintptr begin, GLintptr end, GLboolean gx)
+{
+   GLubyte *data = bufObj->Data;
+   GLintptr head, tail;
+
+   if (begin == end)
+      return;
+
+   if (!gx || end - begin < MIN_GX_TRANSFER_SIZE) {
+      memcpy(data + begin, old + begin, end - begin);
+      GSPGPU_FlushDataCache(data + begin, end - begin);
+      return;
+   }
+
+   head = (begin + 15) & ~15;
+   tail = end & ~15;
+
+   if (head > begin) {
+      memcpy(data + begin, old + begin, head - begin);
+      GSPGPU_FlushDataCache(data + begin, head - begin);
+   }
+   if (end > tail) {
+      memcpy(data + tail, old + tail, end - tail);
+      GSPGPU_FlushDataCache(data + tail, end - tail);
+   }
+
+   GSPGPU_FlushDataCache(old + head, tail - head);
+   GSPGPU_FlushDataCache(data + head, tail - head);
+   begin_transfer(ctx, GSPGPU_EVENT_PPF);
+   GX_TextureCopy((u32 *) (old + head), 0, (u32 *) (data + head), 0,
+                  tail - head, GX_TRANSFER_RAW_COPY(1));
+   queue_transfer(ctx, bufObj, NULL, GSPGPU_EVENT_PPF, head, tail);
+}
+
+
+/**
+ * Give a busy buffer object fresh storage before it's written, so commands
+ * already recorded keep reading the old contents.  The contents outside of
+ * [offset, offset + size), which the caller is about to overwrite, are
+ * copied over, by the GX engine if \p gx is set and they are large, by the
+ * CPU otherwise.  If no storage is available the buffer is left alone and
+ * written in place.
+ *
+ * \return GL_TRUE if the storage was replaced
+ */
+static GLboolean
+rename_storage(struct gl_context *ctx, struct gl_buffer_object *bufObj,
+               GLintptr offset, GLsizeiptr size, GLboolean gx)
+{
+   const GLsizeiptr bufSize = bufObj->Size;
+   GLubyte *old = bufObj->Data;
+   GLubyte *data;
+
+   /* The application holds on to pointers into persistent mappings */
+   if (bufObj->Mappings[MAP_USER].AccessFlags & GL_MAP_PERSISTENT_BIT)
+      return GL_FALSE;
+
+   data = take_spare_storage(ctx, bufObj, bufSize);
+   if (!data)
+      data = _gl3ds_buffer_alloc(ctx->Shared->BufferPool, bufSize);
+   if (!data)
+      return GL_FALSE;
+
+   /* What the CPU copies must have landed, the GX copies queue behind it */
+   if (!gx || cpu_copied(0, offset) || cpu_copied(offset + size, bufSize))
+      _gl3ds_bufferobj_sync(ctx, bufObj);
+   else if (ctx->ReadBack.Buffer == bufObj)
+      _gl3ds_finish_readback(ctx);
+
+   /* The old storage is kept until the GX copies from it are done */
+   if (gx && (offset >= MIN_GX_TRANSFER_SIZE ||
+              bufSize - offset - size >= MIN_GX_TRANSFER_SIZE))
+      _gl3ds_bufferobj_use(ctx, bufObj);
+
+   retire_storage(ctx, bufObj);
+   bufObj->Data = data;
+   bufObj->Size = bufSize;
+
+   copy_storage(ctx, bufObj, old, 0, offset, gx);
+   copy_storage(ctx, bufObj, old, offset + size, bufSize, gx);
+   return GL_TRUE;
+}
+
+
+/**
+ * Get a buffer object's storage ready for the CPU to overwrite
+ * [offset, offset + size): rename it if the GPU may still read it, or else
+ * wait for the transfers queued on it.
+ */
+void
+_gl3ds_bufferobj_prepare_write(struct gl_context *ctx,
+                               struct gl_buffer_object *bufObj,
+                               GLintptr offset, GLsizeiptr size)
+{
+   if (!_gl3ds_bufferobj_busy(ctx, bufObj) ||
+       !rename_storage(ctx, bufObj, offset, size, GL_TRUE))
+      _gl3ds_bufferobj_sync(ctx, bufObj);
+}
+
+
 /**
  * Delete a buffer object.
  * 
@@ -403,9 +758,14 @@ static void
 _mesa_delete_buffer_object(struct gl_context *ctx,
                            struct gl_buffer_object *bufObj)
 {
-   (void) ctx;
+   _gl3ds_free_converted_arrays(ctx, bufObj);
+   if (ctx->ReadBack.Buffer == bufObj)
+      _gl3ds_finish_readback(ctx);
+   release_spare_storage(ctx, bufObj);
 
-   _mesa_align_free(bufObj->Data);
+   /* Released once the frames drawing from it have executed */
+   _gl3ds_buffer_retire(ctx->Shared->BufferPool, bufObj->Data, bufObj->Size,
+                        bufObj->LastUseFence);
 
    /* assign strange values here to help w/ debugging */
    bufObj->RefCount = -1000;
@@ -557,9 +917,28 @@ buffer_data_fallback(struct gl_context *ctx, GLenum target, GLsizeiptr size,
 
    (void) target;
 
-   _mesa_align_free( bufObj->Data );
+   _gl3ds_free_converted_arrays(ctx, bufObj);
+   if (ctx->ReadBack.Buffer == bufObj)
+      _gl3ds_finish_readback(ctx);
+
+   /* Orphan storage the GPU or the GX engines may still use instead of
+    * overwriting it */
+   if (_gl3ds_bufferobj_busy(ctx, bufObj))
+      retire_storage(ctx, bufObj);
+   else
+      _gl3ds_bufferobj_sync(ctx, bufObj);
+
+   if (!bufObj->Data) {
+      bufObj->Data = take_spare_storage(ctx, bufObj, size);
+      bufObj->Size = bufObj->Data ? size : 0;
+   }
+
+   if (usage != GL_STREAM_DRAW)
+      release_spare_storage(ctx, bufObj);
 
-   new_data = _mesa_align_malloc( size, ctx->Const.MinMapBufferAlignment );
+   /* Storage is kept if the new size falls in the same size class */
+   new_data = _gl3ds_buffer_realloc(ctx->Shared->BufferPool, bufObj->Data,
+                                    bufObj->Size, size);
    if (new_data) {
       bufObj->Data = (GLubyte *) new_data;
       bufObj->Size = size;
@@ -568,11 +947,14 @@ buffer_data_fallback(struct gl_context *ctx, GLenum target, GLsizeiptr size,
 
       if (data) {
 	 memcpy( bufObj->Data, data, size );
+         GSPGPU_FlushDataCache(bufObj->Data, size);
       }
 
       return GL_TRUE;
    }
    else {
+      bufObj->Data = NULL;
+      bufObj->Size = 0;
       return GL_FALSE;
    }
 }
@@ -599,13 +981,15 @@ buffer_sub_data_fallback(struct gl_context *ctx, GLintptr offset,
                          GLsizeiptr size, const GLvoid *data,
                          struct gl_buffer_object *bufObj)
 {
-   (void) ctx;
-
    /* this should have been caught in _mesa_BufferSubData() */
    assert(size + offset <= bufObj->Size);
 
    if (bufObj->Data) {
+      _gl3ds_bufferobj_prepare_write(ctx, bufObj, offset, size);
+
       memcpy( (GLubyte *) bufObj->Data + offset, data, size );
+      GSPGPU_FlushDataCache(bufObj->Data + offset, size);
+      _gl3ds_invalidate_converted_arrays(ctx, bufObj, offset, size);
    }
 }
 
@@ -632,9 +1016,8 @@ _mesa_buffer_get_subdata( struct gl_context *ctx, GLintptr offset,
 			  GLsizeiptr size, GLvoid * data,
 			  struct gl_buffer_object * bufObj )
 {
-   (void) ctx;
-
    if (bufObj->Data && ((GLsizeiptr) (size + offset) <= bufObj->Size)) {
+      _gl3ds_bufferobj_sync(ctx, bufObj);
       memcpy( data, (GLubyte *) bufObj->Data + offset, size );
    }
 }
@@ -704,13 +1087,36 @@ map_buffer_range_fallback(struct gl_context *ctx, GLintptr offset,
                           struct gl_buffer_object *bufObj,
                           gl_map_buffer_index index)
 {
-   (void) ctx;
    assert(!_mesa_bufferobj_mapped(bufObj, index));
-   /* Just return a direct pointer to the data */
+   _gl3ds_bufferobj_sync(ctx, bufObj);
+   if (access & GL_MAP_WRITE_BIT) {
+      if (!(access & GL_MAP_UNSYNCHRONIZED_BIT) &&
+          _gl3ds_bufferobj_busy(ctx, bufObj)) {
+         if (access & GL_MAP_INVALIDATE_BUFFER_BIT)
+            rename_storage(ctx, bufObj, 0, bufObj->Size, GL_FALSE);
+         else if (access & GL_MAP_INVALIDATE_RANGE_BIT)
+            rename_storage(ctx, bufObj, offset, length, GL_FALSE);
+         else
+            rename_storage(ctx, bufObj, 0, 0, GL_FALSE);
+      }
+      _gl3ds_invalidate_converted_arrays(ctx, bufObj, offset, length);
+   }
+   /* Just return a direct pointer to the data, the storage is linear
+    * memory the GPU reads from.
+    */
    bufObj->Mappings[index].Pointer = bufObj->Data + offset;
    bufObj->Mappings[index].Length = length;
    bufObj->Mappings[index].Offset = offset;
    bufObj->Mappings[index].AccessFlags = access;
+
+   /* Writes through coherent mappings are flushed at each submission */
+   if (index == MAP_USER &&
+       (access & (GL_MAP_COHERENT_BIT | GL_MAP_WRITE_BIT)) ==
+       (GL_MAP_COHERENT_BIT | GL_MAP_WRITE_BIT)) {
+      bufObj->NextCoherent = ctx->Shared->CoherentMappings;
+      ctx->Shared->CoherentMappings = bufObj;
+   }
+
    return bufObj->Mappings[index].Pointer;
 }
 
@@ -725,11 +1131,13 @@ flush_mapped_buffer_range_fallback(struct gl_context *ctx,
                                    struct gl_buffer_object *obj,
                                    gl_map_buffer_index index)
 {
-   (void) ctx;
-   (void) offset;
-   (void) length;
-   (void) obj;
-   /* no-op */
+   GLubyte *ptr = (GLubyte *) obj->Mappings[index].Pointer + offset;
+
+   /* Only the range written needs to leave the CPU data cache */
+   GSPGPU_FlushDataCache(ptr, length);
+   _gl3ds_invalidate_converted_arrays(ctx, obj,
+                                      obj->Mappings[index].Offset + offset,
+                                      length);
 }
 
 
@@ -744,7 +1152,23 @@ static GLboolean
 unmap_buffer_fallback(struct gl_context *ctx, struct gl_buffer_object *bufObj,
                       gl_map_buffer_index index)
 {
-   (void) ctx;
+   const GLbitfield access = bufObj->Mappings[index].AccessFlags;
+
+   /* Explicitly flushed ranges have been written back already */
+   if ((access & GL_MAP_WRITE_BIT) && !(access & GL_MAP_FLUSH_EXPLICIT_BIT))
+      GSPGPU_FlushDataCache(bufObj->Mappings[index].Pointer,
+                            bufObj->Mappings[index].Length);
+
+   if (index == MAP_USER &&
+       (access & (GL_MAP_COHERENT_BIT | GL_MAP_WRITE_BIT)) ==
+       (GL_MAP_COHERENT_BIT | GL_MAP_WRITE_BIT)) {
+      struct gl_buffer_object **prev = &ctx->Shared->CoherentMappings;
+      while (*prev != bufObj)
+         prev = &(*prev)->NextCoherent;
+      *prev = bufObj->NextCoherent;
+      bufObj->NextCoherent = NULL;
+   }
+
    /* XXX we might assert here that bufObj->Pointer is non-null */
    bufObj->Mappings[index].Pointer = NULL;
    bufObj->Mappings[index].Length = 0;
@@ -754,6 +1178,192 @@ unmap_buffer_fallback(struct gl_context *ctx, struct gl_buffer_object *bufObj,
 }
 
 
+/**
+ * Build the 32-bit GX memory fill value for a clear value, with the bytes
+ * starting \p phase bytes into the repeating pattern.  Only clear values
+ * repeating every four bytes can be filled with.
+ */
+static GLboolean
+fill_pattern(const GLubyte *clearValue, GLsizeiptr clearValueSize,
+             GLsizeiptr phase, u32 *pattern)
+{
+   GLsizeiptr i;
+
+   if (4 % clearValueSize != 0) {
+      if (clearValueSize % 4 != 0)
+         return GL_FALSE;
+      for (i = 4; i < clearValueSize; i++) {
+         if (clearValue[i] != clearValue[i - 4])
+            return GL_FALSE;
+      }
+   }
+
+   *pattern = 0;
+   for (i = 0; i < 4; i++)
+      *pattern |= (u32) clearValue[(phase + i) % clearValueSize] << (8 * i);
+
+   return GL_TRUE;
+}
+
+
+/**
+ * Clear [begin, end) of a range starting at \p dest with the CPU.
+ */
+static void
+fill_bytes(GLubyte *dest, GLsizeiptr begin, GLsizeiptr end,
+           const GLubyte *clearValue, GLsizeiptr clearValueSize)
+{
+   GLsizeiptr i;
+
+   if (begin == end)
+      return;
+
+   for (i = begin; i < end; i++)
+      dest[i] = clearValue[i % clearValueSize];
+
+   GSPGPU_FlushDataCache(dest + begin, end - begin);
+}
+
+
+/**
+ * Clear a large range of a buffer object with the GX memory fill engine.
+ * The 16-byte aligned part of the range is filled by the GPU, in order with
+ * the rest of the GX queue, the bytes around it by the CPU.
+ *
+ * \return GL_FALSE if the range is too small or the clear value can't be
+ *         expressed as a fill value, and the caller must clear it.
+ */
+static GLboolean
+clear_buffer_sub_data_gx(struct gl_context *ctx,
+                         GLintptr offset, GLsizeiptr size,
+                         const GLubyte *clearValue,
+                         GLsizeiptr clearValueSize,
+                         struct gl_buffer_object *bufObj)
+{
+   static const GLubyte zero[4];
+   GLubyte *dest;
+   GLsizeiptr head, tail;
+   u32 pattern;
+
+   if (size < MIN_GX_TRANSFER_SIZE || !bufObj->Data)
+      return GL_FALSE;
+
+   if (!clearValue) {
+      clearValue = zero;
+      clearValueSize = 1;
+   }
+
+   _gl3ds_bufferobj_prepare_write(ctx, bufObj, offset, size);
+
+   dest = bufObj->Data + offset;
+   head = -(uintptr_t) dest & 15;
+   tail = (size - head) & 15;
+
+   if (!fill_pattern(clearValue, clearValueSize, head, &pattern))
+      return GL_FALSE;
+
+   fill_bytes(dest, 0, head, clearValue, clearValueSize);
+   fill_bytes(dest, size - tail, size, clearValue, clearValueSize);
+
+   /* Dirty lines written back later would overwrite the fill */
+   GSPGPU_FlushDataCache(dest + head, size - head - tail);
+   begin_transfer(ctx, GSPGPU_EVENT_PSC0);
+   GX_MemoryFill((u32 *) (dest + head), pattern, (u32 *) (dest + size - tail),
+                 GX_FILL_TRIGGER | GX_FILL_32BIT_DEPTH, NULL, 0, NULL, 0);
+   queue_transfer(ctx, bufObj, NULL, GSPGPU_EVENT_PSC0, offset + head,
+                  offset + size - tail);
+
+   _gl3ds_invalidate_converted_arrays(ctx, bufObj, offset, size);
+   return GL_TRUE;
+}
+
+
+/**
+ * Default fallback for \c dd_function_table::ClearBufferSubData().
+ * Called via glClearBuffer[Sub]Data().
+ */
+static void
+clear_buffer_sub_data_fallback(struct gl_context *ctx,
+                               GLintptr offset, GLsizeiptr size,
+                               const GLvoid *clearValue,
+                               GLsizeiptr clearValueSize,
+                               struct gl_buffer_object *bufObj)
+{
+   if (!clear_buffer_sub_data_gx(ctx, offset, size, clearValue,
+                                 clearValueSize, bufObj)) {
+      _mesa_ClearBufferSubData_sw(ctx, offset, size, clearValue,
+                                  clearValueSize, bufObj);
+   }
+}
+
+
+/**
+ * Copy a large range between buffer objects with a GX texture copy in raw
+ * mode.  The 16-byte aligned part of the range is copied by the GPU, in
+ * order with the rest of the GX queue, the bytes around it by the CPU.
+ *
+ * \return GL_FALSE if the range is too small or the source and destination
+ *         aren't equally aligned, and the caller must copy it.
+ */
+static GLboolean
+copy_buffer_sub_data_gx(struct gl_context *ctx,
+                        struct gl_buffer_object *src,
+                        struct gl_buffer_object *dst,
+                        GLintptr readOffset, GLintptr writeOffset,
+                        GLsizeiptr size)
+{
+   GLubyte *srcPtr, *dstPtr;
+   GLsizeiptr head, tail;
+
+   if (size < MIN_GX_TRANSFER_SIZE || !src->Data || !dst->Data ||
+       ((uintptr_t) (src->Data + readOffset) & 15) !=
+       ((uintptr_t) (dst->Data + writeOffset) & 15))
+      return GL_FALSE;
+
+   _gl3ds_bufferobj_prepare_write(ctx, dst, writeOffset, size);
+   if (ctx->ReadBack.Buffer == src)
+      _gl3ds_finish_readback(ctx);
+
+   srcPtr = src->Data + readOffset;
+   dstPtr = dst->Data + writeOffset;
+   if (((uintptr_t) srcPtr ^ (uintptr_t) dstPtr) & 15) {
+      /* Renamed to storage aligned differently */
+      _gl3ds_bufferobj_sync(ctx, src);
+      memcpy(dstPtr, srcPtr, size);
+      GSPGPU_FlushDataCache(dstPtr, size);
+      _gl3ds_invalidate_converted_arrays(ctx, dst, writeOffset, size);
+      return GL_TRUE;
+   }
+
+   head = -(uintptr_t) dstPtr & 15;
+   tail = (size - head) & 15;
+
+   /* The bytes the CPU copies must have landed, the rest queues behind */
+   if (head || tail)
+      _gl3ds_bufferobj_sync(ctx, src);
+
+   if (head) {
+      memcpy(dstPtr, srcPtr, head);
+      GSPGPU_FlushDataCache(dstPtr, head);
+   }
+   if (tail) {
+      memcpy(dstPtr + size - tail, srcPtr + size - tail, tail);
+      GSPGPU_FlushDataCache(dstPtr + size - tail, tail);
+   }
+
+   GSPGPU_FlushDataCache(srcPtr + head, size - head - tail);
+   GSPGPU_FlushDataCache(dstPtr + head, size - head - tail);
+   begin_transfer(ctx, GSPGPU_EVENT_PPF);
+   GX_TextureCopy((u32 *) (srcPtr + head), 0, (u32 *) (dstPtr + head), 0,
+                  size - head - tail, GX_TRANSFER_RAW_COPY(1));
+   queue_transfer(ctx, dst, src, GSPGPU_EVENT_PPF, writeOffset + head,
+                  writeOffset + size - tail);
+
+   _gl3ds_invalidate_converted_arrays(ctx, dst, writeOffset, size);
+   return GL_TRUE;
+}
+
+
 /**
  * Default fallback for \c dd_function_table::CopyBufferSubData().
  * Called via glCopyBufferSubData().
@@ -767,6 +1377,9 @@ copy_buffer_sub_data_fallback(struct gl_context *ctx,
 {
    GLubyte *srcPtr, *dstPtr;
 
+   if (copy_buffer_sub_data_gx(ctx, src, dst, readOffset, writeOffset, size))
+      return;
+
    if (src == dst) {
       srcPtr = dstPtr = ctx->Driver.MapBufferRange(ctx, 0, src->Size,
 						   GL_MAP_READ_BIT |
@@ -1108,7 +1721,7 @@ _mesa_init_buffer_object_functions(struct dd_function_table *driver)
    driver->UnmapBuffer = unmap_buffer_fallback;
 
    /* GL_ARB_clear_buffer_object */
-   driver->ClearBufferSubData = _mesa_ClearBufferSubData_sw;
+   driver->ClearBufferSubData = clear_buffer_sub_data_fallback;
 
    /* GL_ARB_map_buffer_range */
    driver->MapBufferRange = map_buffer_range_fallback;
@@ -1119,6 +1732,24 @@ _mesa_init_buffer_object_functions(struct dd_function_table *driver)
 }
 
 
+/**
+ * Write back the CPU data cache over the ranges of write mappings with
+ * GL_MAP_COHERENT_BIT, before the GPU executes the commands recorded.
+ */
+void
+_gl3ds_flush_coherent_mappings(struct gl_context *ctx)
+{
+   struct gl_buffer_object *bufObj;
+
+   for (bufObj = ctx->Shared->CoherentMappings; bufObj;
+        bufObj = bufObj->NextCoherent) {
+      const struct gl_buffer_mapping *map = &bufObj->Mappings[MAP_USER];
+      GSPGPU_FlushDataCache(map->Pointer, map->Length);
+      _gl3ds_invalidate_converted_arrays(ctx, bufObj, map->Offset, map->Length);
+   }
+}
+
+
 void
 _mesa_buffer_unmap_all_mappings(struct gl_context *ctx,
                                 struct gl_buffer_object *bufObj)
@@ -1327,26 +1958,26 @@ _mesa_buffer_storage(struct gl_context *ctx, struct gl_buffer_object *bufObj,
 
    if (flags & ~(GL_MAP_READ_BIT |
                  GL_MAP_WRITE_BIT |
-//                 GL_MAP_PERSISTENT_BIT |
-//                 GL_MAP_COHERENT_BIT |
+                 GL_MAP_PERSISTENT_BIT |
+                 GL_MAP_COHERENT_BIT |
                  GL_DYNAMIC_STORAGE_BIT |
                  GL_CLIENT_STORAGE_BIT)) {
       _mesa_error(ctx, GL_INVALID_VALUE, "%s(invalid flag bits set)", func);
       return;
    }
 
-//   if (flags & GL_MAP_PERSISTENT_BIT &&
-//       !(flags & (GL_MAP_READ_BIT | GL_MAP_WRITE_BIT))) {
-//      _mesa_error(ctx, GL_INVALID_VALUE,
-//                  "%s(PERSISTENT and flags!=READ/WRITE)", func);
-//      return;
-//   }
-//
-//   if (flags & GL_MAP_COHERENT_BIT && !(flags & GL_MAP_PERSISTENT_BIT)) {
-//      _mesa_error(ctx, GL_INVALID_VALUE,
-//                  "%s(COHERENT and flags!=PERSISTENT)", func);
-//      return;
-//   }
+   if (flags & GL_MAP_PERSISTENT_BIT &&
+       !(flags & (GL_MAP_READ_BIT | GL_MAP_WRITE_BIT))) {
+      _mesa_error(ctx, GL_INVALID_VALUE,
+                  "%s(PERSISTENT and flags!=READ/WRITE)", func);
+      return;
+   }
+
+   if (flags & GL_MAP_COHERENT_BIT && !(flags & GL_MAP_PERSISTENT_BIT)) {
+      _mesa_error(ctx, GL_INVALID_VALUE,
+                  "%s(COHERENT and flags!=PERSISTENT)", func);
+      return;
+   }
 
    if (bufObj->Immutable) {
       _mesa_error(ctx, GL_INVALID_OPERATION, "%s(immutable)", func);
@@ -1422,9 +2053,6 @@ _mesa_buffer_data(struct gl_context *ctx, struct gl_buffer_object *bufObj,
 
    switch (usage) {
    case GL_STREAM_DRAW:
-      valid_usage = false; //(ctx->API != API_OPENGLES);
-      break;
-
    case GL_STATIC_DRAW:
    case GL_DYNAMIC_DRAW:
       valid_usage = true;
@@ -1631,8 +2259,8 @@ _mesa_clear_buffer_sub_data(struct gl_context *ctx,
                             const GLvoid *data,
                             const char *func, bool subdata)
 {
-//   mesa_format mesaFormat;
-//   GLubyte clearValue[MAX_PIXEL_BYTES];
+   mesa_format mesaFormat;
+   GLubyte clearValue[MAX_PIXEL_BYTES];
    GLsizeiptr clearValueSize;
 
    /* This checks for disallowed mappings. */
@@ -1641,14 +2269,14 @@ _mesa_clear_buffer_sub_data(struct gl_context *ctx,
       return;
    }
 
-//   mesaFormat = validate_clear_buffer_format(ctx, internalformat,
-//                                             format, type, func);
+   mesaFormat = validate_clear_buffer_format(ctx, internalformat,
+                                             format, type, func);
 
-//   if (mesaFormat == MESA_FORMAT_NONE) {
-//      return;
-//   }
+   if (mesaFormat == MESA_FORMAT_NONE) {
+      return;
+   }
 
-//   clearValueSize = _mesa_get_format_bytes(mesaFormat);
+   clearValueSize = _mesa_get_format_bytes(mesaFormat);
    if (offset % clearValueSize != 0 || size % clearValueSize != 0) {
       _mesa_error(ctx, GL_INVALID_VALUE,
                   "%s(offset or size is not a multiple of "
@@ -1665,15 +2293,15 @@ _mesa_clear_buffer_sub_data(struct gl_context *ctx,
       return;
    }
 
-//   if (!convert_clear_buffer_data(ctx, mesaFormat, clearValue,
-//                                  format, type, data, func)) {
-//      return;
-//   }
+   if (!convert_clear_buffer_data(ctx, mesaFormat, clearValue,
+                                  format, type, data, func)) {
+      return;
+   }
 
-//   if (size > 0) {
-//      ctx->Driver.ClearBufferSubData(ctx, offset, size,
-//                                     clearValue, clearValueSize, bufObj);
-//   }
+   if (size > 0) {
+      ctx->Driver.ClearBufferSubData(ctx, offset, size,
+                                     clearValue, clearValueSize, bufObj);
+   }
 }
 
 void glClearBufferData(GLenum target, GLenum internalformat, GLenum format,
@@ -2143,10 +2771,10 @@ _mesa_map_buffer_range(struct gl_context *ctx,
                     GL_MAP_FLUSH_EXPLICIT_BIT |
                     GL_MAP_UNSYNCHRONIZED_BIT;
 
-//   if (ctx->Extensions.ARB_buffer_storage) {
-//         allowed_access |= GL_MAP_PERSISTENT_BIT |
-//                           GL_MAP_COHERENT_BIT;
-//   }
+   if (ctx->Extensions.ARB_buffer_storage) {
+         allowed_access |= GL_MAP_PERSISTENT_BIT |
+                           GL_MAP_COHERENT_BIT;
+   }
 
    if (access & ~allowed_access) {
       /* generate an error if any bits other than those allowed are set */
@@ -2191,19 +2819,19 @@ _mesa_map_buffer_range(struct gl_context *ctx,
       return NULL;
    }
 
-//   if (access & GL_MAP_COHERENT_BIT &&
-//       !(bufObj->StorageFlags & GL_MAP_COHERENT_BIT)) {
-//      _mesa_error(ctx, GL_INVALID_OPERATION,
-//                  "%s(buffer does not allow coherent access)", func);
-//      return NULL;
-//   }
-//
-//   if (access & GL_MAP_PERSISTENT_BIT &&
-//       !(bufObj->StorageFlags & GL_MAP_PERSISTENT_BIT)) {
-//      _mesa_error(ctx, GL_INVALID_OPERATION,
-//                  "%s(buffer does not allow persistent access)", func);
-//      return NULL;
-//   }
+   if (access & GL_MAP_COHERENT_BIT &&
+       !(bufObj->StorageFlags & GL_MAP_COHERENT_BIT)) {
+      _mesa_error(ctx, GL_INVALID_OPERATION,
+                  "%s(buffer does not allow coherent access)", func);
+      return NULL;
+   }
+
+   if (access & GL_MAP_PERSISTENT_BIT &&
+       !(bufObj->StorageFlags & GL_MAP_PERSISTENT_BIT)) {
+      _mesa_error(ctx, GL_INVALID_OPERATION,
+                  "%s(buffer does not allow persistent access)", func);
+      return NULL;
+   }
 
    if (offset + length > bufObj->Size) {
       _mesa_error(ctx, GL_INVALID_VALUE,
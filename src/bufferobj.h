@@ -48,10 +48,85 @@ _mesa_bufferobj_mapped(const struct gl_buffer_object *obj, gl_map_buffer_index i
 static inline GLboolean
 _mesa_check_disallowed_mapping(const struct gl_buffer_object *obj)
 {
-//   return _mesa_bufferobj_mapped(obj, MAP_USER) &&
-//          !(obj->Mappings[MAP_USER].AccessFlags &
-//            GL_MAP_PERSISTENT_BIT);
-	return GL_FALSE;
+   return _mesa_bufferobj_mapped(obj, MAP_USER) &&
+          !(obj->Mappings[MAP_USER].AccessFlags &
+            GL_MAP_PERSISTENT_BIT);
+}
+
+/**
+ * Is \p fence that of a frame some context of the share group is still
+ * recording, whose commands the GPU has yet to execute?
+ */
+static inline GLboolean
+_gl3ds_fence_pending(const struct gl_context *ctx, GLuint fence)
+{
+   return (GLint) (fence - ctx->Shared->PendingFence) >= 0;
+}
+
+/**
+ * Is the buffer's storage read by commands the GPU has yet to execute?
+ */
+static inline GLboolean
+_gl3ds_bufferobj_busy(const struct gl_context *ctx,
+                      const struct gl_buffer_object *obj)
+{
+   return obj->Data != NULL && _gl3ds_fence_pending(ctx, obj->LastUseFence);
+}
+
+extern void
+_gl3ds_finish_transfer(struct gl_context *ctx);
+
+extern void
+_gl3ds_finish_readback(struct gl_context *ctx);
+
+extern void
+_gl3ds_bufferobj_prepare_write(struct gl_context *ctx,
+                               struct gl_buffer_object *bufObj,
+                               GLintptr offset, GLsizeiptr size);
+
+/**
+ * Note that commands of the frame the context records read the buffer.  Pixels
+ * read into it are packed first.
+ */
+static inline void
+_gl3ds_bufferobj_use(struct gl_context *ctx,
+                     struct gl_buffer_object *obj)
+{
+   if (ctx->ReadBack.Buffer == obj)
+      _gl3ds_finish_readback(ctx);
+   /* Another context may be recording a later frame */
+   if ((GLint) (ctx->FrameFence - obj->LastUseFence) > 0)
+      obj->LastUseFence = ctx->FrameFence;
+}
+
+/**
+ * Is a GX transfer writing to or reading from the buffer's storage still
+ * queued?
+ */
+static inline GLboolean
+_gl3ds_transfer_pending(const struct gl_context *ctx,
+                        const struct gl_buffer_object *obj)
+{
+   return (GLint) (obj->TransferSerial - ctx->Shared->TransferDone) > 0;
+}
+
+/**
+ * Wait for the GX transfers writing to or reading from the buffer's
+ * storage, if any, drop the lines the CPU cached over what they wrote and
+ * pack the pixels read into it, before the CPU touches it.
+ */
+static inline void
+_gl3ds_bufferobj_sync(struct gl_context *ctx, struct gl_buffer_object *obj)
+{
+   if (ctx->ReadBack.Buffer == obj)
+      _gl3ds_finish_readback(ctx);
+   if (_gl3ds_transfer_pending(ctx, obj))
+      _gl3ds_finish_transfer(ctx);
+   if (obj->InvalidEnd > obj->InvalidBegin) {
+      GSPGPU_InvalidateDataCache(obj->Data + obj->InvalidBegin,
+                                 obj->InvalidEnd - obj->InvalidBegin);
+      obj->InvalidBegin = obj->InvalidEnd = 0;
+   }
 }
 
 /**
@@ -123,6 +198,18 @@ _mesa_reference_buffer_object(struct gl_context *ctx,
       _mesa_reference_buffer_object_(ctx, ptr, bufObj);
 }
 
+extern void
+_gl3ds_free_converted_arrays(struct gl_context *ctx,
+                             struct gl_buffer_object *bufObj);
+
+extern void
+_gl3ds_invalidate_converted_arrays(struct gl_context *ctx,
+                                   struct gl_buffer_object *bufObj,
+                                   GLintptr offset, GLsizeiptr size);
+
+extern void
+_gl3ds_flush_coherent_mappings(struct gl_context *ctx);
+
 extern GLuint
 _mesa_total_buffer_object_memory(struct gl_context *ctx);
 
@@ -117,6 +117,22 @@ typedef GLuint64 GLbitfield64;
  */
 #define MAX_ARRAY_TEXTURE_LAYERS 64
 
+/** Texture units sampled by the PICA200 fragment stage */
+#define PICA_TEXTURE_UNITS 3
+
+/** Texture combiner stages of the PICA200 */
+#define PICA_TEV_STAGES 6
+
+/** Lighting lookup table ids of the PICA200, and entries of each table */
+#define PICA_LIGHT_LUTS 24
+#define PICA_LIGHT_LUT_SIZE 256
+
+/** Lighting lookup tables kept generated by a context */
+#define MAX_LIGHT_LUT_CACHE 8
+
+/** Entries of the PICA200 fog lookup table */
+#define PICA_FOG_LUT_SIZE 128
+
 /**
  * Max number of texture coordinate units.  This mainly just applies to
  * the fixed-function vertex code.  This will be difficult to raise above
@@ -176,6 +192,7 @@ typedef GLuint64 GLbitfield64;
  */
 /*@{*/
 #define MAX_PROGRAM_LOCAL_PARAMS       4096
+#define MAX_FLOAT_UNIFORM_REGS         96 /* PICA vertex shader c0..c95 */
 #define MAX_UNIFORMS                   4096
 #define MAX_UNIFORM_BUFFERS            15 /* + 1 default uniform buffer */
 /* 6 is for vertex, hull, domain, geometry, fragment, and compute shader. */
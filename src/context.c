@@ -95,12 +95,12 @@
 #include "extensions.h"
 #include "fbobject.h"
 //#include "feedback.h"
-//#include "fog.h"
+#include "fog.h"
 #include "formats.h"
 #include "framebuffer.h"
 //#include "hint.h"
 #include "hash.h"
-//#include "light.h"
+#include "light.h"
 //#include "lines.h"
 #include "macros.h"
 #include "matrix.h"
@@ -122,6 +122,7 @@
 //#include "shaderimage.h"
 #include "util/simple_list.h"
 #include "state.h"
+#include "screenbuffer.h"
 #include "stencil.h"
 //#include "texcompress_s3tc.h"
 #include "texstate.h"
@@ -737,11 +738,11 @@ init_attrib_groups(struct gl_context *ctx)
 //   _mesa_init_eval( ctx );
 	_mesa_init_fbobjects( ctx );
 //   _mesa_init_feedback( ctx );
-//   _mesa_init_fog( ctx );
+   _mesa_init_fog( ctx );
 //   _mesa_init_hint( ctx );
 //   _mesa_init_image_units( ctx );
 //   _mesa_init_line( ctx );
-//   _mesa_init_lighting( ctx );
+   _mesa_init_lighting( ctx );
    _mesa_init_matrix( ctx );
    _mesa_init_multisample( ctx );
 //   _mesa_init_performance_monitors( ctx );
@@ -990,14 +991,16 @@ _mesa_initialize_context(struct gl_context *ctx,
    ctx->WinSysDrawBuffer = NULL;
    ctx->WinSysReadBuffer = NULL;
 
-	ctx->FrameBuffer = (u32*)vramMemAlign(400*240*8, 0x100);
-	ctx->DepthBuffer = (u32*)vramMemAlign(400*240*8, 0x100);
-//	ctx->FrameBuffer = (u32*)vramAlloc(400*240*8);
-//	ctx->DepthBuffer = (u32*)vramAlloc(400*240*8);
+	// Sized for ctx->Screen, which the caller has set
+	if (!visual || !_gl3ds_alloc_screen_buffers(ctx, visual))
+		return GL_FALSE;
 	ctx->CommandBufferSize = 0x40000;
 	ctx->CommandBufferOffset = 0;
 	ctx->CommandBuffer = (u32*)linearAlloc(ctx->CommandBufferSize * 4);
 	ctx->CommandBufferRight = (u32*)linearAlloc(ctx->CommandBufferSize * 4);
+	ctx->StreamBufferSize = 0x100000;
+	ctx->StreamBufferOffset = 0;
+	ctx->StreamBuffer = (u8*)linearAlloc(ctx->StreamBufferSize);
 
    if (visual) {
       ctx->Visual = *visual;
@@ -1032,6 +1035,7 @@ _mesa_initialize_context(struct gl_context *ctx,
    }
 
    _mesa_reference_shared_state(ctx, &ctx->Shared, shared);
+   _gl3ds_shared_attach_context(ctx);
 
    if (!init_attrib_groups( ctx ))
       goto fail;
@@ -1098,6 +1102,7 @@ _mesa_initialize_context(struct gl_context *ctx,
    return GL_TRUE;
 
 fail:
+   _gl3ds_shared_detach_context(ctx);
    _mesa_reference_shared_state(ctx, &ctx->Shared, NULL);
 //   free(ctx->BeginEnd);
 //   free(ctx->OutsideBeginEnd);
@@ -1192,6 +1197,10 @@ _mesa_free_context_data( struct gl_context *ctx )
 //   _mesa_free_sync_data(ctx);
    _mesa_free_varray_data(ctx);
 //   _mesa_free_transform_feedback(ctx);
+
+   _gl3ds_finish_readback(ctx);
+   linearFree(ctx->StreamBuffer);
+   _gl3ds_free_screen_buffers(ctx);
 //   _mesa_free_performance_monitors(ctx);
 
    _mesa_reference_buffer_object(ctx, &ctx->Pack.BufferObj, NULL);
@@ -1205,6 +1214,7 @@ _mesa_free_context_data( struct gl_context *ctx )
 //   free(ctx->Save);
 
    /* Shared context state (display lists, textures, etc) */
+   _gl3ds_shared_detach_context(ctx);
    _mesa_reference_shared_state(ctx, &ctx->Shared, NULL);
 
    /* needs to be after freeing shared state */
@@ -1614,7 +1624,9 @@ _mesa_share_state(struct gl_context *ctx, struct gl_context *ctxToShare)
       _mesa_reference_shared_state(ctx, &oldShared, ctx->Shared);
 
       /* update ctx's Shared pointer */
+      _gl3ds_shared_detach_context(ctx);
       _mesa_reference_shared_state(ctx, &ctx->Shared, ctxToShare->Shared);
+      _gl3ds_shared_attach_context(ctx);
 
       update_default_objects(ctx);
 
@@ -1789,7 +1801,7 @@ _mesa_valid_to_render(struct gl_context *ctx, const char *where)
 //      bool from_glsl_shader[MESA_SHADER_COMPUTE] = { false };
 
 //      for (i = 0; i < MESA_SHADER_COMPUTE; i++) {
-         if (!ctx->Shared->Shader->Program)
+         if (!ctx->Shared->Shader->_Current)
 //         if (!shader_linked_or_absent(ctx, ctx->_Shader->CurrentProgram[i],
 //                                      &from_glsl_shader[i], where))
             return GL_FALSE;
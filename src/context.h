@@ -334,6 +334,7 @@ _mesa_has_compute_shaders(const struct gl_context *ctx)
 
 
 void update_context(struct gl_context *ctx);
+void _gl3ds_run_commands(struct gl_context *ctx);
 
 // Set by gl3ds_makeCurrent()
 //extern struct gl_context* currentContext;
@@ -0,0 +1,176 @@
+/*
+ * Frustum culling on the CPU against the current modelview and projection.
+ *
+ * The planes are taken from _ModelProjectMatrix, so they are in object
+ * space and bounding volumes are tested as the application has them.  They
+ * are made again only after the matrix they come from changed.
+ *
+ * With GL3DS_CULL_SKIP_DRAW a batch nothing of which is visible drops the
+ * draw call that follows it, so the usual test-then-draw needs no branch.
+ */
+
+#include "glheader.h"
+#include "context.h"
+#include "cull.h"
+#include "macros.h"
+#include "matrix.h"
+#include "mtypes.h"
+
+/**
+ * Whether the planes are up to date, made from the top matrices.  Their
+ * product in _ModelProjectMatrix then is too.
+ */
+GLboolean _gl3ds_cull_current(const struct gl_context *ctx)
+{
+	const struct gl_cull_state *cull = &ctx->Cull;
+	const GLmatrix *proj = ctx->ProjectionMatrixStack.Top;
+	const GLmatrix *mv = ctx->ModelviewMatrixStack.Top;
+	GLuint transpose = (proj->flags & MAT_NEED_TRANSPOSE) | (mv->flags & MAT_NEED_TRANSPOSE) << 1;
+
+	return cull->Valid && cull->Transpose == transpose &&
+		   !memcmp(cull->Modelview, mv->m, sizeof(cull->Modelview)) &&
+		   !memcmp(cull->Projection, proj->m, sizeof(cull->Projection));
+}
+
+/**
+ * Bring the planes up to date.  A matrix change not drawn with yet is
+ * applied to _ModelProjectMatrix here, the draw then finds the product
+ * current and doesn't multiply the matrices again.
+ */
+static void update_planes(struct gl_context *ctx)
+{
+	struct gl_cull_state *cull = &ctx->Cull;
+	const GLmatrix *proj = ctx->ProjectionMatrixStack.Top;
+	const GLmatrix *mv = ctx->ModelviewMatrixStack.Top;
+	const GLfloat *m;
+	int i;
+
+	if (_gl3ds_cull_current(ctx))
+		return;
+	if (ctx->NewState & (_NEW_MODELVIEW | _NEW_PROJECTION))
+		_mesa_update_modelview_project(ctx, ctx->NewState);
+
+	// Rows of the product: the clip volume is -w <= x, y, z <= w
+	m = ctx->_ModelProjectMatrix.m;
+	for (i = 0; i < 3; i++) {
+		GLfloat *lo = cull->Planes[i * 2], *hi = cull->Planes[i * 2 + 1];
+		lo[0] = m[12] + m[i * 4 + 0];  hi[0] = m[12] - m[i * 4 + 0];
+		lo[1] = m[13] + m[i * 4 + 1];  hi[1] = m[13] - m[i * 4 + 1];
+		lo[2] = m[14] + m[i * 4 + 2];  hi[2] = m[14] - m[i * 4 + 2];
+		lo[3] = m[15] + m[i * 4 + 3];  hi[3] = m[15] - m[i * 4 + 3];
+	}
+
+	// Unit normals make plane distances those of the sphere radii
+	for (i = 0; i < 6; i++) {
+		GLfloat *p = cull->Planes[i];
+		GLfloat len = LEN_3FV(p);
+		if (len > 0.0F) {
+			GLfloat inv = 1.0F / len;
+			SELF_SCALE_SCALAR_4V(p, inv);
+		}
+	}
+
+	memcpy(cull->Modelview, mv->m, sizeof(cull->Modelview));
+	memcpy(cull->Projection, proj->m, sizeof(cull->Projection));
+	cull->Transpose = (proj->flags & MAT_NEED_TRANSPOSE) | (mv->flags & MAT_NEED_TRANSPOSE) << 1;
+	cull->Valid = GL_TRUE;
+}
+
+static GLboolean sphere_visible(const GLfloat planes[6][4], const GLfloat *s)
+{
+	int i;
+	for (i = 0; i < 6; i++) {
+		const GLfloat *p = planes[i];
+		if (p[0] * s[0] + p[1] * s[1] + p[2] * s[2] + p[3] < -s[3])
+			return GL_FALSE;
+	}
+	return GL_TRUE;
+}
+
+/** The box is out when its corner furthest along a normal is behind it */
+static GLboolean box_visible(const GLfloat planes[6][4], const GLfloat *b)
+{
+	int i;
+	for (i = 0; i < 6; i++) {
+		const GLfloat *p = planes[i];
+		GLfloat x = p[0] >= 0.0F ? b[3] : b[0];
+		GLfloat y = p[1] >= 0.0F ? b[4] : b[1];
+		GLfloat z = p[2] >= 0.0F ? b[5] : b[2];
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0F)
+			return GL_FALSE;
+	}
+	return GL_TRUE;
+}
+
+/**
+ * Test \p count volumes of \p size floats each, setting a bit in \p visible
+ * for each one that may be seen.
+ */
+static GLsizei cull_volumes(struct gl_context *ctx, const GLfloat *volumes, GLsizei count,
+							GLuint *visible, GLbitfield flags, GLuint size,
+							GLboolean (*test)(const GLfloat planes[6][4], const GLfloat *v),
+							const char *caller)
+{
+	GLsizei i, seen = 0;
+
+	if (count < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "%s(count=%d)", caller, count);
+		return 0;
+	}
+
+	if (flags & ~GL3DS_CULL_SKIP_DRAW) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "%s(flags=0x%x)", caller, flags);
+		return 0;
+	}
+
+	update_planes(ctx);
+
+	for (i = 0; i < count; i += 32) {
+		GLsizei n = MIN2(count - i, 32), j;
+		GLuint bits = 0;
+		for (j = 0; j < n; j++) {
+			if (test(ctx->Cull.Planes, volumes + (i + j) * size))
+				bits |= 1u << j;
+		}
+		if (visible)
+			visible[i / 32] = bits;
+		seen += _mesa_bitcount(bits);
+	}
+
+	if (flags & GL3DS_CULL_SKIP_DRAW)
+		ctx->Cull.SkipDraw = (seen == 0);
+
+	return seen;
+}
+
+/**
+ * Called by the draw calls, drops the one following a batch that was culled
+ * with GL3DS_CULL_SKIP_DRAW.  The draw calls take the flag on entry, so one
+ * that draws nothing or fails still consumes it.
+ */
+GLboolean _gl3ds_cull_draw(struct gl_context *ctx)
+{
+	GLboolean skip = ctx->Cull.SkipDraw;
+	ctx->Cull.SkipDraw = GL_FALSE;
+	return skip;
+}
+
+void gl3ds_getFrustumPlanes(GLfloat planes[6][4])
+{
+	GET_CURRENT_CONTEXT(ctx);
+
+	update_planes(ctx);
+	memcpy(planes, ctx->Cull.Planes, sizeof(ctx->Cull.Planes));
+}
+
+GLsizei gl3ds_cullSpheres(const GLfloat* spheres, GLsizei count, GLuint* visible, GLbitfield flags)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	return cull_volumes(ctx, spheres, count, visible, flags, 4, sphere_visible, "gl3ds_cullSpheres");
+}
+
+GLsizei gl3ds_cullBoxes(const GLfloat* boxes, GLsizei count, GLuint* visible, GLbitfield flags)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	return cull_volumes(ctx, boxes, count, visible, flags, 6, box_visible, "gl3ds_cullBoxes");
+}
@@ -0,0 +1,11 @@
+#ifndef GL3DS_CULL
+#define GL3DS_CULL
+
+#include "glheader.h"
+
+struct gl_context;
+
+GLboolean _gl3ds_cull_current(const struct gl_context *ctx);
+GLboolean _gl3ds_cull_draw(struct gl_context *ctx);
+
+#endif
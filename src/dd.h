@@ -719,7 +719,8 @@ struct dd_function_table {
                            GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1,
                            GLbitfield mask, GLenum filter);
    void (*DiscardFramebuffer)(struct gl_context *ctx,
-                              GLenum target, GLsizei numAttachments,
+                              struct gl_framebuffer *fb,
+                              GLsizei numAttachments,
                               const GLenum *attachments);
 
    /**
@@ -33,7 +33,7 @@
 #include "context.h"
 #include "enable.h"
 #include "errors.h"
-//#include "light.h"
+#include "light.h"
 #include "util/simple_list.h"
 #include "mtypes.h"
 #include "enums.h"
@@ -340,19 +340,19 @@ _mesa_set_enable(struct gl_context *ctx, GLenum cap, GLboolean state)
 //            }
 //         }
 //         break;
-//      case GL_COLOR_MATERIAL:
+      case GL_COLOR_MATERIAL:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//         if (ctx->Light.ColorMaterialEnabled == state)
-//            return;
-//         FLUSH_VERTICES(ctx, _NEW_LIGHT);
-//         FLUSH_CURRENT(ctx, 0);
-//         ctx->Light.ColorMaterialEnabled = state;
-//         if (state) {
-//            _mesa_update_color_material( ctx,
-//                                  ctx->Current.Attrib[VERT_ATTRIB_COLOR0] );
-//         }
-//         break;
+         if (ctx->Light.ColorMaterialEnabled == state)
+            return;
+         FLUSH_VERTICES(ctx, _NEW_LIGHT);
+         FLUSH_CURRENT(ctx, 0);
+         ctx->Light.ColorMaterialEnabled = state;
+         if (state) {
+            _mesa_update_color_material( ctx,
+                                  ctx->Current.Attrib[VERT_ATTRIB_COLOR0] );
+         }
+         break;
       case GL_CULL_FACE:
          if (ctx->Polygon.CullFlag == state)
             return;
@@ -378,44 +378,44 @@ _mesa_set_enable(struct gl_context *ctx, GLenum cap, GLboolean state)
 //         FLUSH_VERTICES(ctx, _NEW_COLOR);
 //         ctx->Color.DitherFlag = state;
 //         break;
-//      case GL_FOG:
+      case GL_FOG:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//         if (ctx->Fog.Enabled == state)
-//            return;
-//         FLUSH_VERTICES(ctx, _NEW_FOG);
-//         ctx->Fog.Enabled = state;
-//         break;
-//      case GL_LIGHT0:
-//      case GL_LIGHT1:
-//      case GL_LIGHT2:
-//      case GL_LIGHT3:
-//      case GL_LIGHT4:
-//      case GL_LIGHT5:
-//      case GL_LIGHT6:
-//      case GL_LIGHT7:
+         if (ctx->Fog.Enabled == state)
+            return;
+         FLUSH_VERTICES(ctx, _NEW_FOG);
+         ctx->Fog.Enabled = state;
+         break;
+      case GL_LIGHT0:
+      case GL_LIGHT1:
+      case GL_LIGHT2:
+      case GL_LIGHT3:
+      case GL_LIGHT4:
+      case GL_LIGHT5:
+      case GL_LIGHT6:
+      case GL_LIGHT7:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//         if (ctx->Light.Light[cap-GL_LIGHT0].Enabled == state)
-//            return;
-//         FLUSH_VERTICES(ctx, _NEW_LIGHT);
-//         ctx->Light.Light[cap-GL_LIGHT0].Enabled = state;
-//         if (state) {
-//            insert_at_tail(&ctx->Light.EnabledList,
-//                           &ctx->Light.Light[cap-GL_LIGHT0]);
-//         }
-//         else {
-//            remove_from_list(&ctx->Light.Light[cap-GL_LIGHT0]);
-//         }
-//         break;
-//      case GL_LIGHTING:
+         if (ctx->Light.Light[cap-GL_LIGHT0].Enabled == state)
+            return;
+         FLUSH_VERTICES(ctx, _NEW_LIGHT);
+         ctx->Light.Light[cap-GL_LIGHT0].Enabled = state;
+         if (state) {
+            insert_at_tail(&ctx->Light.EnabledList,
+                           &ctx->Light.Light[cap-GL_LIGHT0]);
+         }
+         else {
+            remove_from_list(&ctx->Light.Light[cap-GL_LIGHT0]);
+         }
+         break;
+      case GL_LIGHTING:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//         if (ctx->Light.Enabled == state)
-//            return;
-//         FLUSH_VERTICES(ctx, _NEW_LIGHT);
-//         ctx->Light.Enabled = state;
-//         break;
+         if (ctx->Light.Enabled == state)
+            return;
+         FLUSH_VERTICES(ctx, _NEW_LIGHT);
+         ctx->Light.Enabled = state;
+         break;
 //      case GL_LINE_SMOOTH:
 //         if (!_mesa_is_desktop_gl(ctx) && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
@@ -1205,10 +1205,10 @@ GLboolean glIsEnabled( GLenum cap )
 //
 //	 return (ctx->Transform.ClipPlanesEnabled >> p) & 1;
 //      }
-//      case GL_COLOR_MATERIAL:
+      case GL_COLOR_MATERIAL:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//	 return ctx->Light.ColorMaterialEnabled;
+	 return ctx->Light.ColorMaterialEnabled;
       case GL_CULL_FACE:
          return ctx->Polygon.CullFlag;
       case GL_DEBUG_OUTPUT:
@@ -1221,25 +1221,25 @@ GLboolean glIsEnabled( GLenum cap )
          return ctx->Depth.Test;
 //      case GL_DITHER:
 //	 return ctx->Color.DitherFlag;
-//      case GL_FOG:
+      case GL_FOG:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//	 return ctx->Fog.Enabled;
-//      case GL_LIGHTING:
+	 return ctx->Fog.Enabled;
+      case GL_LIGHTING:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//         return ctx->Light.Enabled;
-//      case GL_LIGHT0:
-//      case GL_LIGHT1:
-//      case GL_LIGHT2:
-//      case GL_LIGHT3:
-//      case GL_LIGHT4:
-//      case GL_LIGHT5:
-//      case GL_LIGHT6:
-//      case GL_LIGHT7:
+         return ctx->Light.Enabled;
+      case GL_LIGHT0:
+      case GL_LIGHT1:
+      case GL_LIGHT2:
+      case GL_LIGHT3:
+      case GL_LIGHT4:
+      case GL_LIGHT5:
+      case GL_LIGHT6:
+      case GL_LIGHT7:
 //         if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
-//         return ctx->Light.Light[cap-GL_LIGHT0].Enabled;
+         return ctx->Light.Light[cap-GL_LIGHT0].Enabled;
 //      case GL_LINE_SMOOTH:
 //         if (!_mesa_is_desktop_gl(ctx) && ctx->API != API_OPENGLES)
 //            goto invalid_enum_error;
@@ -711,6 +711,9 @@ _mesa_init_extensions(struct gl_extensions *extensions)
    /* Then, selectively turn default extensions on. */
    extensions->dummy_true = GL_TRUE;
    extensions->EXT_texture3D = GL_TRUE;
+   extensions->ARB_draw_instanced = GL_TRUE;
+   extensions->ARB_instanced_arrays = GL_TRUE;
+   extensions->ARB_buffer_storage = GL_TRUE;
 }
 
 
@@ -3779,9 +3779,12 @@ invalidate_framebuffer_storage(struct gl_context *ctx,
       }
    }
 
-   /* We don't actually do anything for this yet.  Just return after
-    * validating the parameters and generating the required errors.
+   /* Only invalidation of the whole framebuffer is passed on, the driver
+    * may ignore it and the rest anyway.
     */
+   if (ctx->Driver.DiscardFramebuffer && x <= 0 && y <= 0 &&
+       width >= MAX_VIEWPORT_WIDTH && height >= MAX_VIEWPORT_HEIGHT)
+      ctx->Driver.DiscardFramebuffer(ctx, fb, numAttachments, attachments);
    return;
 
 invalid_enum:
@@ -3954,7 +3957,7 @@ void glDiscardFramebufferEXT(GLenum target, GLsizei numAttachments,
    }
 
    if (ctx->Driver.DiscardFramebuffer)
-      ctx->Driver.DiscardFramebuffer(ctx, target, numAttachments, attachments);
+      ctx->Driver.DiscardFramebuffer(ctx, fb, numAttachments, attachments);
 
    return;
 
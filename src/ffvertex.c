@@ -0,0 +1,599 @@
+/*
+ * Fixed-function vertex programs.
+ *
+ * Without a program of its own an application draws with a PICA vertex
+ * shader generated here from the lighting, texgen and matrix state.  Each
+ * variant is generated once and kept in a small cache, the most recently
+ * used first.  Lighting itself is done by the fragment lighting unit, the
+ * program only passes the normal and view vector on to it.
+ */
+
+#include "glheader.h"
+#include "context.h"
+#include "imports.h"
+#include "macros.h"
+#include "ffvertex.h"
+#include "matrix.h"
+#include "shader.h"
+#include "varray.h"
+#include "util/hash_table.h"
+#include "util/simple_list.h"
+
+/** Generated programs kept around */
+#define FF_CACHE_SIZE 16
+
+/** Texture units with texture coordinates, one per texcoord output */
+#define FF_TEX_UNITS 3
+
+#define FF_MAX_CODE 512
+#define FF_MAX_OPDESC 128
+#define FF_MAX_OUTPUTS (4 + FF_TEX_UNITS)
+
+/** Uniform registers of the generated programs */
+enum {
+	FF_PROJECTION = 0,
+	FF_MODELVIEW = 4,
+	FF_TEXTURE_MATRIX = 8,    /**< 4 per texture unit */
+	FF_CONSTANTS = 20,        /**< 0, 1, 0.5, epsilon */
+	FF_COLOR = 21,            /**< Current color */
+	FF_NORMAL = 22,           /**< Current normal */
+	FF_TEXCOORD = 23,         /**< Current texcoord, 1 per texture unit */
+	FF_TEXGEN = 26,           /**< S and T planes per texture unit */
+	FF_NORMALIZE = 32         /**< Scales, then biases, per FF_NORM_* - 1 */
+};
+
+/** Output registers past the texcoords, used by lighting */
+#define FF_OUT_QUATERNION  (2 + FF_TEX_UNITS)
+#define FF_OUT_VIEW        (3 + FF_TEX_UNITS)
+
+/** Inputs of the key, 4 bits each */
+enum {
+	FF_INPUT_POS,
+	FF_INPUT_NORMAL,
+	FF_INPUT_COLOR,
+	FF_INPUT_TEX0
+};
+
+/**
+ * Normalization of an integer input, 4 bits each in the key: one of these
+ * and the array size - 1 above it.
+ */
+enum {
+	FF_NORM_NONE,
+	FF_NORM_UBYTE,
+	FF_NORM_BYTE,
+	FF_NORM_SHORT
+};
+
+/** Key flags */
+#define FF_LIGHTING        0x1
+
+/** Texture unit bits of the key, 8 per unit, texgen modes for S and T */
+#define FF_TEX_ENABLED     0x1
+#define FF_TEXGEN_S_SHIFT  1
+#define FF_TEXGEN_T_SHIFT  3
+
+enum {
+	FF_TEXGEN_NONE,
+	FF_TEXGEN_OBJECT,
+	FF_TEXGEN_EYE
+};
+
+/**
+ * The state a program is generated from.  Inputs hold the input register
+ * plus one of each FF_INPUT_*, zero for values not coming from an array.
+ * Normalize holds the FF_NORM_* and size of each, for normalized integer
+ * arrays the attribute loader fetches as is.
+ */
+struct ff_vertex_key
+{
+	GLuint Inputs;
+	GLuint Normalize;
+	GLuint Texture;
+	GLuint Flags;
+};
+
+struct ff_vertex_program
+{
+	struct simple_node Node;  /**< Must come first */
+	struct ff_vertex_key Key;
+	GLuint Hash;
+	u32 *Code;                /**< Instructions followed by operand descriptors */
+	DVLP_s Dvlp;
+	DVLE_s Dvle;
+	DVLE_outEntry_s Outputs[FF_MAX_OUTPUTS];
+	struct gl_pica_program Program;
+};
+
+struct gl_ff_vertex_cache
+{
+	struct simple_node Programs;  /**< Most recently used first */
+	GLuint Count;
+};
+
+
+/* PICA200 shader instruction encoding */
+
+#define OP_ADD  0x00
+#define OP_DP3  0x01
+#define OP_DP4  0x02
+#define OP_DST  0x04
+#define OP_EX2  0x05
+#define OP_LG2  0x06
+#define OP_MUL  0x08
+#define OP_SLT  0x0A
+#define OP_MAX  0x0C
+#define OP_MIN  0x0D
+#define OP_RCP  0x0E
+#define OP_RSQ  0x0F
+#define OP_MOV  0x13
+#define OP_END  0x22
+
+/** Source registers, the destination ones are the same for temporaries */
+#define V(n)  (n)
+#define R(n)  (0x10 + (n))
+#define C(n)  (0x20 + (n))
+/** Destination output registers */
+#define O(n)  (n)
+
+#define SWIZZLE(x, y, z, w)  ((x) << 6 | (y) << 4 | (z) << 2 | (w))
+#define XYZW  SWIZZLE(0, 1, 2, 3)
+#define XXXX  SWIZZLE(0, 0, 0, 0)
+#define YYYY  SWIZZLE(1, 1, 1, 1)
+#define ZZZZ  SWIZZLE(2, 2, 2, 2)
+#define WWWW  SWIZZLE(3, 3, 3, 3)
+
+/** Source operands: register, swizzle and negation */
+#define SRC(reg, swizzle)  ((reg) | (swizzle) << 8)
+#define S(reg)             SRC(reg, XYZW)
+#define NEGATE             (1 << 16)
+
+#define MASK_X     0x8
+#define MASK_Y     0x4
+#define MASK_Z     0x2
+#define MASK_W     0x1
+#define MASK_XY    0xC
+#define MASK_XYZ   0xE
+#define MASK_XYZW  0xF
+
+struct ff_builder
+{
+	u32 Code[FF_MAX_CODE];
+	u32 Opdesc[FF_MAX_OPDESC];
+	DVLE_outEntry_s Outputs[FF_MAX_OUTPUTS];
+	GLuint NumCode;
+	GLuint NumOpdesc;
+	GLuint NumOutputs;
+	GLboolean Overflow;
+};
+
+static u32 operand_desc(int src, int shift)
+{
+	return (u32) ((src >> 16) & 1) << shift | (u32) ((src >> 8) & 0xFF) << (shift + 1);
+}
+
+/** Index of an operand descriptor, shared by the instructions using it */
+static u32 find_opdesc(struct ff_builder *b, u32 desc)
+{
+	GLuint i;
+
+	for (i = 0; i < b->NumOpdesc; i++) {
+		if (b->Opdesc[i] == desc)
+			return i;
+	}
+	if (b->NumOpdesc == FF_MAX_OPDESC) {
+		b->Overflow = GL_TRUE;
+		return 0;
+	}
+	b->Opdesc[b->NumOpdesc] = desc;
+	return b->NumOpdesc++;
+}
+
+/**
+ * Emit an instruction of the common format.  Only the first source can
+ * be a uniform, the second has room for inputs and temporaries.
+ */
+static void emit(struct ff_builder *b, int op, int dst, int mask, int src1, int src2)
+{
+	u32 desc = mask | operand_desc(src1, 4) | operand_desc(src2, 13);
+	u32 index = find_opdesc(b, desc);
+
+	assert((src2 & 0xFF) < C(0));
+
+	if (b->NumCode == FF_MAX_CODE) {
+		b->Overflow = GL_TRUE;
+		return;
+	}
+	b->Code[b->NumCode++] = (u32) op << 26 | (u32) dst << 21 |
+							(u32) (src1 & 0x7F) << 12 | (u32) (src2 & 0x1F) << 7 | index;
+}
+
+static void add_output(struct ff_builder *b, int type, int reg, int mask)
+{
+	DVLE_outEntry_s *out = &b->Outputs[b->NumOutputs++];
+
+	out->type = type;
+	out->regID = reg;
+	out->mask = mask;
+}
+
+/** Input register of a key input, -1 if it doesn't come from an array */
+static int key_input(const struct ff_vertex_key *key, int input)
+{
+	return (int) ((key->Inputs >> (input * 4)) & 0xF) - 1;
+}
+
+/**
+ * Operand of an array input.  Normalized integer arrays are fetched as
+ * they are, the components they have are scaled into \p temp, those the
+ * attribute loader fills in are kept.
+ */
+static int load_array(struct ff_builder *b, const struct ff_vertex_key *key,
+					  int input, int temp)
+{
+	int reg = MAX2(key_input(key, input), 0);
+	int norm = (key->Normalize >> (input * 4)) & 3;
+	int size = ((key->Normalize >> (input * 4 + 2)) & 3) + 1;
+	int swizzle = SWIZZLE(norm - 1, norm - 1, norm - 1, norm - 1);
+	int mask = (MASK_XYZW << (4 - size)) & MASK_XYZW;
+
+	if (norm == FF_NORM_NONE)
+		return S(V(reg));
+
+	if (mask != MASK_XYZW)
+		emit(b, OP_MOV, R(temp), MASK_XYZW & ~mask, S(V(reg)), 0);
+	// Signed values map to [-1, 1] as (2c + 1) / (2^b - 1)
+	emit(b, OP_MUL, R(temp), mask, SRC(C(FF_NORMALIZE), swizzle), S(V(reg)));
+	if (norm != FF_NORM_UBYTE)
+		emit(b, OP_ADD, R(temp), mask, SRC(C(FF_NORMALIZE + 1), swizzle), S(R(temp)));
+	return S(R(temp));
+}
+
+/**
+ * Operand of a vertex value, the array's input or the current value moved
+ * to a temporary.
+ */
+static int load_input(struct ff_builder *b, const struct ff_vertex_key *key,
+					  int input, int uniform, int temp)
+{
+	if (key_input(key, input) >= 0)
+		return load_array(b, key, input, temp);
+	emit(b, OP_MOV, R(temp), MASK_XYZW, S(C(uniform)), 0);
+	return S(R(temp));
+}
+
+/**
+ * Output the eye space normal as the quaternion rotating +Z onto it, and
+ * the view vector, for the fragment lighting unit.  r0 holds the eye
+ * position.
+ */
+static void emit_lighting(struct ff_builder *b, const struct ff_vertex_key *key)
+{
+	int normal;
+	int i;
+
+	// r1 = normalize(modelview * normal)
+	normal = load_input(b, key, FF_INPUT_NORMAL, FF_NORMAL, 3);
+	for (i = 0; i < 3; i++)
+		emit(b, OP_DP3, R(1), MASK_X >> i, S(C(FF_MODELVIEW + i)), normal);
+	emit(b, OP_DP3, R(1), MASK_W, S(R(1)), S(R(1)));
+	emit(b, OP_RSQ, R(1), MASK_W, SRC(R(1), WWWW), 0);
+	emit(b, OP_MUL, R(1), MASK_XYZ, S(R(1)), SRC(R(1), WWWW));
+
+	// r2.x = cos(a / 2)^2 = (1 + N.z) / 2, kept off zero for a normal
+	// pointing straight away, r2.y = 1 / cos(a / 2)
+	emit(b, OP_ADD, R(2), MASK_X, SRC(C(FF_CONSTANTS), YYYY), SRC(R(1), ZZZZ));
+	emit(b, OP_MUL, R(2), MASK_X, SRC(C(FF_CONSTANTS), ZZZZ), SRC(R(2), XXXX));
+	emit(b, OP_MAX, R(2), MASK_X, SRC(C(FF_CONSTANTS), WWWW), SRC(R(2), XXXX));
+	emit(b, OP_RSQ, R(2), MASK_Y, SRC(R(2), XXXX), 0);
+
+	// q = (N.x, N.y) * sin(a / 2) / sin(a), cos(a / 2), 0
+	emit(b, OP_MUL, R(3), MASK_XY, SRC(C(FF_CONSTANTS), ZZZZ), S(R(1)));
+	emit(b, OP_MUL, R(3), MASK_XY, S(R(3)), SRC(R(2), YYYY));
+	emit(b, OP_RCP, R(3), MASK_Z, SRC(R(2), YYYY), 0);
+	emit(b, OP_MOV, R(3), MASK_W, SRC(C(FF_CONSTANTS), XXXX), 0);
+	emit(b, OP_MOV, O(FF_OUT_QUATERNION), MASK_XYZW, S(R(3)), 0);
+	add_output(b, RESULT_NORMALQUAT, FF_OUT_QUATERNION, 0xF);
+
+	emit(b, OP_MOV, O(FF_OUT_VIEW), MASK_XYZ, S(R(0)) | NEGATE, 0);
+	add_output(b, RESULT_VIEW, FF_OUT_VIEW, 0x7);
+}
+
+static void emit_texcoord(struct ff_builder *b, const struct ff_vertex_key *key,
+						  int unit, int pos)
+{
+	GLuint bits = key->Texture >> (unit * 8);
+	int coord = load_input(b, key, FF_INPUT_TEX0 + unit, FF_TEXCOORD + unit, 3);
+	int j;
+
+	if (bits & (3 << FF_TEXGEN_S_SHIFT | 3 << FF_TEXGEN_T_SHIFT)) {
+		if (coord != S(R(3)))
+			emit(b, OP_MOV, R(3), MASK_XYZW, coord, 0);
+		for (j = 0; j < 2; j++) {
+			int mode = (bits >> (FF_TEXGEN_S_SHIFT + j * 2)) & 3;
+			int plane = C(FF_TEXGEN + unit * 2 + j);
+
+			if (mode == FF_TEXGEN_OBJECT)
+				emit(b, OP_DP4, R(3), MASK_X >> j, S(plane), pos);
+			else if (mode == FF_TEXGEN_EYE)
+				emit(b, OP_DP4, R(3), MASK_X >> j, S(plane), S(R(0)));
+		}
+		coord = S(R(3));
+	}
+
+	for (j = 0; j < 2; j++)
+		emit(b, OP_DP4, O(2 + unit), MASK_X >> j, S(C(FF_TEXTURE_MATRIX + unit * 4 + j)), coord);
+
+	add_output(b, unit == 0 ? RESULT_TEXCOORD0 : RESULT_TEXCOORD1 + unit - 1, 2 + unit, 0x3);
+}
+
+/**
+ * Generate the program for a key.  r0 holds the eye position throughout,
+ * r4 a normalized object position, lighting uses r1 to r3.
+ */
+static void emit_program(struct ff_builder *b, const struct ff_vertex_key *key)
+{
+	int pos = load_array(b, key, FF_INPUT_POS, 4);
+	int color, i;
+
+	for (i = 0; i < 4; i++)
+		emit(b, OP_DP4, R(0), MASK_X >> i, S(C(FF_MODELVIEW + i)), pos);
+	for (i = 0; i < 4; i++)
+		emit(b, OP_DP4, O(0), MASK_X >> i, S(C(FF_PROJECTION + i)), S(R(0)));
+	add_output(b, RESULT_POSITION, 0, 0xF);
+
+	// With lighting the texture combiners blend the lit color with this
+	color = key_input(key, FF_INPUT_COLOR) >= 0 ? load_array(b, key, FF_INPUT_COLOR, 3) : S(C(FF_COLOR));
+	emit(b, OP_MOV, O(1), MASK_XYZW, color, 0);
+	add_output(b, RESULT_COLOR, 1, 0xF);
+
+	for (i = 0; i < FF_TEX_UNITS; i++) {
+		if ((key->Texture >> (i * 8)) & FF_TEX_ENABLED)
+			emit_texcoord(b, key, i, pos);
+	}
+
+	if (key->Flags & FF_LIGHTING)
+		emit_lighting(b, key);
+
+	emit(b, OP_END, 0, 0, 0, 0);
+}
+
+
+static GLuint texgen_mode(const struct gl_texgen *gen)
+{
+	switch (gen->Mode) {
+	case GL_OBJECT_LINEAR:
+		return FF_TEXGEN_OBJECT;
+	case GL_EYE_LINEAR:
+		return FF_TEXGEN_EYE;
+	default:
+		// Sphere, normal and reflection maps aren't generated
+		return FF_TEXGEN_NONE;
+	}
+}
+
+/** Normalization the program does for an array, with its size */
+static GLuint array_normalize(const struct gl_client_array *array)
+{
+	GLuint size = (GLuint) (array->Size - 1) << 2;
+
+	if (!array->Normalized)
+		return FF_NORM_NONE;
+
+	switch (array->Type) {
+	case GL_UNSIGNED_BYTE:
+		return FF_NORM_UBYTE | size;
+	case GL_BYTE:
+		return FF_NORM_BYTE | size;
+	case GL_SHORT:
+		return FF_NORM_SHORT | size;
+	default:
+		// Converted to floats already normalized
+		return FF_NORM_NONE;
+	}
+}
+
+static void make_key(struct gl_context *ctx, struct ff_vertex_key *key)
+{
+	const GLbitfield64 enabled = ctx->Array.VAO->_Enabled;
+	static const GLuint attribs[] = {
+		VERT_ATTRIB_POS, VERT_ATTRIB_NORMAL, VERT_ATTRIB_COLOR0,
+		VERT_ATTRIB_TEX0, VERT_ATTRIB_TEX1, VERT_ATTRIB_TEX2
+	};
+	GLuint i;
+
+	memset(key, 0, sizeof(*key));
+
+	// Attributes are loaded into consecutive registers in attribute order
+	for (i = 0; i < ARRAY_SIZE(attribs); i++) {
+		GLbitfield64 bit = BITFIELD64_BIT(attribs[i]);
+		GLuint reg = _mesa_bitcount_64(enabled & (bit - 1));
+
+		if ((enabled & bit) && reg < PICA_MAX_ATTRIBS) {
+			key->Inputs |= (reg + 1) << (i * 4);
+			key->Normalize |= array_normalize(&ctx->Array.VAO->_VertexAttrib[attribs[i]]) << (i * 4);
+		}
+	}
+
+	if (ctx->Light.Enabled)
+		key->Flags |= FF_LIGHTING;
+
+	for (i = 0; i < FF_TEX_UNITS; i++) {
+		const struct gl_texture_unit *unit = &ctx->Texture.Unit[i];
+		GLuint bits = 0;
+
+		if (unit->TexGenEnabled & S_BIT)
+			bits |= texgen_mode(&unit->GenS) << FF_TEXGEN_S_SHIFT;
+		if (unit->TexGenEnabled & T_BIT)
+			bits |= texgen_mode(&unit->GenT) << FF_TEXGEN_T_SHIFT;
+		if (bits || (enabled & VERT_BIT_TEX(i)) ||
+			(ctx->Texture._EnabledCoordUnits & (1 << i)))
+			bits |= FF_TEX_ENABLED;
+		key->Texture |= bits << (i * 8);
+	}
+}
+
+static struct ff_vertex_program *create_program(const struct ff_vertex_key *key, GLuint hash)
+{
+	struct ff_builder b;
+	struct ff_vertex_program *fp;
+
+	b.NumCode = 0;
+	b.NumOpdesc = 0;
+	b.NumOutputs = 0;
+	b.Overflow = GL_FALSE;
+	emit_program(&b, key);
+	if (b.Overflow)
+		return NULL;
+
+	fp = CALLOC_STRUCT(ff_vertex_program);
+	if (!fp)
+		return NULL;
+	fp->Code = malloc((b.NumCode + b.NumOpdesc) * sizeof(u32));
+	if (!fp->Code) {
+		free(fp);
+		return NULL;
+	}
+
+	memcpy(fp->Code, b.Code, b.NumCode * sizeof(u32));
+	memcpy(fp->Code + b.NumCode, b.Opdesc, b.NumOpdesc * sizeof(u32));
+	memcpy(fp->Outputs, b.Outputs, sizeof(b.Outputs));
+	fp->Key = *key;
+	fp->Hash = hash;
+
+	fp->Dvlp.codeSize = b.NumCode;
+	fp->Dvlp.codeData = fp->Code;
+	fp->Dvlp.opdescSize = b.NumOpdesc;
+	fp->Dvlp.opcdescData = fp->Code + b.NumCode;
+
+	fp->Dvle.type = VERTEX_SHDR;
+	fp->Dvle.dvlp = &fp->Dvlp;
+	fp->Dvle.mainOffset = 0;
+	fp->Dvle.endmainOffset = b.NumCode;
+	fp->Dvle.outTableSize = b.NumOutputs;
+	fp->Dvle.outTableData = fp->Outputs;
+	DVLE_GenerateOutmap(&fp->Dvle);
+
+	// Generated programs have no name, the matrices are uploaded like
+	// those of any other program
+	fp->Program.ProjectionUniform = FF_PROJECTION;
+	fp->Program.ModelviewUniform = FF_MODELVIEW;
+	fp->Program.TextureUniform = -1;
+	shaderProgramInit(&fp->Program.Program);
+	shaderProgramSetVsh(&fp->Program.Program, &fp->Dvle);
+	return fp;
+}
+
+static void free_program(struct ff_vertex_program *fp)
+{
+	shaderProgramFree(&fp->Program.Program);
+	free(fp->Code);
+	free(fp);
+}
+
+/**
+ * The fixed-function program for the current state, generated if it
+ * isn't in the cache.  The least recently used one makes room for it.
+ */
+struct gl_pica_program *_gl3ds_ff_vertex_program(struct gl_context *ctx)
+{
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+	struct gl_ff_vertex_cache *cache = shader->FFVertex;
+	struct ff_vertex_key key;
+	struct simple_node *node;
+	struct ff_vertex_program *fp;
+	GLuint hash;
+
+	make_key(ctx, &key);
+	hash = _mesa_hash_data(&key, sizeof(key));
+
+	foreach(node, &cache->Programs) {
+		fp = (struct ff_vertex_program *) node;
+		if (fp->Hash == hash && !memcmp(&fp->Key, &key, sizeof(key))) {
+			move_to_head(&cache->Programs, node);
+			return &fp->Program;
+		}
+	}
+
+	fp = create_program(&key, hash);
+	if (!fp) {
+		_mesa_error(ctx, GL_OUT_OF_MEMORY, "fixed-function vertex program");
+		return NULL;
+	}
+
+	if (cache->Count == FF_CACHE_SIZE) {
+		struct ff_vertex_program *old = (struct ff_vertex_program *) last_elem(&cache->Programs);
+
+		if (shader->_Current == &old->Program) {
+			shader->_Current = NULL;
+			shader->Uniforms = NULL;
+		}
+		if (shader->BoundProgram == &old->Program)
+			shader->BoundProgram = NULL;
+		remove_from_list(&old->Node);
+		free_program(old);
+		cache->Count--;
+	}
+
+	insert_at_head(&cache->Programs, &fp->Node);
+	cache->Count++;
+	return &fp->Program;
+}
+
+/**
+ * Store the texgen and current vertex state in the uniforms of the current
+ * fixed-function program.
+ */
+void _gl3ds_ff_vertex_uniforms(struct gl_context *ctx)
+{
+	static const GLfloat constants[4] = { 0.0F, 1.0F, 0.5F, 1e-6F };
+	static const GLfloat normalize[2][4] = {
+		{ 1.0F / 255.0F, 2.0F / 255.0F, 2.0F / 65535.0F, 0.0F },
+		{ 0.0F, 1.0F / 255.0F, 1.0F / 65535.0F, 0.0F }
+	};
+	struct gl_program_uniforms *uniforms = ctx->Shared->Shader->Uniforms;
+	GLfloat (*current)[8] = ctx->Current.Attrib;
+	GLuint i;
+
+	_gl3ds_set_uniforms(ctx, uniforms, FF_CONSTANTS, 1, constants);
+	_gl3ds_set_uniforms(ctx, uniforms, FF_NORMALIZE, 2, &normalize[0][0]);
+	_gl3ds_set_uniforms(ctx, uniforms, FF_COLOR, 1, current[VERT_ATTRIB_COLOR0]);
+	_gl3ds_set_uniforms(ctx, uniforms, FF_NORMAL, 1, current[VERT_ATTRIB_NORMAL]);
+
+	for (i = 0; i < FF_TEX_UNITS; i++) {
+		const struct gl_texture_unit *unit = &ctx->Texture.Unit[i];
+		GLfloat planes[2][4];
+
+		_gl3ds_set_uniforms(ctx, uniforms, FF_TEXCOORD + i, 1, current[VERT_ATTRIB_TEX0 + i]);
+		_gl3ds_upload_matrix(ctx, &ctx->TextureMatrixStack[i], FF_TEXTURE_MATRIX + i * 4);
+
+		if (unit->TexGenEnabled & (S_BIT | T_BIT)) {
+			COPY_4V(planes[0], unit->GenS.Mode == GL_OBJECT_LINEAR ?
+					unit->GenS.ObjectPlane : unit->GenS.EyePlane);
+			COPY_4V(planes[1], unit->GenT.Mode == GL_OBJECT_LINEAR ?
+					unit->GenT.ObjectPlane : unit->GenT.EyePlane);
+			_gl3ds_set_uniforms(ctx, uniforms, FF_TEXGEN + i * 2, 2, &planes[0][0]);
+		}
+	}
+}
+
+void _gl3ds_init_ff_vertex(struct gl_context *ctx)
+{
+	struct gl_ff_vertex_cache *cache = CALLOC_STRUCT(gl_ff_vertex_cache);
+
+	make_empty_list(&cache->Programs);
+	ctx->Shared->Shader->FFVertex = cache;
+}
+
+void _gl3ds_free_ff_vertex(struct gl_context *ctx)
+{
+	struct gl_ff_vertex_cache *cache = ctx->Shared->Shader->FFVertex;
+	struct simple_node *node, *next;
+
+	for (node = first_elem(&cache->Programs); !at_end(&cache->Programs, node); node = next) {
+		next = next_elem(node);
+		free_program((struct ff_vertex_program *) node);
+	}
+	free(cache);
+	ctx->Shared->Shader->FFVertex = NULL;
+}
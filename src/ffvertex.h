@@ -0,0 +1,21 @@
+#ifndef GL3DS_FFVERTEX
+#define GL3DS_FFVERTEX
+
+#include "glheader.h"
+
+struct gl_context;
+struct gl_pica_program;
+
+/** State the fixed-function vertex program is generated from */
+#define _FF_VERTEX_PROGRAM_STATE (_NEW_PROGRAM | _NEW_ARRAY | _NEW_LIGHT | _NEW_TEXTURE)
+
+/** State the uniforms of the fixed-function vertex program hold */
+#define _FF_VERTEX_UNIFORM_STATE (_NEW_PROGRAM | _NEW_TEXTURE | _NEW_TEXTURE_MATRIX | \
+                                  _NEW_CURRENT_ATTRIB)
+
+struct gl_pica_program *_gl3ds_ff_vertex_program(struct gl_context *ctx);
+void _gl3ds_ff_vertex_uniforms(struct gl_context *ctx);
+void _gl3ds_init_ff_vertex(struct gl_context *ctx);
+void _gl3ds_free_ff_vertex(struct gl_context *ctx);
+
+#endif
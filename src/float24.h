@@ -0,0 +1,61 @@
+#ifndef GL3DS_FLOAT24
+#define GL3DS_FLOAT24
+
+#include "glheader.h"
+
+/**
+ * Float24 exponent field and mantissa mask for a float exponent: values
+ * too small for float24 flush to zero, those too large become infinity,
+ * infinities and NaNs keep their mantissa.
+ */
+#define F24(e)		((e) <= 64 ? 0 : (e) == 255 ? 0x7FFFFF :			\
+					 (e) >= 191 ? 0x7F0000 : (u32) ((e) - 64) << 16 | 0xFFFF)
+#define F24_4(e)	F24(e), F24((e) + 1), F24((e) + 2), F24((e) + 3)
+#define F24_16(e)	F24_4(e), F24_4((e) + 4), F24_4((e) + 8), F24_4((e) + 12)
+#define F24_64(e)	F24_16(e), F24_16((e) + 16), F24_16((e) + 32), F24_16((e) + 48)
+
+static const u32 _gl3ds_float24_exp[256] = {
+	F24_64(0), F24_64(64), F24_64(128), F24_64(192)
+};
+
+#undef F24_64
+#undef F24_16
+#undef F24_4
+#undef F24
+
+/**
+ * Convert a float to float24: 1 sign, 7 exponent and 16 mantissa bits.
+ * The exponent is rebiased through a table, without branches.  NaNs are
+ * quieted, so those whose mantissa only has low bits set stay NaNs.
+ */
+static inline u32 _gl3ds_float24(GLfloat f)
+{
+	union { GLfloat f; u32 i; } u = { f };
+	u32 sign = (u.i >> 8) & 0x800000;
+	u32 bits = _gl3ds_float24_exp[(u.i >> 23) & 0xFF] & ((u.i >> 7) | 0x7F0000);
+	u32 nan = (u.i & 0x7FFFFFFF) > 0x7F800000;
+
+	return sign | bits | nan << 15;
+}
+
+/**
+ * Pack float uniform registers into the float24 upload form, three words
+ * per register instead of four.
+ */
+static inline void _gl3ds_pack_float24(u32 *dst, const GLfloat (*regs)[4], int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++, dst += 3) {
+		u32 w = _gl3ds_float24(regs[i][0]);
+		u32 z = _gl3ds_float24(regs[i][1]);
+		u32 y = _gl3ds_float24(regs[i][2]);
+		u32 x = _gl3ds_float24(regs[i][3]);
+
+		dst[0] = w << 8 | z >> 16;
+		dst[1] = z << 16 | y >> 8;
+		dst[2] = y << 24 | x;
+	}
+}
+
+#endif
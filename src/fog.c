@@ -0,0 +1,307 @@
+/*
+ * Mesa 3-D graphics library
+ *
+ * Copyright (C) 1999-2008  Brian Paul   All Rights Reserved.
+ * Copyright (C) 2009  VMware, Inc.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "glheader.h"
+#include "context.h"
+#include "fog.h"
+#include "imports.h"
+#include "macros.h"
+#include "mtypes.h"
+#include "math/m_matrix.h"
+#include "util/hash_table.h"
+
+
+/** Fog mode bits of GPUREG_TEXENV_UPDATE_BUFFER */
+#define FOG_MODE_FOG 5
+
+
+static void
+update_fog_scale(struct gl_context *ctx)
+{
+   if (ctx->Fog.End == ctx->Fog.Start)
+      ctx->Fog._Scale = 1.0f;
+   else
+      ctx->Fog._Scale = 1.0f / (ctx->Fog.End - ctx->Fog.Start);
+}
+
+
+
+void glFogf(GLenum pname, GLfloat param)
+{
+   GLfloat fparam[4];
+   fparam[0] = param;
+   fparam[1] = fparam[2] = fparam[3] = 0.0F;
+   glFogfv(pname, fparam);
+}
+
+
+void glFogi(GLenum pname, GLint param )
+{
+   GLfloat fparam[4];
+   fparam[0] = (GLfloat) param;
+   fparam[1] = fparam[2] = fparam[3] = 0.0F;
+   glFogfv(pname, fparam);
+}
+
+
+void glFogiv(GLenum pname, const GLint *params )
+{
+   GLfloat p[4];
+   switch (pname) {
+      case GL_FOG_MODE:
+      case GL_FOG_DENSITY:
+      case GL_FOG_START:
+      case GL_FOG_END:
+      case GL_FOG_INDEX:
+//      case GL_FOG_COORDINATE_SOURCE_EXT:
+	 p[0] = (GLfloat) *params;
+	 break;
+      case GL_FOG_COLOR:
+	 p[0] = INT_TO_FLOAT( params[0] );
+	 p[1] = INT_TO_FLOAT( params[1] );
+	 p[2] = INT_TO_FLOAT( params[2] );
+	 p[3] = INT_TO_FLOAT( params[3] );
+	 break;
+      default:
+         /* Error will be caught later in glFogfv */
+         ASSIGN_4V(p, 0.0F, 0.0F, 0.0F, 0.0F);
+   }
+   glFogfv(pname, p);
+}
+
+
+void glFogfv( GLenum pname, const GLfloat *params )
+{
+   GET_CURRENT_CONTEXT(ctx);
+   GLenum m;
+
+   switch (pname) {
+      case GL_FOG_MODE:
+         m = (GLenum) (GLint) *params;
+	 switch (m) {
+	 case GL_LINEAR:
+	 case GL_EXP:
+	 case GL_EXP2:
+	    break;
+	 default:
+	    _mesa_error( ctx, GL_INVALID_ENUM, "glFog" );
+            return;
+	 }
+	 if (ctx->Fog.Mode == m)
+	    return;
+	 FLUSH_VERTICES(ctx, _NEW_FOG);
+	 ctx->Fog.Mode = m;
+	 break;
+      case GL_FOG_DENSITY:
+	 if (*params<0.0F) {
+	    _mesa_error( ctx, GL_INVALID_VALUE, "glFog" );
+            return;
+	 }
+	 if (ctx->Fog.Density == *params)
+	    return;
+	 FLUSH_VERTICES(ctx, _NEW_FOG);
+	 ctx->Fog.Density = *params;
+	 break;
+      case GL_FOG_START:
+         if (ctx->Fog.Start == *params)
+            return;
+         FLUSH_VERTICES(ctx, _NEW_FOG);
+         ctx->Fog.Start = *params;
+         update_fog_scale(ctx);
+         break;
+      case GL_FOG_END:
+         if (ctx->Fog.End == *params)
+            return;
+         FLUSH_VERTICES(ctx, _NEW_FOG);
+         ctx->Fog.End = *params;
+         update_fog_scale(ctx);
+         break;
+      case GL_FOG_INDEX:
+         if (ctx->Fog.Index == *params)
+	    return;
+	 FLUSH_VERTICES(ctx, _NEW_FOG);
+ 	 ctx->Fog.Index = *params;
+	 break;
+      case GL_FOG_COLOR:
+         if (TEST_EQ_4V(ctx->Fog.Color, params))
+	    return;
+	 FLUSH_VERTICES(ctx, _NEW_FOG);
+	 ctx->Fog.ColorUnclamped[0] = params[0];
+	 ctx->Fog.ColorUnclamped[1] = params[1];
+	 ctx->Fog.ColorUnclamped[2] = params[2];
+	 ctx->Fog.ColorUnclamped[3] = params[3];
+	 ctx->Fog.Color[0] = CLAMP(params[0], 0.0F, 1.0F);
+	 ctx->Fog.Color[1] = CLAMP(params[1], 0.0F, 1.0F);
+	 ctx->Fog.Color[2] = CLAMP(params[2], 0.0F, 1.0F);
+	 ctx->Fog.Color[3] = CLAMP(params[3], 0.0F, 1.0F);
+         break;
+      default:
+         goto invalid_pname;
+   }
+
+   if (ctx->Driver.Fogfv) {
+      ctx->Driver.Fogfv( ctx, pname, params );
+   }
+
+   return;
+
+invalid_pname:
+   _mesa_error( ctx, GL_INVALID_ENUM, "glFog" );
+   return;
+}
+
+
+/**********************************************************************/
+/*****                      Initialization                        *****/
+/**********************************************************************/
+
+void _mesa_init_fog( struct gl_context * ctx )
+{
+   /* Fog group */
+   ctx->Fog.Enabled = GL_FALSE;
+   ctx->Fog.Mode = GL_EXP;
+   ASSIGN_4V( ctx->Fog.Color, 0.0, 0.0, 0.0, 0.0 );
+   ASSIGN_4V( ctx->Fog.ColorUnclamped, 0.0, 0.0, 0.0, 0.0 );
+   ctx->Fog.Index = 0.0;
+   ctx->Fog.Density = 1.0;
+   ctx->Fog.Start = 0.0;
+   ctx->Fog.End = 1.0;
+   ctx->Fog.ColorSumEnabled = GL_FALSE;
+//   ctx->Fog.FogCoordinateSource = GL_FRAGMENT_DEPTH_EXT;
+   ctx->Fog._Scale = 1.0f;
+//   ctx->Fog.FogDistanceMode = GL_EYE_PLANE_ABSOLUTE_NV;
+}
+
+
+/**
+ * Eye distance of a GPU depth value, which runs from 1 at the near plane
+ * to 0 at the far one, through the projection that made it.
+ */
+static GLfloat depth_distance(const GLfloat proj[4], GLfloat depth)
+{
+	// proj holds the z and w rows' z and w terms
+	GLfloat z = 1.0F - 2.0F * depth;
+	GLfloat denom = z * proj[2] - proj[0];
+
+	if (denom == 0.0F)
+		return 0.0F;
+	return fabsf((proj[1] - z * proj[3]) / denom);
+}
+
+/** Fraction of the fragment color fog keeps, at a distance */
+static GLfloat fog_factor(const struct gl_fog_lut_key *key, GLfloat c)
+{
+	GLfloat f;
+
+	switch (key->Mode) {
+	case GL_LINEAR:
+		f = key->End == key->Start ? 1.0F : (key->End - c) / (key->End - key->Start);
+		break;
+	case GL_EXP:
+		f = expf(-key->Density * c);
+		break;
+	default:
+		f = expf(-(key->Density * c) * (key->Density * c));
+		break;
+	}
+	return CLAMP(f, 0.0F, 1.0F);
+}
+
+/**
+ * Write the lookup table for the fog parameters, indexed by depth.  Each
+ * entry holds its 0.11 factor above the 13-bit signed difference to the
+ * next one.
+ */
+static void load_fog_lut(const struct gl_fog_lut_key *key)
+{
+	u32 data[PICA_FOG_LUT_SIZE];
+	GLfloat next = fog_factor(key, depth_distance(key->Projection, 0.0F));
+	int i;
+
+	for (i = 0; i < PICA_FOG_LUT_SIZE; i++) {
+		GLfloat f = next;
+		GLfloat depth = (GLfloat) (i + 1) / PICA_FOG_LUT_SIZE;
+		s32 diff;
+
+		next = fog_factor(key, depth_distance(key->Projection, depth));
+		diff = IROUND((next - f) * 2048.0F);
+		data[i] = ((u32) CLAMP(diff, -0x1000, 0xFFF) & 0x1FFF) |
+				  MIN2((u32) (f * 2048.0F), 0x7FF) << 13;
+	}
+
+	GPUCMD_AddWrite(GPUREG_FOG_LUT_INDEX, 0);
+	GPUCMD_AddWrites(GPUREG_FOG_LUT_DATA0, data, PICA_FOG_LUT_SIZE);
+}
+
+/**
+ * Set the fog unit up.  The table is written again only when the hash of
+ * the parameters it is made from changes.
+ */
+void _gl3ds_update_fog(struct gl_context *ctx)
+{
+	struct gl_fog_lut_state *lut = &ctx->FogLut;
+	const GLmatrix *proj = ctx->ProjectionMatrixStack.Top;
+	struct gl_fog_lut_key key;
+	GLuint hash;
+
+	if (!ctx->Fog.Enabled) {
+		GPUCMD_AddMaskedWrite(GPUREG_TEXENV_UPDATE_BUFFER, 0x1, 0);
+		return;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.Mode = ctx->Fog.Mode;
+	key.Density = ctx->Fog.Density;
+	key.Start = ctx->Fog.Start;
+	key.End = ctx->Fog.End;
+	if (proj->flags & MAT_NEED_TRANSPOSE)
+		ASSIGN_4V(key.Projection, proj->m[10], proj->m[14], proj->m[11], proj->m[15]);
+	else
+		ASSIGN_4V(key.Projection, proj->m[10], proj->m[11], proj->m[14], proj->m[15]);
+	hash = _mesa_hash_data(&key, sizeof(key));
+
+	if (!lut->Known || lut->Hash != hash || memcmp(&lut->Loaded, &key, sizeof(key))) {
+		load_fog_lut(&key);
+		lut->Loaded = key;
+		lut->Hash = hash;
+		lut->Known = GL_TRUE;
+	}
+
+	GPUCMD_AddWrite(GPUREG_FOG_COLOR, (u32) FLOAT_TO_UBYTE(ctx->Fog.Color[0]) |
+					(u32) FLOAT_TO_UBYTE(ctx->Fog.Color[1]) << 8 |
+					(u32) FLOAT_TO_UBYTE(ctx->Fog.Color[2]) << 16);
+	GPUCMD_AddMaskedWrite(GPUREG_TEXENV_UPDATE_BUFFER, 0x1, FOG_MODE_FOG);
+}
+
+/**
+ * Forget the table on the GPU, after it was reset or used by another
+ * context.
+ */
+void _gl3ds_reset_fog(struct gl_context *ctx)
+{
+	ctx->FogLut.Known = GL_FALSE;
+	ctx->NewState |= _NEW_FOG;
+}
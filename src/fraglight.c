@@ -0,0 +1,356 @@
+/*
+ * GL lighting on the PICA200 fragment lighting unit.
+ *
+ * The fixed-function vertex program passes the eye space normal and view
+ * vector on, the colors and positions of the enabled lights are set up
+ * here.  Shininess, spotlight cone and distance attenuation are lookup
+ * tables generated from the GL parameters.  Tables are kept by a hash of
+ * those, so lights with the same parameters share one, and a table
+ * already on the GPU isn't sent again.
+ */
+
+#include "glheader.h"
+#include "context.h"
+#include "imports.h"
+#include "macros.h"
+#include "fraglight.h"
+#include "util/hash_table.h"
+
+/** Table ids, as GPUREG_LIGHTING_LUT_INDEX takes them */
+#define LUT_D0     0
+#define LUT_SP(n)  (8 + (n))
+#define LUT_DA(n)  (16 + (n))
+
+/** Kinds of generated tables */
+enum {
+	LUT_DISTRIBUTION,  /**< N.H to the power of the shininess */
+	LUT_SPOT,          /**< Spot exponent inside the cutoff cone */
+	LUT_ATTENUATION    /**< 1 / (k0 + k1 * d + k2 * d * d) over a range */
+};
+
+/** Table inputs, N.H for D0 and -L.P for the spotlight tables */
+#define LUTINPUT_SELECT  (0 << 0 | 4 << 8)
+/** Both take their input signed rather than its absolute value */
+#define LUTINPUT_ABS     (2 << 0 | 2 << 8)
+
+/** Layer configuration 0 has the D0, RR, SP and DA tables, and highlights
+ * are clamped where N.L is negative
+ */
+#define CONFIG0  (0 << 4 | 1 << 27)
+
+/** Bits of GPUREG_LIGHTING_CONFIG1 disabling tables */
+#define CONFIG1_SP(n)  (1 << (8 + (n)))
+#define CONFIG1_D0     (1 << 16)
+#define CONFIG1_DA(n)  (1u << (24 + (n)))
+
+/** Attenuation at the end of the distance table's range */
+#define ATTENUATION_FLOOR 256.0F
+
+/** Colors have 10 bits a channel, blue in the lowest ones */
+static u32 pack_color(const GLfloat color[3])
+{
+	GLubyte r, g, b;
+
+	UNCLAMPED_FLOAT_TO_UBYTE(r, color[0]);
+	UNCLAMPED_FLOAT_TO_UBYTE(g, color[1]);
+	UNCLAMPED_FLOAT_TO_UBYTE(b, color[2]);
+	return b | g << 10 | (u32) r << 20;
+}
+
+/**
+ * Convert a float to float20: 1 sign, 7 exponent and 12 mantissa bits.
+ */
+static u32 to_float20(GLfloat f)
+{
+	union { GLfloat f; u32 i; } u = { f };
+	u32 sign = (u.i >> 12) & 0x80000;
+	s32 exp = (s32) ((u.i >> 23) & 0xFF) - (127 - 63);
+
+	if (exp <= 0)
+		return sign;
+	if (exp >= 0x7F)
+		return sign | 0x7F000;
+	return sign | (u32) exp << 12 | ((u.i >> 11) & 0xFFF);
+}
+
+/** Spot directions are signed 1.1.11 fixed point */
+static u32 to_fixed13(GLfloat f)
+{
+	return (u32) IROUND(CLAMP(f, -1.0F, 1.0F) * 2048.0F) & 0x1FFF;
+}
+
+static GLfloat lut_value(const struct gl_light_lut_key *key, GLfloat x)
+{
+	GLfloat d;
+
+	switch (key->Kind) {
+	case LUT_DISTRIBUTION:
+		return x > 0.0F ? powf(x, key->Param[0]) : 0.0F;
+	case LUT_SPOT:
+		return x >= key->Param[0] && x > 0.0F ? powf(x, key->Param[1]) : 0.0F;
+	default:
+		d = x * key->Param[0];
+		return 1.0F / MAX2(key->Param[1] + d * (key->Param[2] + d * key->Param[3]), 1.0F);
+	}
+}
+
+/**
+ * Sample a table's function.  Each entry holds its value and the
+ * difference to the next one the GPU interpolates with.  Signed tables
+ * cover [0, 1) in their first half and [-1, 0) in the second.
+ */
+static void generate_lut(u32 *data, const struct gl_light_lut_key *key)
+{
+	GLboolean is_signed = key->Kind != LUT_ATTENUATION;
+	int i;
+
+	for (i = 0; i < PICA_LIGHT_LUT_SIZE; i++) {
+		int n = is_signed && i >= PICA_LIGHT_LUT_SIZE / 2 ? i - PICA_LIGHT_LUT_SIZE : i;
+		GLfloat step = is_signed ? 2.0F / PICA_LIGHT_LUT_SIZE : 1.0F / PICA_LIGHT_LUT_SIZE;
+		GLfloat value = CLAMP(lut_value(key, n * step), 0.0F, 1.0F);
+		GLfloat diff = CLAMP(lut_value(key, (n + 1) * step), 0.0F, 1.0F) - value;
+		u32 entry = MIN2((u32) (value * 4096.0F), 0xFFF);
+		u32 delta = MIN2((u32) (fabsf(diff) * 2048.0F), 0x7FF);
+
+		if (diff < 0.0F)
+			delta |= 0x800;
+		data[i] = entry | delta << 12;
+	}
+}
+
+/**
+ * The generated table for a key, made in place of the least recently
+ * used one if there is none.
+ */
+static const struct gl_light_lut *find_lut(struct gl_fraglight_state *fl,
+										   const struct gl_light_lut_key *key)
+{
+	GLuint hash = _mesa_hash_data(key, sizeof(*key));
+	struct gl_light_lut *lut = &fl->Luts[0];
+	int i;
+
+	for (i = 0; i < MAX_LIGHT_LUT_CACHE; i++) {
+		struct gl_light_lut *entry = &fl->Luts[i];
+
+		if (entry->LastUse && entry->Hash == hash &&
+			!memcmp(&entry->Key, key, sizeof(*key))) {
+			entry->LastUse = ++fl->UseCount;
+			return entry;
+		}
+		if (entry->LastUse < lut->LastUse)
+			lut = entry;
+	}
+
+	lut->Key = *key;
+	lut->Hash = hash;
+	lut->LastUse = ++fl->UseCount;
+	generate_lut(lut->Data, key);
+	return lut;
+}
+
+/** Write a table, unless the GPU has it already */
+static void load_lut(struct gl_fraglight_state *fl, GLuint id,
+					 GLuint kind, GLfloat p0, GLfloat p1, GLfloat p2, GLfloat p3)
+{
+	struct gl_light_lut_key key;
+	const struct gl_light_lut *lut;
+
+	// Memset so the padding hashes the same every time
+	memset(&key, 0, sizeof(key));
+	key.Kind = kind;
+	ASSIGN_4V(key.Param, p0, p1, p2, p3);
+
+	if ((fl->LoadedMask & (1u << id)) && !memcmp(&fl->Loaded[id], &key, sizeof(key)))
+		return;
+
+	lut = find_lut(fl, &key);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_LUT_INDEX, id << 8);
+	GPUCMD_AddWrites(GPUREG_LIGHTING_LUT_DATA0, (u32 *) lut->Data, PICA_LIGHT_LUT_SIZE);
+	fl->Loaded[id] = key;
+	fl->LoadedMask |= 1u << id;
+}
+
+/** Distance at which a light is attenuated to ATTENUATION_FLOOR */
+static GLfloat attenuation_range(const struct gl_light *light)
+{
+	GLfloat k0 = light->ConstantAttenuation;
+	GLfloat k1 = light->LinearAttenuation;
+	GLfloat k2 = light->QuadraticAttenuation;
+	GLfloat range = 0.0F;
+
+	if (k2 > 0.0F)
+		range = (sqrtf(k1 * k1 - 4.0F * k2 * (k0 - ATTENUATION_FLOOR)) - k1) / (2.0F * k2);
+	else if (k1 > 0.0F)
+		range = (ATTENUATION_FLOOR - k0) / k1;
+	return range > 0.0F ? range : 1.0F;
+}
+
+/**
+ * Whether lighting is done by the fragment lighting unit, which needs the
+ * outputs of a fixed-function vertex program.
+ */
+GLboolean _gl3ds_fragment_lighting(const struct gl_context *ctx)
+{
+	const struct gl_pica_program *program = ctx->Shared->Shader->_Current;
+
+	return ctx->Light.Enabled && program && !program->Name;
+}
+
+/** The front ambient and diffuse materials tracking the vertex color */
+static GLbitfield tracked_material(const struct gl_context *ctx)
+{
+	if (!ctx->Light.ColorMaterialEnabled)
+		return 0;
+	return ctx->Light._ColorMaterialBitmask & (MAT_BIT_FRONT_AMBIENT | MAT_BIT_FRONT_DIFFUSE);
+}
+
+/**
+ * The color the combiners add to that of the fragment lighting unit with
+ * color material.  The unit only makes the terms the combiners multiply
+ * by the vertex color, or with only the ambient material tracked, the
+ * terms they don't.  The others are here: the emission, plus the ambient
+ * terms unless both materials are tracked.
+ *
+ * The ambient of each light is taken without the spotlight and distance
+ * attenuation the unit would apply to it.
+ */
+void _gl3ds_lighting_color(struct gl_context *ctx, GLfloat color[3])
+{
+	GLbitfield cm = tracked_material(ctx);
+	struct gl_light *light;
+
+	if (cm == (MAT_BIT_FRONT_AMBIENT | MAT_BIT_FRONT_DIFFUSE)) {
+		COPY_3V(color, ctx->Light.Material.Attrib[MAT_ATTRIB_FRONT_EMISSION]);
+		return;
+	}
+
+	if (cm == MAT_BIT_FRONT_DIFFUSE) {
+		COPY_3V(color, ctx->Light._BaseColor[0]);
+		foreach(light, &ctx->Light.EnabledList)
+			ACC_3V(color, light->_MatAmbient[0]);
+	} else {
+		// To be multiplied by the vertex color
+		COPY_3V(color, ctx->Light.Model.Ambient);
+		foreach(light, &ctx->Light.EnabledList)
+			ACC_3V(color, light->Ambient);
+	}
+}
+
+/**
+ * Set the fragment lighting unit up for the enabled lights, the front
+ * material and the light model.  With color material the unit makes the
+ * terms of the tracked materials, without them, for the combiners to
+ * multiply by the vertex color (see _gl3ds_lighting_color()).
+ */
+void _gl3ds_update_fragment_lighting(struct gl_context *ctx)
+{
+	static const GLfloat zero[3] = { 0.0F, 0.0F, 0.0F };
+	struct gl_fraglight_state *fl = &ctx->FragLight;
+	GLfloat (*mat)[4] = ctx->Light.Material.Attrib;
+	GLbitfield cm = tracked_material(ctx);
+	struct gl_light *light;
+	u32 config1 = ~CONFIG1_D0;
+	u32 permutation = 0;
+	GLuint count = 0;
+	GLfloat base[3];
+
+	if (!_gl3ds_fragment_lighting(ctx)) {
+		GPUCMD_AddWrite(GPUREG_LIGHTING_ENABLE0, 0);
+		GPUCMD_AddWrite(GPUREG_LIGHTING_ENABLE1, 1);
+		return;
+	}
+
+	foreach(light, &ctx->Light.EnabledList) {
+		GLuint i = light - ctx->Light.Light;
+		u32 regs[8], config[3];
+		GLfloat pos[3], dir[3];
+
+		regs[0] = pack_color(light->_MatSpecular[0]);
+		regs[1] = 0;
+		regs[2] = pack_color(cm & MAT_BIT_FRONT_DIFFUSE ? light->Diffuse : light->_MatDiffuse[0]);
+		if (!cm)
+			regs[3] = pack_color(light->_MatAmbient[0]);
+		else if (cm == (MAT_BIT_FRONT_AMBIENT | MAT_BIT_FRONT_DIFFUSE))
+			regs[3] = pack_color(light->Ambient);
+		else
+			regs[3] = 0;
+
+		COPY_3V(pos, light->EyePosition);
+		if (light->_Flags & LIGHT_POSITIONAL)
+			SELF_SCALE_SCALAR_3V(pos, 1.0F / light->EyePosition[3]);
+		regs[4] = _mesa_float_to_half(pos[0]) | (u32) _mesa_float_to_half(pos[1]) << 16;
+		regs[5] = _mesa_float_to_half(pos[2]);
+
+		// The unit takes the direction towards the spotlight
+		COPY_3V(dir, light->SpotDirection);
+		NORMALIZE_3FV(dir);
+		regs[6] = to_fixed13(-dir[0]) | to_fixed13(-dir[1]) << 16;
+		regs[7] = to_fixed13(-dir[2]);
+		GPUCMD_AddIncrementalWrites(GPUREG_LIGHT0_SPECULAR0 + i * 0x10, regs, 8);
+
+		config[0] = light->_Flags & LIGHT_POSITIONAL ? 0 : 1;
+		config[1] = to_float20(0.0F);
+		config[2] = to_float20(1.0F);
+
+		if (light->_Flags & LIGHT_SPOT) {
+			load_lut(fl, LUT_SP(i), LUT_SPOT, light->_CosCutoff, light->SpotExponent, 0.0F, 0.0F);
+			config1 &= ~CONFIG1_SP(i);
+		}
+
+		if ((light->_Flags & LIGHT_POSITIONAL) &&
+			(light->ConstantAttenuation != 1.0F ||
+			 light->LinearAttenuation != 0.0F ||
+			 light->QuadraticAttenuation != 0.0F)) {
+			GLfloat range = attenuation_range(light);
+
+			load_lut(fl, LUT_DA(i), LUT_ATTENUATION, range, light->ConstantAttenuation,
+					 light->LinearAttenuation, light->QuadraticAttenuation);
+			config[2] = to_float20(1.0F / range);
+			config1 &= ~CONFIG1_DA(i);
+		}
+		GPUCMD_AddIncrementalWrites(GPUREG_LIGHT0_CONFIG + i * 0x10, config, 3);
+
+		permutation |= i << (count * 4);
+		count++;
+	}
+
+	// The unit runs at least one light, a dark one does nothing
+	if (!count) {
+		static const u32 dark[4] = { 0, 0, 0, 0 };
+
+		GPUCMD_AddIncrementalWrites(GPUREG_LIGHT0_SPECULAR0, (u32 *) dark, 4);
+		count = 1;
+	}
+
+	load_lut(fl, LUT_D0, LUT_DISTRIBUTION, mat[MAT_ATTRIB_FRONT_SHININESS][0], 0.0F, 0.0F, 0.0F);
+
+	if (!cm)
+		COPY_3V(base, ctx->Light._BaseColor[0]);
+	else if (cm == (MAT_BIT_FRONT_AMBIENT | MAT_BIT_FRONT_DIFFUSE))
+		COPY_3V(base, ctx->Light.Model.Ambient);
+	else if (cm == MAT_BIT_FRONT_AMBIENT)
+		COPY_3V(base, mat[MAT_ATTRIB_FRONT_EMISSION]);
+	else
+		COPY_3V(base, zero);
+
+	GPUCMD_AddWrite(GPUREG_LIGHTING_AMBIENT, pack_color(base));
+	GPUCMD_AddWrite(GPUREG_LIGHTING_NUM_LIGHTS, count - 1);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_CONFIG0, CONFIG0);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_CONFIG1, config1);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_LIGHT_PERMUTATION, permutation);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_LUTINPUT_ABS, LUTINPUT_ABS);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_LUTINPUT_SELECT, LUTINPUT_SELECT);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_LUTINPUT_SCALE, 0);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_ENABLE0, 1);
+	GPUCMD_AddWrite(GPUREG_LIGHTING_ENABLE1, 0);
+}
+
+/**
+ * Forget the tables on the GPU, after it was reset or used by another
+ * context.
+ */
+void _gl3ds_reset_fragment_lighting(struct gl_context *ctx)
+{
+	ctx->FragLight.LoadedMask = 0;
+	ctx->NewState |= _NEW_LIGHT;
+}
@@ -0,0 +1,16 @@
+#ifndef GL3DS_FRAGLIGHT
+#define GL3DS_FRAGLIGHT
+
+#include "glheader.h"
+
+struct gl_context;
+
+/** State the fragment lighting unit is set up from */
+#define _FRAGMENT_LIGHTING_STATE (_NEW_LIGHT | _NEW_PROGRAM)
+
+GLboolean _gl3ds_fragment_lighting(const struct gl_context *ctx);
+void _gl3ds_lighting_color(struct gl_context *ctx, GLfloat color[3]);
+void _gl3ds_update_fragment_lighting(struct gl_context *ctx);
+void _gl3ds_reset_fragment_lighting(struct gl_context *ctx);
+
+#endif
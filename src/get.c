@@ -897,7 +897,7 @@ find_custom_value(struct gl_context *ctx, const struct value_desc *d, union valu
        */
 //      v->value_int =
 //	 ctx->Shader.ActiveProgram ? ctx->Shader.ActiveProgram->Name : 0;
-		   v->value_int = (GLint) ctx->Shared->Shader->Program;
+		   v->value_int = ctx->Shared->Shader->Program ? ctx->Shared->Shader->Program->Name : 0;
       break;
    case GL_READ_FRAMEBUFFER_BINDING_EXT:
       v->value_int = ctx->ReadBuffer->Name;
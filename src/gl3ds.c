@@ -1,6 +1,10 @@
 #include "context.h"
 #include "glheader.h"
 #include "shader.h"
+#include "tev.h"
+#include "fraglight.h"
+#include "fog.h"
+#include "ffvertex.h"
 #include "drivers/driverfuncs.h"
 #include "matrix.h"
 #include "polygon.h"
@@ -15,9 +19,12 @@
 #include "teximage.h"
 #include "texstore.h"
 #include "depth.h"
+#include "varray.h"
+#include "bufferalloc.h"
+#include "bufferobj.h"
+#include "shared.h"
 #include "mtypes.h"
-
-#define RGBA8(r, g, b, a) ((((r)&0xFF)<<24) | (((g)&0xFF)<<16) | (((b)&0xFF)<<8) | (((a)&0xFF)<<0))
+#include "screenbuffer.h"
 
 //Apt hook cookie
 static aptHookCookie apt_hook_cookie;
@@ -25,11 +32,33 @@ static aptHookCookie apt_hook_cookie;
 
 // Called by glClear
 void gl3ds_Clear(struct gl_context *ctx, GLbitfield mask) {
-	// TODO: implement masks
-	u32 color = RGBA8((char)ctx->Color.ClearColor.i[0], (char)ctx->Color.ClearColor.i[1], (char)ctx->Color.ClearColor.i[2], (char)ctx->Color.ClearColor.i[3]);
-	GX_MemoryFill(ctx->FrameBuffer, color, &ctx->FrameBuffer[0x2EE00], GX_FILL_TRIGGER | GX_FILL_32BIT_DEPTH,
-					 ctx->DepthBuffer, 0x00000000, &ctx->DepthBuffer[0x2EE00], GX_FILL_TRIGGER | GX_FILL_32BIT_DEPTH);
-	gspWaitForPSC0();
+	_gl3ds_clear_screen_buffers(ctx, mask);
+}
+
+
+/**
+ * Send the commands added since they were last run to the GPU, ending
+ * with a flush of its framebuffer cache.  The GPU takes them in turn with
+ * the GX work queued before and after; P3D signals when they are done.
+ */
+void _gl3ds_run_commands(struct gl_context *ctx)
+{
+	u32 *buf, size, offset;
+
+	// What was written through coherent mappings has to be in memory first
+	_gl3ds_flush_coherent_mappings(ctx);
+
+	GPU_FinishDrawing();
+	GPUCMD_Finalize();
+	GPUCMD_GetBuffer(&buf, &size, &offset);
+
+	// GPUCMD_FlushAndRun() runs its buffer from the start, point it past what already ran
+	GPUCMD_SetBuffer(buf + ctx->CommandBufferRun, size - ctx->CommandBufferRun, offset - ctx->CommandBufferRun);
+	GPUCMD_FlushAndRun();
+	GPUCMD_SetBuffer(buf, size, offset);
+
+	ctx->CommandBufferRun = offset;
+	ctx->Drawn = GL_FALSE;
 }
 
 
@@ -51,12 +80,19 @@ static void apt_hook_func(APT_HookType hook, void* param)
 		if (hook == APTHOOK_ONRESTORE) {
 
 			GPU_Reset(NULL, ctx->CommandBuffer, ctx->CommandBufferSize);
+			_gl3ds_reset_program(ctx);
 			ctx->NewState = _NEW_PROGRAM;
+			_gl3ds_reset_tev(ctx);
+			_gl3ds_reset_fragment_lighting(ctx);
+			_gl3ds_reset_fog(ctx);
 			_gl3ds_update_program(ctx);
 			GPUCMD_Finalize();
 			GPUCMD_FlushAndRun();
 			gspWaitForP3D();
 			GPUCMD_SetBufferOffset(0);
+			ctx->CommandBufferRun = 0;
+			// The screens may have been used by another application
+			ctx->Presented[0] = ctx->Presented[1] = NULL;
 //			ctx->NewState = _NEW_VIEWPORT | _NEW_PROJECTION | _NEW_MODELVIEW;
 		}
 	}
@@ -66,32 +102,57 @@ static void apt_hook_func(APT_HookType hook, void* param)
 static void
 gl3ds_update_state( struct gl_context *ctx, GLuint new_state )
 {
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+
+	if (_gl3ds_select_program(ctx, new_state))
+		new_state |= _NEW_PROGRAM;
+
+	_gl3ds_update_device_matrices(ctx, new_state);
+
+	if (new_state & _FOG_STATE)
+		_gl3ds_update_fog(ctx);
+
 	if (new_state & _NEW_PROGRAM) {
-		_gl3ds_upload_matrix(ctx->ProjectionMatrixStack.Top, ctx->Shared->Shader->ProjectionUniform, new_state & _NEW_PROJECTION);
-		_gl3ds_upload_matrix(ctx->ModelviewMatrixStack.Top, ctx->Shared->Shader->ModelviewUniform, false);
-		_gl3ds_upload_matrix(ctx->TextureMatrixStack[0].Top, ctx->Shared->Shader->TextureUniform, false);
+		// Looks up the matrix uniforms of the program
+		_gl3ds_bind_program(ctx);
+		_gl3ds_upload_matrix(ctx, &ctx->ProjectionMatrixStack, shader->ProjectionUniform);
+		_gl3ds_upload_matrix(ctx, &ctx->ModelviewMatrixStack, shader->ModelviewUniform);
+		_gl3ds_upload_matrix(ctx, &ctx->TextureMatrixStack[0], shader->TextureUniform);
 	} else {
 		if (new_state & _NEW_PROJECTION) {
-			_gl3ds_upload_matrix(ctx->ProjectionMatrixStack.Top, ctx->Shared->Shader->ProjectionUniform, true);
+			_gl3ds_upload_matrix(ctx, &ctx->ProjectionMatrixStack, shader->ProjectionUniform);
 		}
 
 		if (new_state & _NEW_MODELVIEW) {
-			_gl3ds_upload_matrix(ctx->ModelviewMatrixStack.Top, ctx->Shared->Shader->ModelviewUniform, false);
+			_gl3ds_upload_matrix(ctx, &ctx->ModelviewMatrixStack, shader->ModelviewUniform);
 		}
 
 		if (new_state & _NEW_TEXTURE_MATRIX) {
 			// TODO: Handle other texunits
-			_gl3ds_upload_matrix(ctx->TextureMatrixStack[ctx->Texture.CurrentUnit].Top, ctx->Shared->Shader->TextureUniform, false);
+			_gl3ds_upload_matrix(ctx, &ctx->TextureMatrixStack[ctx->Texture.CurrentUnit], shader->TextureUniform);
 		}
 	}
 
+	// Generated programs have no name
+	if (shader->_Current && !shader->_Current->Name && (new_state & _FF_VERTEX_UNIFORM_STATE))
+		_gl3ds_ff_vertex_uniforms(ctx);
+
 	_gl3ds_update_program(ctx);
 
+	if (new_state & _FRAGMENT_LIGHTING_STATE)
+		_gl3ds_update_fragment_lighting(ctx);
+
+	if (new_state & _TEV_STATE)
+		_gl3ds_update_tev(ctx);
+
 	if (new_state & _NEW_VIEWPORT)
 		_gl3ds_update_viewport(ctx);
 
 	if (new_state & _NEW_SCISSOR)
 		_gl3ds_update_scissor(ctx);
+
+	if (new_state & (_NEW_ARRAY | _NEW_BUFFER_OBJECT))
+		_gl3ds_update_arrays(ctx);
 }
 
 void make_current(struct gl_context *ctx)
@@ -113,6 +174,11 @@ void make_current(struct gl_context *ctx)
 		GPU_Reset(NULL, ctx->CommandBuffer, ctx->CommandBufferSize);
 	} else {
 		GPUCMD_SetBuffer(ctx->CommandBuffer, ctx->CommandBufferSize, ctx->CommandBufferOffset);
+		// The previous context set its own program and stages up on the GPU
+		_gl3ds_reset_program(ctx);
+		_gl3ds_reset_tev(ctx);
+		_gl3ds_reset_fragment_lighting(ctx);
+		_gl3ds_reset_fog(ctx);
 	}
 
 	_mesa_make_current(ctx, ctx->DrawBuffer, ctx->ReadBuffer);
@@ -168,49 +234,14 @@ void update_context(struct gl_context *ctx)
 
 	int i;
 
-	GPU_SetTexEnv(0,
-				  GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR), // RGB channels
-				  GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR), // Alpha
-//				  GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0x1, 0), // RGB channels
-//				  GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0x1, 0), // Alpha
-				  GPU_TEVOPERANDS(0, 0, 0), // RGB
-				  GPU_TEVOPERANDS(0, 0, 0), // Alpha
-//				  GPU_MODULATE, GPU_MODULATE, // RGB, Alpha
-				  GPU_REPLACE, GPU_REPLACE, // RGB, Alpha
-				  0xFFFFFFFF);
-
-	for (i = 1; i < 6; i++) {
-		struct gl_texture_unit *unit = &ctx->Texture.Unit[i];
-		struct gl_tex_env_combine_state* env = &unit->Combine;
-//		if (i == 0)
-//		GPU_SetTexEnv(i,
-//					  GPU_TEVSOURCES(env->SourceRGB[0], env->SourceRGB[1], env->SourceRGB[2]),
-//					  GPU_TEVSOURCES(env->SourceA[0], env->SourceA[1], env->SourceA[2]),
-//					  GPU_TEVOPERANDS(env->OperandRGB[0], env->OperandRGB[1], env->OperandRGB[2]),
-//					  GPU_TEVOPERANDS(env->OperandA[0], env->OperandA[1], env->OperandA[2]),
-//					  env->ModeRGB,
-//					  env->ModeA,
-//					  0xFFFFFFFF); // TODO: Use unit->EnvColor[0]
-//		else
-		GPU_SetTexEnv(i,
-					  GPU_TEVSOURCES(GPU_PREVIOUS, 0, 0),
-					  GPU_TEVSOURCES(GPU_PREVIOUS, 0, 0),
-					  GPU_TEVOPERANDS(0,0,0),
-					  GPU_TEVOPERANDS(0,0,0),
-					  GPU_REPLACE,
-					  GPU_REPLACE,
-					  0xFFFFFFFF);
-	}
-
 	GLubyte enabledTexUnits = 0x0;
 
-	for (i = 0; i < 3; i++) {
+	for (i = 0; i < PICA_TEXTURE_UNITS; i++) {
 //	for (i = 0; i < ctx->Const.MaxTextureUnits; i++) {
 		struct gl_texture_unit *texUnit = &ctx->Texture.Unit[i];
 		struct gl_texture_object *texObj = texUnit->CurrentTex[TEXTURE_2D_INDEX];
 		struct swrast_texture_image *swImage = swrast_texture_image(_mesa_select_tex_image(texObj, GL_TEXTURE_2D, 0));
 		if (swImage) {
-			struct gl_tex_env_combine_state* env = &texUnit->Combine;
 			if (swImage->NeedsTiling) {
 				swImage->NeedsTiling = GL_FALSE;
 				imageTile32(swImage->TiledBuffer, swImage->Buffer, swImage->Base.Width, swImage->Base.Height);
@@ -223,28 +254,6 @@ void update_context(struct gl_context *ctx)
 					GPU_TEXTURE_MAG_FILTER(GPU_NEAREST) | GPU_TEXTURE_MIN_FILTER(GPU_NEAREST) | GPU_TEXTURE_WRAP_S(GPU_CLAMP_TO_EDGE) | GPU_TEXTURE_WRAP_T(GPU_CLAMP_TO_EDGE),
 					GPU_RGBA8);
 
-			GPU_SetTexEnv(
-					i,
-//					GPU_TEVSOURCES(GPU_TEXTURE0, GPU_FRAGMENT_PRIMARY_COLOR, 0),
-//					GPU_TEVSOURCES(GPU_TEXTURE0, GPU_FRAGMENT_PRIMARY_COLOR, 0),
-					GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, 0),
-					GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, 0),
-					GPU_TEVOPERANDS(GPU_TEVOP_RGB_SRC_COLOR, GPU_TEVOP_RGB_SRC_COLOR, 0),
-//					GPU_TEVOPERANDS(GPU_SRC_COLOR, GPU_SRC_COLOR, GPU_SRC_ALPHA),
-					GPU_TEVOPERANDS(GPU_TEVOP_A_SRC_ALPHA, GPU_TEVOP_A_SRC_ALPHA, 0),
-//					GPU_TEVOPERANDS(GPU_SRC_ALPHA, GPU_SRC_ALPHA, GPU_SRC_ALPHA),
-					GPU_MODULATE, GPU_MODULATE,
-//			GPU_REPLACE, GPU_REPLACE,
-					0xFFFFFFFF
-			);
-//			GPU_SetTexEnv(i,
-//						  GPU_TEVSOURCES(env->SourceRGB[0], env->SourceRGB[1], env->SourceRGB[2]),
-//						  GPU_TEVSOURCES(env->SourceA[0], env->SourceA[1], env->SourceA[2]),
-//						  GPU_TEVOPERANDS(env->OperandRGB[0], env->OperandRGB[1], env->OperandRGB[2]),
-//						  GPU_TEVOPERANDS(env->OperandA[0], env->OperandA[1], env->OperandA[2]),
-//						  env->ModeRGB,
-//						  env->ModeA,
-//						  0xFFFFFFFF); // TODO: Use unit->EnvColor[0]
 			enabledTexUnits |= (1 << i);
 //			printf("texunit(%d w:%d h:%d)\n", i, swImage->Base.Width, swImage->Base.Height);
 		}
@@ -254,36 +263,100 @@ void update_context(struct gl_context *ctx)
 
 //	ctx->NewState = _NEW_VIEWPORT;
 	ctx->NewState = 0;
+	ctx->Drawn = GL_TRUE;
+	_gl3ds_screen_buffers_drawn(ctx);
+}
+
+
+/**
+ * Visual bits of the formats a context can be created with.  Depth and
+ * stencil are asked for as GL_DEPTH24_STENCIL8 only.  Supersampling is
+ * told by the samples of the visual.
+ */
+static struct gl_config *create_visual(const gl3ds_contextConfig *config)
+{
+	GLint r, g, b, a, depth, stencil = 0, samples;
+
+	switch (config->colorFormat) {
+	case GL_RGBA8:   r = g = b = a = 8; break;
+	case GL_RGB8:    r = g = b = 8; a = 0; break;
+	case GL_RGB565:  r = b = 5; g = 6; a = 0; break;
+	case GL_RGB5_A1: r = g = b = 5; a = 1; break;
+	case GL_RGBA4:   r = g = b = a = 4; break;
+	default:
+		return NULL;
+	}
+
+	switch (config->depthFormat) {
+	case GL_DEPTH_COMPONENT16:  depth = 16; break;
+	case GL_DEPTH_COMPONENT24:  depth = 24; break;
+	case GL_DEPTH24_STENCIL8:   depth = 24; stencil = 8; break;
+	default:
+		return NULL;
+	}
+
+	switch (config->samples) {
+	case 0:
+	case 1:  samples = 0; break;
+	case 2:
+	case 4:  samples = config->samples; break;
+	default:
+		return NULL;
+	}
+
+	return _mesa_create_visual(GL_TRUE, GL_FALSE, r, g, b, a, depth, stencil, 0, 0, 0, 0, samples);
 }
 
 
 GLuint gl3ds_createContext(GLuint sharedContext, gfxScreen_t screen)
 {
-	struct gl_context* ctx = CALLOC_STRUCT(gl_context);
+	static const gl3ds_contextConfig config = { GL_RGBA8, GL_DEPTH24_STENCIL8, 0 };
+	return gl3ds_createContextWithConfig(sharedContext, screen, &config);
+}
+
+
+GLuint gl3ds_createContextWithConfig(GLuint sharedContext, gfxScreen_t screen, const gl3ds_contextConfig* config)
+{
+	struct gl_context* ctx;
 	struct gl_context* shared_ctx = NULL;
-	struct dd_function_table* driverFunctions = CALLOC_STRUCT(dd_function_table);
+	struct dd_function_table* driverFunctions;
+	struct gl_config *vis;
+	GLboolean ok;
 
-	if (!ctx)
-		return NULL;
+	if (!config || !(vis = create_visual(config)))
+		return 0;
+
+	ctx = CALLOC_STRUCT(gl_context);
+	driverFunctions = CALLOC_STRUCT(dd_function_table);
+	if (!ctx || !driverFunctions) {
+		free(ctx);
+		free(driverFunctions);
+		_mesa_destroy_visual(vis);
+		return 0;
+	}
 	if (sharedContext > 0)
 		shared_ctx = (struct gl_context*) sharedContext;
 
-	struct gl_config *vis = _mesa_create_visual(GL_TRUE, GL_FALSE, 8, 8, 8, 8, 32, 8, 0, 0, 0, 0, 1);
-
 	_mesa_init_driver_functions(driverFunctions);
 
 	driverFunctions->GetString =   NULL;
 	driverFunctions->UpdateState = gl3ds_update_state;
 	driverFunctions->Clear =       gl3ds_Clear;
 	driverFunctions->Flush =       gl3ds_Flush;
+	driverFunctions->DiscardFramebuffer = _gl3ds_discard_screen_buffers;
+	driverFunctions->ReadPixels =  _gl3ds_read_pixels;
 
-	if (_mesa_initialize_context(ctx, vis, shared_ctx, driverFunctions)) {
+	// The screen buffers are sized for it
+	ctx->Screen = screen;
+	ok = _mesa_initialize_context(ctx, vis, shared_ctx, driverFunctions);
+	_mesa_destroy_visual(vis);
+
+	if (ok) {
 		ctx->RenderMode = GL_RENDER; // From feedback.c
-		ctx->Screen = screen;
 		return (GLuint) ctx;
 	} else {
 		free(ctx);
-		return NULL;
+		return 0;
 	}
 
 }
@@ -317,27 +390,29 @@ void gl3ds_deleteContext(GLuint context)
 }
 
 
-#define DISPLAY_TRANSFER_FLAGS \
-	(GX_TRANSFER_FLIP_VERT(0) | GX_TRANSFER_OUT_TILED(0) | GX_TRANSFER_RAW_COPY(0) | \
-	GX_TRANSFER_IN_FORMAT(GX_TRANSFER_FMT_RGBA8) | GX_TRANSFER_OUT_FORMAT(GX_TRANSFER_FMT_RGB8) | \
-	GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
-
 void gl3ds_flushContext(GLuint context)
 {
 	struct gl_context* ctx = (struct gl_context*) context;
 //	ctx->NewState = _NEW_ALL;
 //	update_context(ctx);
-	GPU_FinishDrawing();
-	GPUCMD_Finalize();
-	GPUCMD_FlushAndRun();
+	// The present below waits on the event a buffer transfer signals
+	_gl3ds_finish_transfer(ctx);
+	_gl3ds_run_commands(ctx);
 	gspWaitForP3D();
 
-	u32 dim = (ctx->Screen == GFX_TOP) ? GX_BUFFER_DIM(240, 400) : GX_BUFFER_DIM(240, 320);
-	GX_DisplayTransfer(ctx->FrameBuffer, dim, (u32*)gfxGetFramebuffer(ctx->Screen, GFX_LEFT, NULL, NULL), dim, DISPLAY_TRANSFER_FLAGS);
-	gspWaitForPPF();
+	/* The frame has executed, storage retired before the frames of all the
+	 * contexts sharing it can be reused.  The next frame re-emits the
+	 * vertex arrays, noting the buffers it reads.
+	 */
+	_gl3ds_shared_next_frame(ctx);
+	ctx->NewState |= _NEW_ARRAY;
+
+	_gl3ds_present_screen_buffer(ctx);
 
 //	ctx->CommandBufferOffset = 0;
 	GPUCMD_SetBufferOffset(0);
+	ctx->CommandBufferRun = 0;
+	ctx->StreamBufferOffset = 0;
 }
 
 
@@ -347,3 +422,22 @@ void gl3ds_swapBuffers()
 	gfxSwapBuffersGpu();
 	gspWaitForVBlank();
 }
+
+
+void gl3ds_addDamage(GLuint context, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	struct gl_context* ctx = (struct gl_context*) context;
+	if (width < 0 || height < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "gl3ds_addDamage");
+		return;
+	}
+	_gl3ds_add_damage(ctx, x, y, width, height);
+}
+
+
+void gl3ds_getBufferPoolStats(GLuint context, gl3ds_bufferPoolStats* stats)
+{
+	struct gl_context* ctx = (struct gl_context*) context;
+	if (ctx && stats)
+		_gl3ds_buffer_pool_stats(ctx->Shared->BufferPool, stats);
+}
@@ -545,10 +545,10 @@ _mesa_bytes_per_vertex_attrib(GLint comps, GLenum type)
       return comps * sizeof(GLfloat);
    case GL_HALF_FLOAT:
       return comps * sizeof(GLhalfARB);
-//   case GL_DOUBLE:
-//      return comps * sizeof(GLdouble);
-//   case GL_FIXED:
-//      return comps * sizeof(GLfixed);
+   case GL_DOUBLE:
+      return comps * sizeof(GLdouble);
+   case GL_FIXED:
+      return comps * sizeof(GLfixed);
    case GL_INT_2_10_10_10_REV:
    case GL_UNSIGNED_INT_2_10_10_10_REV:
       if (comps == 4)
@@ -45,17 +45,17 @@
 
 
 /**
- * Names of the corresponding GLmatrixtype values.
+ * Names of the corresponding GLmatrixtype values, for _math_matrix_print().
  */
-static const char *types[] = {
-		"MATRIX_GENERAL",
-		"MATRIX_IDENTITY",
-		"MATRIX_3D_NO_ROT",
-		"MATRIX_PERSPECTIVE",
-		"MATRIX_2D",
-		"MATRIX_2D_NO_ROT",
-		"MATRIX_3D"
-};
+//static const char *types[] = {
+//		"MATRIX_GENERAL",
+//		"MATRIX_IDENTITY",
+//		"MATRIX_3D_NO_ROT",
+//		"MATRIX_PERSPECTIVE",
+//		"MATRIX_2D",
+//		"MATRIX_2D_NO_ROT",
+//		"MATRIX_3D"
+//};
 
 
 /**
@@ -127,6 +127,120 @@ static void matmul34( GLfloat *product, const GLfloat *a, const GLfloat *b )
 	P(3,3) = 1;
 }
 
+/**
+ * Multiply by a right matrix of type MATRIX_3D or MATRIX_2D, whose last
+ * elements of the first three groups of four are zero and whose last is one.
+ *
+ * \note 48 multiplications
+ */
+static void matmul_affine( GLfloat *product, const GLfloat *a, const GLfloat *b )
+{
+	GLint i;
+	for (i = 0; i < 4; i++) {
+		const GLfloat ai0=A(i,0),  ai1=A(i,1),  ai2=A(i,2),  ai3=A(i,3);
+		P(i,0) = ai0 * B(0,0) + ai1 * B(1,0) + ai2 * B(2,0) + ai3 * B(3,0);
+		P(i,1) = ai0 * B(0,1) + ai1 * B(1,1) + ai2 * B(2,1) + ai3 * B(3,1);
+		P(i,2) = ai0 * B(0,2) + ai1 * B(1,2) + ai2 * B(2,2) + ai3 * B(3,2);
+		P(i,3) = ai3;
+	}
+}
+
+/**
+ * Multiply by a right matrix of type MATRIX_3D_NO_ROT: a scale on the
+ * diagonal and a translation.
+ *
+ * \note 24 multiplications
+ */
+static void matmul_3d_no_rot( GLfloat *product, const GLfloat *a, const GLfloat *b )
+{
+	const GLfloat b00=B(0,0), b11=B(1,1), b22=B(2,2);
+	const GLfloat b30=B(3,0), b31=B(3,1), b32=B(3,2);
+	GLint i;
+	for (i = 0; i < 4; i++) {
+		const GLfloat ai0=A(i,0),  ai1=A(i,1),  ai2=A(i,2),  ai3=A(i,3);
+		P(i,0) = ai0 * b00 + ai3 * b30;
+		P(i,1) = ai1 * b11 + ai3 * b31;
+		P(i,2) = ai2 * b22 + ai3 * b32;
+		P(i,3) = ai3;
+	}
+}
+
+/**
+ * Multiply by a right matrix of type MATRIX_2D_NO_ROT, which is
+ * MATRIX_3D_NO_ROT leaving z alone.
+ *
+ * \note 16 multiplications
+ */
+static void matmul_2d_no_rot( GLfloat *product, const GLfloat *a, const GLfloat *b )
+{
+	const GLfloat b00=B(0,0), b11=B(1,1), b30=B(3,0), b31=B(3,1);
+	GLint i;
+	for (i = 0; i < 4; i++) {
+		const GLfloat ai0=A(i,0),  ai1=A(i,1),  ai2=A(i,2),  ai3=A(i,3);
+		P(i,0) = ai0 * b00 + ai3 * b30;
+		P(i,1) = ai1 * b11 + ai3 * b31;
+		P(i,2) = ai2;
+		P(i,3) = ai3;
+	}
+}
+
+/**
+ * Multiply by a right matrix of type MATRIX_PERSPECTIVE, as made by
+ * glFrustum.  The analysis makes sure of the -1.
+ *
+ * \note 24 multiplications
+ */
+static void matmul_perspective( GLfloat *product, const GLfloat *a, const GLfloat *b )
+{
+	const GLfloat b00=B(0,0), b11=B(1,1), b20=B(2,0), b21=B(2,1);
+	const GLfloat b22=B(2,2), b32=B(3,2);
+	GLint i;
+	for (i = 0; i < 4; i++) {
+		const GLfloat ai0=A(i,0),  ai1=A(i,1),  ai2=A(i,2),  ai3=A(i,3);
+		P(i,0) = ai0 * b00 + ai2 * b20;
+		P(i,1) = ai1 * b11 + ai2 * b21;
+		P(i,2) = ai2 * b22 + ai3 * b32;
+		P(i,3) = -ai2;
+	}
+}
+
+/**
+ * Multiply choosing the kernel from the type of the right matrix.  Each
+ * kernel gives what matmul4() does, leaving out the terms that the type
+ * says are zero.
+ *
+ * \param product will receive the product of \p a and \p b.
+ * \param a matrix.
+ * \param b matrix, with an up to date type.
+ *
+ * \warning As for matmul4(), \p product == \p a is allowed but not == \p b.
+ */
+static void matmul_typed( GLfloat *product, const GLfloat *a, const GLmatrix *b )
+{
+	switch (b->type) {
+	case MATRIX_IDENTITY:
+		if (product != a)
+			memcpy( product, a, sizeof(Identity) );
+		break;
+	case MATRIX_2D_NO_ROT:
+		matmul_2d_no_rot( product, a, b->m );
+		break;
+	case MATRIX_3D_NO_ROT:
+		matmul_3d_no_rot( product, a, b->m );
+		break;
+	case MATRIX_2D:
+	case MATRIX_3D:
+		matmul_affine( product, a, b->m );
+		break;
+	case MATRIX_PERSPECTIVE:
+		matmul_perspective( product, a, b->m );
+		break;
+	default:
+		matmul4( product, a, b->m );
+		break;
+	}
+}
+
 #undef A
 #undef B
 #undef P
@@ -159,18 +273,27 @@ static void matrix_multf( GLmatrix *mat, const GLfloat *m, GLuint flags )
  * \param a left matrix.
  * \param b right matrix.
  * 
- * Joins both flags and marks the type and inverse as dirty.  Calls matmul34()
- * if both matrices are 3D, or matmul4() otherwise.
+ * Joins both flags and marks the type and inverse as dirty.  When the type of
+ * \p b is known the multiplication is specialized for it, otherwise calls
+ * matmul34() if both matrices are 3D, or matmul4().
  */
 void
 _math_matrix_mul_matrix( GLmatrix *dest, const GLmatrix *a, const GLmatrix *b )
 {
+	const GLboolean typed = !(b->flags & MAT_DIRTY_TYPE);
+	const GLboolean left_identity = !(a->flags & MAT_DIRTY_TYPE) &&
+									a->type == MATRIX_IDENTITY;
+
 	dest->flags = (a->flags |
 				   b->flags |
 				   MAT_DIRTY_TYPE |
 				   MAT_DIRTY_INVERSE);
 
-	if (TEST_MAT_FLAGS(dest, MAT_FLAGS_3D))
+	if (left_identity && dest != b)
+		memcpy( dest->m, b->m, sizeof(Identity) );
+	else if (typed && dest != b)
+		matmul_typed( dest->m, a->m, b );
+	else if (TEST_MAT_FLAGS(dest, MAT_FLAGS_3D))
 		matmul34( dest->m, a->m, b->m );
 	else
 		matmul4( dest->m, a->m, b->m );
@@ -942,8 +1065,7 @@ _math_matrix_frustum( GLmatrix *mat,
  * \param nearval distance to the near clipping plane.
  * \param farval distance to the far clipping plane.
  *
- * Creates the projection matrix and multiplies it with \p mat, marking the
- * MAT_FLAG_GENERAL_SCALE and MAT_FLAG_TRANSLATION flags.
+ * Writes the projection matrix into \p mat, marking it for analysis.
  */
 void
 _math_matrix_ortho( GLmatrix *mat,
@@ -976,6 +1098,9 @@ _math_matrix_ortho( GLmatrix *mat,
 #undef M
 
 //	matrix_multf( mat, m, (MAT_FLAG_GENERAL_SCALE|MAT_FLAG_TRANSLATION));
+	/* The matrix is replaced rather than multiplied, so its type is not
+	 * known until it is analysed again */
+	mat->flags = (MAT_FLAG_GENERAL | MAT_DIRTY);
 }
 
 /**
@@ -1541,4 +1666,146 @@ _mesa_transform_vector( GLfloat u[4], const GLfloat v[4], const GLfloat m[16] )
 	u[2] = v0 * M(0,2) + v1 * M(1,2) + v2 * M(2,2) + v3 * M(3,2);
 	u[3] = v0 * M(0,3) + v1 * M(1,3) + v2 * M(2,3) + v3 * M(3,3);
 #undef M
-}
\ No newline at end of file
+}
+
+
+/**********************************************************************/
+/** \name Point transformation */
+/*@{*/
+
+/*
+ * The kernels keep the matrix in locals and do two points a loop, so the
+ * loads of the next point overlap the arithmetic of the one before.  Each
+ * is made for one size of input, where a missing w is one.
+ */
+
+#define FETCH_W3( P )  1.0F
+#define FETCH_W4( P )  (P)[3]
+
+#define TRANSFORM_KERNEL( NAME, SIZE, SETUP, BODY )			\
+static void NAME( GLfloat (*to)[4], const GLfloat m[16],		\
+				  const GLubyte *from, GLuint stride, GLuint count )	\
+{									\
+	SETUP								\
+	GLuint i;							\
+	for (i = 0; i + 1 < count; i += 2) {				\
+		const GLfloat *p = (const GLfloat *) from;			\
+		const GLfloat *p1 = (const GLfloat *) (from + stride);	\
+		const GLfloat ox = p[0], oy = p[1], oz = p[2];		\
+		const GLfloat ow = FETCH_W##SIZE(p);			\
+		const GLfloat ox1 = p1[0], oy1 = p1[1], oz1 = p1[2];	\
+		const GLfloat ow1 = FETCH_W##SIZE(p1);			\
+		GLfloat *q = to[i], *q1 = to[i + 1];			\
+		BODY(q, ox, oy, oz, ow)					\
+		BODY(q1, ox1, oy1, oz1, ow1)				\
+		from += 2 * stride;					\
+	}								\
+	if (i < count) {						\
+		const GLfloat *p = (const GLfloat *) from;			\
+		const GLfloat ox = p[0], oy = p[1], oz = p[2];		\
+		const GLfloat ow = FETCH_W##SIZE(p);			\
+		GLfloat *q = to[i];					\
+		BODY(q, ox, oy, oz, ow)					\
+	}								\
+}
+
+#define SETUP_GENERAL							\
+	const GLfloat m0 = m[0],  m4 = m[4],  m8 = m[8],  m12 = m[12];	\
+	const GLfloat m1 = m[1],  m5 = m[5],  m9 = m[9],  m13 = m[13];	\
+	const GLfloat m2 = m[2],  m6 = m[6],  m10 = m[10], m14 = m[14];	\
+	const GLfloat m3 = m[3],  m7 = m[7],  m11 = m[11], m15 = m[15];
+
+#define BODY_GENERAL( Q, X, Y, Z, W )					\
+	Q[0] = m0 * X + m4 * Y + m8  * Z + m12 * W;			\
+	Q[1] = m1 * X + m5 * Y + m9  * Z + m13 * W;			\
+	Q[2] = m2 * X + m6 * Y + m10 * Z + m14 * W;			\
+	Q[3] = m3 * X + m7 * Y + m11 * Z + m15 * W;
+
+#define SETUP_IDENTITY  (void) m;
+
+#define BODY_IDENTITY( Q, X, Y, Z, W )					\
+	Q[0] = X;  Q[1] = Y;  Q[2] = Z;  Q[3] = W;
+
+#define SETUP_AFFINE							\
+	const GLfloat m0 = m[0],  m4 = m[4],  m8 = m[8],  m12 = m[12];	\
+	const GLfloat m1 = m[1],  m5 = m[5],  m9 = m[9],  m13 = m[13];	\
+	const GLfloat m2 = m[2],  m6 = m[6],  m10 = m[10], m14 = m[14];
+
+#define BODY_AFFINE( Q, X, Y, Z, W )					\
+	Q[0] = m0 * X + m4 * Y + m8  * Z + m12 * W;			\
+	Q[1] = m1 * X + m5 * Y + m9  * Z + m13 * W;			\
+	Q[2] = m2 * X + m6 * Y + m10 * Z + m14 * W;			\
+	Q[3] = W;
+
+#define SETUP_NO_ROT							\
+	const GLfloat m0 = m[0],  m5 = m[5],  m10 = m[10];		\
+	const GLfloat m12 = m[12], m13 = m[13], m14 = m[14];
+
+#define BODY_NO_ROT( Q, X, Y, Z, W )					\
+	Q[0] = m0  * X + m12 * W;					\
+	Q[1] = m5  * Y + m13 * W;					\
+	Q[2] = m10 * Z + m14 * W;					\
+	Q[3] = W;
+
+#define SETUP_PERSPECTIVE						\
+	const GLfloat m0 = m[0],  m5 = m[5],  m8 = m[8],  m9 = m[9];	\
+	const GLfloat m10 = m[10], m14 = m[14];
+
+#define BODY_PERSPECTIVE( Q, X, Y, Z, W )				\
+	Q[0] = m0 * X + m8  * Z;					\
+	Q[1] = m5 * Y + m9  * Z;					\
+	Q[2] = m10 * Z + m14 * W;					\
+	Q[3] = -Z;
+
+TRANSFORM_KERNEL( transform_points3_general, 3, SETUP_GENERAL, BODY_GENERAL )
+TRANSFORM_KERNEL( transform_points4_general, 4, SETUP_GENERAL, BODY_GENERAL )
+TRANSFORM_KERNEL( transform_points3_identity, 3, SETUP_IDENTITY, BODY_IDENTITY )
+TRANSFORM_KERNEL( transform_points4_identity, 4, SETUP_IDENTITY, BODY_IDENTITY )
+TRANSFORM_KERNEL( transform_points3_affine, 3, SETUP_AFFINE, BODY_AFFINE )
+TRANSFORM_KERNEL( transform_points4_affine, 4, SETUP_AFFINE, BODY_AFFINE )
+TRANSFORM_KERNEL( transform_points3_no_rot, 3, SETUP_NO_ROT, BODY_NO_ROT )
+TRANSFORM_KERNEL( transform_points4_no_rot, 4, SETUP_NO_ROT, BODY_NO_ROT )
+TRANSFORM_KERNEL( transform_points3_perspective, 3, SETUP_PERSPECTIVE, BODY_PERSPECTIVE )
+TRANSFORM_KERNEL( transform_points4_perspective, 4, SETUP_PERSPECTIVE, BODY_PERSPECTIVE )
+
+typedef void (*transform_func)( GLfloat (*to)[4], const GLfloat m[16],
+								const GLubyte *from, GLuint stride, GLuint count );
+
+/** Kernels by matrix type, for inputs of three and four components */
+static const transform_func transform_tab[7][2] = {
+	{ transform_points3_general,     transform_points4_general },     /* MATRIX_GENERAL */
+	{ transform_points3_identity,    transform_points4_identity },    /* MATRIX_IDENTITY */
+	{ transform_points3_no_rot,      transform_points4_no_rot },      /* MATRIX_3D_NO_ROT */
+	{ transform_points3_perspective, transform_points4_perspective }, /* MATRIX_PERSPECTIVE */
+	{ transform_points3_affine,      transform_points4_affine },      /* MATRIX_2D */
+	{ transform_points3_no_rot,      transform_points4_no_rot },      /* MATRIX_2D_NO_ROT */
+	{ transform_points3_affine,      transform_points4_affine }       /* MATRIX_3D */
+};
+
+/**
+ * Transform an array of points by a matrix, as TRANSFORM_POINT() does.
+ *
+ * \param to receives the points, always with four components.
+ * \param mat matrix.  Its type picks the kernel when it is up to date.
+ * \param from first component of the first point.
+ * \param stride bytes from one point to the next.
+ * \param size components of the points, 3 (w is one) or 4.
+ * \param count number of points.
+ */
+void
+_math_transform_points( GLfloat (*to)[4], const GLmatrix *mat,
+						const GLfloat *from, GLuint stride,
+						GLuint size, GLuint count )
+{
+	enum GLmatrixtype type = MATRIX_GENERAL;
+
+	assert(size == 3 || size == 4);
+
+	if (!(mat->flags & MAT_DIRTY_TYPE))
+		type = mat->type;
+
+	transform_tab[type][size == 4]( to, mat->m, (const GLubyte *) from,
+									stride, count );
+}
+
+/*@}*/
@@ -276,6 +276,11 @@ do {								\
 extern void
 _mesa_transform_vector(GLfloat u[4], const GLfloat v[4], const GLfloat m[16]);
 
+extern void
+_math_transform_points( GLfloat (*to)[4], const GLmatrix *mat,
+                        const GLfloat *from, GLuint stride,
+                        GLuint size, GLuint count );
+
 
 /*@}*/
 
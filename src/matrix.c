@@ -38,9 +38,11 @@
 #include "glheader.h"
 #include "imports.h"
 #include "context.h"
+#include "cull.h"
 #include "enums.h"
 #include "macros.h"
 #include "matrix.h"
+#include "shader.h"
 #include "mtypes.h"
 #include "math/m_matrix.h"
 
@@ -524,6 +526,23 @@ update_projection( struct gl_context *ctx )
 }
 
 
+/**
+ * Return a matrix in rows, as matmul4() and the device matrices take it.
+ * Only matrices the application loaded are stored the other way, those are
+ * transposed into \p tmp.
+ */
+static const GLmatrix *
+matrix_rows( const GLmatrix *mat, GLmatrix *tmp )
+{
+   if (!(mat->flags & MAT_NEED_TRANSPOSE))
+	  return mat;
+
+   _math_transposef( tmp->m, mat->m );
+   tmp->flags = MAT_FLAG_GENERAL | MAT_DIRTY_TYPE | MAT_DIRTY_FLAGS;
+   return tmp;
+}
+
+
 /**
  * Calculate the combined modelview-projection matrix.
  *
@@ -531,16 +550,28 @@ update_projection( struct gl_context *ctx )
  *
  * Multiplies the top matrices of the projection and model view stacks into
  * __struct gl_contextRec::_ModelProjectMatrix via _math_matrix_mul_matrix()
- * and analyzes the resulting matrix via _math_matrix_analyse().
+ * and analyzes the resulting matrix via _math_matrix_analyse().  The product
+ * is in rows, like the device matrices.
  */
 static void
 calculate_model_project_matrix( struct gl_context *ctx )
 {
+   GLfloat proj_rows[16], mv_rows[16];
+   GLmatrix proj_tmp = { proj_rows, NULL, 0, MATRIX_GENERAL };
+   GLmatrix mv_tmp = { mv_rows, NULL, 0, MATRIX_GENERAL };
+
+   /* Already multiplied ahead of the draw, for culling */
+   if (_gl3ds_cull_current(ctx))
+      return;
+
    _math_matrix_mul_matrix( &ctx->_ModelProjectMatrix,
-							ctx->ProjectionMatrixStack.Top,
-							ctx->ModelviewMatrixStack.Top );
+							matrix_rows( ctx->ProjectionMatrixStack.Top, &proj_tmp ),
+							matrix_rows( ctx->ModelviewMatrixStack.Top, &mv_tmp ) );
 
    _math_matrix_analyse( &ctx->_ModelProjectMatrix );
+
+   /* The frustum planes are made from it */
+   ctx->Cull.Valid = GL_FALSE;
 }
 
 
@@ -705,30 +736,57 @@ void _mesa_init_transform( struct gl_context *ctx )
 	ctx->Transform.ClipPlanesEnabled = 0;
 }
 
-static void rotate_projection(GLmatrix *mat)
+/**
+ * Recompute a stack's device matrix from its top: in rows, as the vertex
+ * programs take them, and for the projection with the screen fix applied.
+ * The top itself is left as the application set it.
+ */
+static void update_device_matrix(struct gl_matrix_stack *stack, bool projection)
 {
-	// Rotate 90 degree clockwise (3DS screens are sideways)
-	// Convert Z from [-1,1] to [0,1]
-	GLfloat fix[16] = {
-			0, -1,  0,   0,
-			1,  0,  0,   0,
-			0,  0,  0.5, 0,
-			0,  0, -0.5, 1
-	};
-	_math_matrix_mul_floats(mat, fix);
+	const GLfloat *m = stack->Top->m;
+	GLfloat fixed[16];
+	int i;
+
+	if (projection) {
+		// Rotate 90 degree clockwise (3DS screens are sideways)
+		// Convert Z from [-1,1] to [0,1]
+		// That is the top times { 0,-1,0,0, 1,0,0,0, 0,0,0.5,0, 0,0,-0.5,1 }
+		for (i = 0; i < 4; i++) {
+			fixed[i*4 + 0] = m[i*4 + 1];
+			fixed[i*4 + 1] = -m[i*4 + 0];
+			fixed[i*4 + 2] = 0.5F * (m[i*4 + 2] - m[i*4 + 3]);
+			fixed[i*4 + 3] = m[i*4 + 3];
+		}
+		m = fixed;
+	}
+
+	if (stack->Top->flags & MAT_NEED_TRANSPOSE)
+		_math_transposef(stack->Device, m);
+	else
+		memcpy(stack->Device, m, sizeof(stack->Device));
 }
 
-void _gl3ds_upload_matrix(GLmatrix *mat, GLint uniform, bool rotate)
+/**
+ * Bring the device matrices of the stacks that changed up to date.
+ */
+void _gl3ds_update_device_matrices(struct gl_context *ctx, GLbitfield new_state)
 {
-	if (rotate)
-		rotate_projection(mat);
+	GLuint i;
+
+	if (new_state & _NEW_PROJECTION)
+		update_device_matrix(&ctx->ProjectionMatrixStack, true);
+
+	if (new_state & _NEW_MODELVIEW)
+		update_device_matrix(&ctx->ModelviewMatrixStack, false);
 
-	if (mat->flags & MAT_NEED_TRANSPOSE) {
-		GLfloat copy[16];
-		_math_transposef(copy, mat->m);
-		memcpy(mat->m, copy, sizeof(GLfloat)*16);
-		mat->flags &= ~MAT_NEED_TRANSPOSE;
+	// The texture stacks share their dirty flag
+	if (new_state & _NEW_TEXTURE_MATRIX) {
+		for (i = 0; i < ARRAY_SIZE(ctx->TextureMatrixStack); i++)
+			update_device_matrix(&ctx->TextureMatrixStack[i], false);
 	}
+}
 
-	glUniformMatrix4fv(uniform, 1, GL_TRUE, mat->m);
+void _gl3ds_upload_matrix(struct gl_context *ctx, const struct gl_matrix_stack *stack, GLint uniform)
+{
+	_gl3ds_set_uniforms(ctx, ctx->Shared->Shader->Uniforms, uniform, 4, stack->Device);
 }
@@ -5,11 +5,13 @@
 #include "math/m_matrix.h"
 
 struct gl_context;
+struct gl_matrix_stack;
 
 void _mesa_init_matrix( struct gl_context * ctx );
 void _mesa_init_transform( struct gl_context *ctx );
 void _mesa_free_matrix_data( struct gl_context *ctx );
 void _mesa_update_modelview_project( struct gl_context *ctx, GLuint newstate );
-void _gl3ds_upload_matrix(GLmatrix *mat, GLint uniform, bool rotate);
+void _gl3ds_update_device_matrices(struct gl_context *ctx, GLbitfield new_state);
+void _gl3ds_upload_matrix(struct gl_context *ctx, const struct gl_matrix_stack *stack, GLint uniform);
 
 #endif
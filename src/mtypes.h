@@ -790,6 +790,29 @@ struct gl_fog_attrib
 };
 
 
+/**
+ * What the fog lookup table is generated from: the fog parameters, and
+ * the depth terms of the projection matrix depth is turned back into eye
+ * distance with.
+ */
+struct gl_fog_lut_key
+{
+   GLenum Mode;
+   GLfloat Density;
+   GLfloat Start;
+   GLfloat End;
+   GLfloat Projection[4];
+};
+
+/** The fog lookup table last written to the GPU */
+struct gl_fog_lut_state
+{
+   struct gl_fog_lut_key Loaded;
+   GLuint Hash;            /**< Of the parameters Loaded holds */
+   GLboolean Known;        /**< Loaded is what the GPU has */
+};
+
+
 /** 
  * Hint attribute group (GL_HINT_BIT).
  * 
@@ -808,6 +831,38 @@ struct gl_hint_attrib
 };
 
 
+/**
+ * What a lighting lookup table is generated from: its kind and the GL
+ * parameters the kind takes.
+ */
+struct gl_light_lut_key
+{
+   GLuint Kind;
+   GLfloat Param[4];
+};
+
+/** A lighting lookup table in the form the GPU takes it */
+struct gl_light_lut
+{
+   struct gl_light_lut_key Key;
+   GLuint Hash;
+   GLuint LastUse;         /**< Zero for an unused entry */
+   u32 Data[PICA_LIGHT_LUT_SIZE];
+};
+
+/**
+ * Lookup tables generated for the fragment lighting unit, and the ones
+ * last written to each of its tables.
+ */
+struct gl_fraglight_state
+{
+   struct gl_light_lut Luts[MAX_LIGHT_LUT_CACHE];
+   GLuint UseCount;
+   struct gl_light_lut_key Loaded[PICA_LIGHT_LUTS];
+   GLbitfield LoadedMask;  /**< Tables whose contents Loaded holds */
+};
+
+
 /**
  * Lighting attribute group (GL_LIGHT_BIT).
  */
@@ -1256,6 +1311,21 @@ struct gl_tex_env_combine_state
 };
 
 
+/**
+ * Texture combiner stages compiled from the texture environment, and the
+ * register values last written to the GPU.  A stage is the source,
+ * operand, combiner, color and scale registers.
+ */
+struct gl_tev_state
+{
+   u32 Stage[PICA_TEV_STAGES][5];
+   u32 Emitted[PICA_TEV_STAGES][5];
+   GLubyte Known;          /**< Stages whose GPU registers Emitted holds */
+   GLubyte Buffer;         /**< Combiner buffer update bits last written */
+   GLboolean BufferKnown;  /**< Combiner buffer set up on the GPU */
+};
+
+
 /**
  * TexGenEnabled flags.
  */
@@ -1464,6 +1534,40 @@ typedef enum {
 } gl_buffer_usage;
 
 
+/**
+ * Float copy of a vertex array stored in a buffer object with a type the
+ * PICA200 attribute loader can't fetch.  Kept in buffer pool storage and
+ * regenerated only when the source range is modified, into fresh storage
+ * if draws yet to execute read the old copy.
+ */
+struct gl_converted_array
+{
+   struct gl_converted_array *Next;
+   GLintptr Offset;     /**< Offset of the source array in the buffer */
+   GLsizei StrideB;     /**< Source stride in bytes */
+   GLint Size;          /**< Components per element */
+   GLenum Type;         /**< Source datatype */
+   GLboolean Normalized;
+   GLboolean Stale;     /**< Source range was written since conversion */
+   GLuint Count;        /**< Number of elements converted */
+   GLfloat *Data;       /**< Tightly packed floats, in linear memory */
+   GLuint LastUseFence; /**< Latest frame fence of the draws reading Data */
+};
+
+
+/**
+ * Buffer object storage replaced while the GPU could still read it.  It's
+ * only reused or released once the GPU is past \c Fence.
+ */
+struct gl_retired_storage
+{
+   struct gl_retired_storage *Next;
+   GLubyte *Data;
+   GLsizeiptr Size;
+   GLuint Fence;
+};
+
+
 /**
  * GL_ARB_vertex/pixel_buffer_object buffer object
  */
@@ -1484,6 +1588,19 @@ struct gl_buffer_object
    gl_buffer_usage UsageHistory; /**< How has this buffer been used so far? */
 
    struct gl_buffer_mapping Mappings[MAP_COUNT];
+
+   /** Converted copies of arrays sourced from this buffer */
+   struct gl_converted_array *Converted;
+
+   GLuint LastUseFence;   /**< Latest frame fence of the draws reading Data */
+   struct gl_retired_storage *Spare; /**< GL_STREAM_DRAW storage to cycle */
+
+   GLuint TransferSerial; /**< Of the last GX transfer queued on Data */
+   GLintptr InvalidBegin; /**< Start of the range GX transfers wrote to */
+   GLintptr InvalidEnd;   /**< End of it, stale in the CPU cache until synced */
+
+   /** Next in gl_shared_state::CoherentMappings */
+   struct gl_buffer_object *NextCoherent;
 };
 
 
@@ -1635,12 +1752,6 @@ struct gl_vertex_array_object
 
    /** The index buffer (also known as the element array buffer in OpenGL). */
    struct gl_buffer_object *IndexBufferObj;
-
-	uint64_t AttributeFormats;
-	uint64_t AttributePermutation;
-	uint16_t BufferStrides[3];
-	uint32_t BufferOffsets[3];
-	uint64_t BufferPermutations[3];
 };
 
 
@@ -1701,6 +1812,12 @@ struct gl_array_attrib
     */
    const struct gl_client_array **_DrawArrays; /**< 0..VERT_ATTRIB_MAX-1 */
 
+   /** Client arrays converted into the stream buffer at each draw */
+   GLbitfield64 _StreamArrays;
+
+   /** Arrays with a divisor, fed as fixed attributes once per instance */
+   GLbitfield64 _InstancedArrays;
+
    /** Legal array datatypes and the API for which they have been computed */
    GLbitfield LegalTypesMask;
 //   gl_api LegalTypesMaskAPI;
@@ -2607,12 +2724,51 @@ struct gl_program_resource
    uint8_t StageReferences; /** Bitmask of shader stage references. */
 };
 
-struct gl_shader_uniform
+/**
+ * Uniform values the application set for one program.
+ */
+struct gl_program_uniforms
+{
+	/** Float registers, components in w, z, y, x order */
+	GLfloat Float[MAX_FLOAT_UNIFORM_REGS][4];
+	GLuint FloatSet[(MAX_FLOAT_UNIFORM_REGS + 31) / 32];   /**< Registers set */
+	GLuint FloatDirty[(MAX_FLOAT_UNIFORM_REGS + 31) / 32]; /**< Set since upload */
+	u32 Int[4];          /**< i0..i3, x in the low byte */
+	GLubyte IntSet;      /**< Bitmask of the integer registers set */
+	GLushort Bool;       /**< b0..b15 */
+	GLushort BoolSet;    /**< Bitmask of the boolean registers set */
+	GLboolean IntBoolDirty;
+};
+
+/**
+ * A parsed shader binary, shared by the programs given identical binaries.
+ */
+struct gl_shader_binary
+{
+	struct gl_shader_binary *Next;  /**< Next binary with the same hash */
+	GLuint Hash;
+	GLsizei Size;
+	u32 *Data;       /**< Copy of the binary, the DVLB points into it */
+	DVLB_s *Dvlb;
+	GLint RefCount;
+};
+
+/**
+ * A program object, set up from PICA shader binaries.
+ */
+struct gl_pica_program
 {
-	u32 location;
-	float* value;
-	u8 count;
-	bool changed;
+	GLuint Name;
+	shaderProgram_s Program;
+	struct gl_shader_binary *VertexBinary;
+	struct gl_shader_binary *GeometryBinary;
+
+	/** Registers of the matrix uniforms, resolved when the binary is set */
+	GLint ProjectionUniform;
+	GLint ModelviewUniform;
+	GLint TextureUniform;
+
+	struct gl_program_uniforms Uniforms;
 };
 
 /**
@@ -2622,13 +2778,24 @@ struct gl_shader_uniform
 struct gl_shader_program
 {
 	GLboolean Uploaded;
-	shaderProgram_s* Program;
+	struct gl_pica_program *Program;
+	struct gl_pica_program *_Current;      /**< Program, or the fixed-function one */
+	struct gl_pica_program *BoundProgram;  /**< Program last set up on the GPU */
 	GLint ProjectionUniform;
 	GLint ModelviewUniform;
 	GLint TextureUniform;
 
-	struct gl_shader_uniform UniformVals[8];
-	uint8_t UniformCount;
+	struct _mesa_HashTable *Programs;  /**< Program objects by name */
+	struct _mesa_HashTable *Binaries;  /**< Shader binaries by content hash */
+	struct gl_ff_vertex_cache *FFVertex;  /**< Generated fixed-function programs */
+
+	/** Uniform values of _Current */
+	struct gl_program_uniforms *Uniforms;
+
+	/** Float uniform registers as last uploaded, w, z, y, x order */
+	GLfloat UniformRegs[MAX_FLOAT_UNIFORM_REGS][4];
+	/** Registers whose GPU contents UniformRegs holds */
+	GLuint UniformKnown[(MAX_FLOAT_UNIFORM_REGS + 31) / 32];
 
    GLenum Type;  /**< Always GL_SHADER_PROGRAM (internal token) */
    GLuint Name;  /**< aka handle or ID */
@@ -3024,6 +3191,30 @@ struct gl_shared_state
 
    struct _mesa_HashTable *BufferObjects;
 
+   /** Linear memory suballocator for buffer object storage */
+   struct gl_buffer_pool *BufferPool;
+
+   /** Fence handed to the last frame a context of the group started */
+   GLuint LastFence;
+
+   /**
+    * Lowest fence of the frames the contexts are recording.  Frames before
+    * it have been executed by the GPU.
+    */
+   GLuint PendingFence;
+
+   /** Contexts sharing the state, linked through gl_context::NextShared */
+   struct gl_context *Contexts;
+
+   /** Serial of the last GX buffer transfer queued */
+   GLuint TransferSerial;
+
+   /** Serial of the last GX buffer transfer known to be done */
+   GLuint TransferDone;
+
+   /** Buffers mapped for writing with GL_MAP_COHERENT_BIT */
+   struct gl_buffer_object *CoherentMappings;
+
    /** Table of both gl_shader and gl_shader_program objects */
 //   struct _mesa_HashTable *ShaderObjects;
 
@@ -3790,6 +3981,52 @@ struct gl_matrix_stack
    GLuint Depth;       /**< 0 <= Depth < MaxDepth */
    GLuint MaxDepth;    /**< size of Stack[] array */
    GLuint DirtyFlag;   /**< _NEW_MODELVIEW or _NEW_PROJECTION, for example */
+   GLfloat Device[16]; /**< Top as uploaded to the GPU, recomputed on DirtyFlag */
+};
+
+
+/**
+ * Rectangle of a screen buffer, in the coordinates the GPU is given:
+ * x across the buffer's width, y down its rows.  Empty if x0 >= x1 or
+ * y0 >= y1.
+ */
+struct gl_screen_rect
+{
+   GLint x0, y0, x1, y1;
+};
+
+
+/**
+ * A glReadPixels() into a pixel pack buffer.  The display transfer de-tiles
+ * the rows read into staging memory, and they are packed into the buffer
+ * once the transfer is done and the buffer is used.
+ */
+struct gl_readback_state
+{
+   struct gl_buffer_object *Buffer; /**< Referenced while pending, or NULL */
+   GLubyte *Staging;          /**< Rows of the color buffer, as RGBA8 */
+   GLuint StagingSize;
+   GLint StagingWidth;        /**< Pixels in a staged row, a window column */
+   GLint Row0;                /**< Window column of the first staged row */
+   GLint X, Y, Width, Height; /**< Window rectangle read */
+   GLenum Format, Type;
+   struct gl_pixelstore_attrib Packing; /**< Clipped, without BufferObj */
+   GLintptr Offset;           /**< Of the pixels in the buffer */
+};
+
+
+/**
+ * Frustum planes of the combined modelview-projection matrix, in object
+ * space, for culling on the CPU.
+ */
+struct gl_cull_state
+{
+   GLfloat Planes[6][4];      /**< Left, right, bottom, top, near, far */
+   GLboolean Valid;           /**< Planes are of _ModelProjectMatrix */
+   GLfloat Modelview[16];     /**< Top matrices the planes were made from, */
+   GLfloat Projection[16];    /**< to tell a pending change from a new one */
+   GLuint Transpose;          /**< Their MAT_NEED_TRANSPOSE flags */
+   GLboolean SkipDraw;        /**< Drop the next draw, its volume was culled */
 };
 
 
@@ -4136,11 +4373,39 @@ struct gl_context
 	gfxScreen_t Screen;
 	u32* FrameBuffer;
 	u32* DepthBuffer;
+	u16 BufferWidth;          /**< Of both buffers, the screen's height */
+	u16 BufferHeight;
+	u8 ColorFormat;           /**< COLORBUF_* format of FrameBuffer */
+	u8 DepthFormat;           /**< DEPTHBUF_* format of DepthBuffer */
+	u8 ScaleX;                /**< Of the buffers over the screen, 2 when supersampled */
+	u8 ScaleY;
+	GLbitfield BufferUndefined; /**< BUFFER_BIT_* invalidated since they were written */
+	GLbitfield BufferCleared; /**< BUFFER_BIT_* of the buffers holding only a clear value */
+	u32 ClearedColor;         /**< That value, as a pixel of the buffer */
+	u32 ClearedDepth;
+	u32* Presented[2];        /**< Screen framebuffers the color buffer was last transferred to */
+	struct gl_screen_rect Stale[2]; /**< Where they differ from the color buffer */
+	struct gl_screen_rect Damage; /**< Of the color buffer, since it was last presented */
+	GLboolean DamageGiven;    /**< Damage was added by gl3ds_addDamage() */
 	u32* CommandBuffer;
 	u32* CommandBufferRight;
 	u32 CommandBufferSize;
 	u32 CommandBufferOffset;
 	u32 CommandBufferOffset2;
+	u32 CommandBufferRun;     /**< Offset up to which the commands were run */
+	GLuint FrameFence;        /**< Of the frame the command buffer records */
+	struct gl_context *NextShared; /**< In gl_shared_state::Contexts */
+	GLboolean Drawn;          /**< Draws were added since the commands were last run */
+	u8* StreamBuffer;         /**< Per-frame linear scratch for client arrays */
+	u32 StreamBufferSize;
+	u32 StreamBufferOffset;
+	u32 TransferEvents;          /**< Mask of the GSP events the queued GX work signals */
+	u32 TransferStray;           /**< Mask of the GSP events queued buffer transfers signal */
+	struct gl_tev_state Tev;
+	struct gl_fraglight_state FragLight;
+	struct gl_fog_lut_state FogLut;
+	struct gl_cull_state Cull;
+	struct gl_readback_state ReadBack;
 
    /**
     * Device driver function pointer table
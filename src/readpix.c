@@ -978,22 +978,24 @@ void glReadnPixelsARB( GLint x, GLint y, GLsizei width, GLsizei height,
    if (ctx->NewState)
       _mesa_update_state(ctx);
 
-	// TODO: Support more than GL_BGR direct from framebuffer
-	u8* buf = gfxGetFramebuffer(ctx->Screen, GFX_LEFT, NULL, NULL);
-	memcpy(pixels, buf + (x*240 + y)*3, 3 * width * height);
-	return;
-
    if (ctx->ReadBuffer->_Status != GL_FRAMEBUFFER_COMPLETE) {
       _mesa_error(ctx, GL_INVALID_FRAMEBUFFER_OPERATION,
                   "glReadPixels(incomplete framebuffer)" );
       return;
    }
 
-   rb = _mesa_get_read_renderbuffer_for_format(ctx, format);
-   if (rb == NULL) {
-      _mesa_error(ctx, GL_INVALID_OPERATION,
-                  "glReadPixels(read buffer)");
-      return;
+   /* The window system framebuffer has no renderbuffers, the driver reads
+    * the screen buffers of the context itself.
+    */
+   if (_mesa_is_user_fbo(ctx->ReadBuffer)) {
+      rb = _mesa_get_read_renderbuffer_for_format(ctx, format);
+      if (rb == NULL) {
+         _mesa_error(ctx, GL_INVALID_OPERATION,
+                     "glReadPixels(read buffer)");
+         return;
+      }
+   } else {
+      rb = NULL;
    }
 
    /* OpenGL ES 1.x and OpenGL ES 2.0 impose additional restrictions on the
@@ -1016,7 +1018,7 @@ void glReadnPixelsARB( GLint x, GLint y, GLsizei width, GLsizei height,
                err = GL_INVALID_OPERATION;
             }
          }
-      } else {
+      } else if (rb) {
          err = read_pixels_es3_error_check(format, type, rb);
       }
 
@@ -1047,7 +1049,7 @@ void glReadnPixelsARB( GLint x, GLint y, GLsizei width, GLsizei height,
       return;
    }
 
-   if (!_mesa_source_buffer_exists(ctx, format)) {
+   if (rb && !_mesa_source_buffer_exists(ctx, format)) {
       _mesa_error(ctx, GL_INVALID_OPERATION, "glReadPixels(no readbuffer)");
       return;
    }
@@ -1055,7 +1057,7 @@ void glReadnPixelsARB( GLint x, GLint y, GLsizei width, GLsizei height,
    /* Check that the destination format and source buffer are both
     * integer-valued or both non-integer-valued.
     */
-   if (ctx->Extensions.EXT_texture_integer && _mesa_is_color_format(format)) {
+   if (rb && ctx->Extensions.EXT_texture_integer && _mesa_is_color_format(format)) {
       const struct gl_renderbuffer *rb = ctx->ReadBuffer->_ColorReadBuffer;
       const GLboolean srcInteger = _mesa_is_format_integer_color(rb->Format);
       const GLboolean dstInteger = _mesa_is_enum_format_integer(format);
@@ -24,8 +24,10 @@
 
 #include "glheader.h"
 #include "context.h"
+#include "macros.h"
 #include "mtypes.h"
 #include "scissor.h"
+#include "screenbuffer.h"
 
 
 /**
@@ -225,7 +227,11 @@ void _mesa_init_scissor(struct gl_context *ctx)
 void _gl3ds_update_scissor(struct gl_context *ctx) {
 	if (ctx->Scissor.EnableFlags) {
 		struct gl_scissor_rect *rect = &ctx->Scissor.ScissorArray[0];
-		GPU_SetScissorTest(GPU_SCISSOR_NORMAL, rect->X, rect->Y, rect->Width, rect->Height);
+		struct gl_screen_rect r;
+
+		// The buffers are sideways, and larger than the screen when supersampled
+		_gl3ds_window_rect(ctx, &r, rect->X, rect->Y, rect->Width, rect->Height);
+		GPU_SetScissorTest(GPU_SCISSOR_NORMAL, MAX2(r.x0, 0), MAX2(r.y0, 0), r.x1, r.y1);
 	} else {
 		GPU_SetScissorTest(GPU_SCISSOR_DISABLE, 0, 0, 0, 0);
 	}
@@ -0,0 +1,868 @@
+/*
+ * The color and depth buffers a context renders to, in VRAM.
+ *
+ * They are sized to the context's screen and take the formats its visual
+ * asks for.  Like the screens they are stored rotated, so their width is
+ * the height of the screen.
+ */
+
+#include "glheader.h"
+#include "context.h"
+#include "macros.h"
+#include "mtypes.h"
+#include "screenbuffer.h"
+#include "bufferobj.h"
+#include "enums.h"
+#include "fbobject.h"
+#include "glformats.h"
+#include "image.h"
+#include "pbo.h"
+
+/** Bytes per pixel of the color formats */
+static const u8 color_bytes[] = { 4, 3, 2, 2, 2 };
+
+/** Pixel size field of GPUREG_COLORBUFFER_FORMAT */
+static const u8 color_size[] = { 2, 1, 0, 0, 0 };
+
+/** GX transfer formats of the color formats, 5551 and 565 are swapped */
+static const u8 color_transfer[] = {
+	GX_TRANSFER_FMT_RGBA8, GX_TRANSFER_FMT_RGB8, GX_TRANSFER_FMT_RGB5A1,
+	GX_TRANSFER_FMT_RGB565, GX_TRANSFER_FMT_RGBA4
+};
+
+static GLuint choose_color_format(const struct gl_config *vis)
+{
+	if (vis->redBits > 5 || vis->greenBits > 6 || vis->blueBits > 5)
+		return vis->alphaBits ? COLORBUF_RGBA8 : COLORBUF_RGB8;
+	if (vis->alphaBits == 0)
+		return COLORBUF_RGB565;
+	if (vis->alphaBits == 1)
+		return COLORBUF_RGB5A1;
+	if (vis->redBits <= 4 && vis->greenBits <= 4 && vis->blueBits <= 4 && vis->alphaBits <= 4)
+		return COLORBUF_RGBA4;
+	return COLORBUF_RGBA8;
+}
+
+static GLuint choose_depth_format(const struct gl_config *vis)
+{
+	if (vis->stencilBits)
+		return DEPTHBUF_24_STENCIL8;
+	return vis->depthBits > 16 ? DEPTHBUF_24 : DEPTHBUF_16;
+}
+
+static GLuint depth_bytes(GLuint format)
+{
+	return format == DEPTHBUF_16 ? 2 : format == DEPTHBUF_24 ? 3 : 4;
+}
+
+/** GX_MemoryFill control for a pixel size in bytes */
+static u16 fill_width(GLuint bytes)
+{
+	return bytes == 4 ? GX_FILL_32BIT_DEPTH : bytes == 3 ? GX_FILL_24BIT_DEPTH : GX_FILL_16BIT_DEPTH;
+}
+
+/**
+ * Allocate the buffers for ctx->Screen in the formats of \p visual.  With
+ * samples, they are twice the size across (2) or both ways (4), for the
+ * display transfer to scale down.
+ */
+GLboolean _gl3ds_alloc_screen_buffers(struct gl_context *ctx, const struct gl_config *visual)
+{
+	ctx->ScaleX = visual->samples >= 2 ? 2 : 1;
+	ctx->ScaleY = visual->samples >= 4 ? 2 : 1;
+	ctx->BufferWidth = 240 * ctx->ScaleX;
+	ctx->BufferHeight = (ctx->Screen == GFX_TOP ? 400 : 320) * ctx->ScaleY;
+	ctx->ColorFormat = choose_color_format(visual);
+	ctx->DepthFormat = choose_depth_format(visual);
+
+	// Nothing writes the stencil before a clear or a draw with it enabled
+	ctx->BufferUndefined |= BUFFER_BIT_STENCIL;
+
+	ctx->FrameBuffer = vramMemAlign(ctx->BufferWidth * ctx->BufferHeight * color_bytes[ctx->ColorFormat], 0x100);
+	ctx->DepthBuffer = vramMemAlign(ctx->BufferWidth * ctx->BufferHeight * depth_bytes(ctx->DepthFormat), 0x100);
+	if (!ctx->FrameBuffer || !ctx->DepthBuffer) {
+		_gl3ds_free_screen_buffers(ctx);
+		return GL_FALSE;
+	}
+	return GL_TRUE;
+}
+
+void _gl3ds_free_screen_buffers(struct gl_context *ctx)
+{
+	if (ctx->FrameBuffer)
+		vramFree(ctx->FrameBuffer);
+	if (ctx->DepthBuffer)
+		vramFree(ctx->DepthBuffer);
+	ctx->FrameBuffer = ctx->DepthBuffer = NULL;
+}
+
+/**
+ * Set the buffer formats up, after GPU_SetViewport() set its own.
+ */
+void _gl3ds_emit_buffer_formats(struct gl_context *ctx)
+{
+	GPUCMD_AddWrite(GPUREG_DEPTHBUFFER_FORMAT, ctx->DepthFormat);
+	GPUCMD_AddWrite(GPUREG_COLORBUFFER_FORMAT, color_size[ctx->ColorFormat] | (u32) ctx->ColorFormat << 16);
+}
+
+/** The clear color as a pixel of the color buffer */
+static u32 clear_color_value(const struct gl_context *ctx)
+{
+	GLubyte r, g, b, a;
+
+	UNCLAMPED_FLOAT_TO_UBYTE(r, ctx->Color.ClearColor.f[0]);
+	UNCLAMPED_FLOAT_TO_UBYTE(g, ctx->Color.ClearColor.f[1]);
+	UNCLAMPED_FLOAT_TO_UBYTE(b, ctx->Color.ClearColor.f[2]);
+	UNCLAMPED_FLOAT_TO_UBYTE(a, ctx->Color.ClearColor.f[3]);
+
+	switch (ctx->ColorFormat) {
+	case COLORBUF_RGB8:
+		return r << 16 | g << 8 | b;
+	case COLORBUF_RGB5A1:
+		return (r >> 3) << 11 | (g >> 3) << 6 | (b >> 3) << 1 | a >> 7;
+	case COLORBUF_RGB565:
+		return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+	case COLORBUF_RGBA4:
+		return (r >> 4) << 12 | (g >> 4) << 8 | (b >> 4) << 4 | a >> 4;
+	default:
+		return (u32) r << 24 | g << 16 | b << 8 | a;
+	}
+}
+
+/** The depth clear value as a pixel of the depth buffer, stencil on top */
+static u32 clear_depth_value(const struct gl_context *ctx)
+{
+	// Device Z runs from 1 at the near plane to 0 at the far one
+	GLdouble z = 1.0 - CLAMP(ctx->Depth.Clear, 0.0, 1.0);
+	GLdouble max = ctx->DepthFormat == DEPTHBUF_16 ? 0xFFFF : 0xFFFFFF;
+
+	return (u32) (z * max + 0.5) | (u32) (ctx->Stencil.Clear & 0xFF) << 24;
+}
+
+/** Bits of the color channels, RGBA, in a pixel of each color format */
+static const u32 color_channels[][4] = {
+	{ 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF },
+	{ 0x00FF0000, 0x0000FF00, 0x000000FF, 0 },
+	{ 0xF800, 0x07C0, 0x003E, 0x0001 },
+	{ 0xF800, 0x07E0, 0x001F, 0 },
+	{ 0xF000, 0x0F00, 0x00F0, 0x000F }
+};
+
+/** One of the screen buffers, as glClear writes it */
+struct clear_target {
+	u8 *buf;
+	GLuint bytes;
+	GLbitfield bits;          /**< BUFFER_BIT_* kept in the buffer, but stencil */
+	struct gl_screen_rect rect;
+	u32 value;
+	u32 mask;                 /**< Bits of the pixels written */
+	u32 all;                  /**< Bits of a pixel */
+	u32 stencil;              /**< Bits of the stencil in a pixel */
+	u32 undefined;            /**< Bits invalidated since they were written */
+	u32 known;                /**< Bits holding the last clear value everywhere */
+	u32 keep;                 /**< Bits written with the value they hold */
+	GLboolean fill;
+};
+
+/** The bits of a pixel of \p t that the \p buffers (BUFFER_BIT_*) keep */
+static u32 target_pixel(const struct clear_target *t, GLbitfield buffers)
+{
+	return (buffers & t->bits ? t->all & ~t->stencil : 0) |
+		   (buffers & BUFFER_BIT_STENCIL ? t->stencil : 0);
+}
+
+/** The buffers (BUFFER_BIT_*) keeping any of the bits \p pixel of \p t */
+static GLbitfield target_buffers(const struct clear_target *t, u32 pixel)
+{
+	return (pixel & t->all & ~t->stencil ? t->bits : 0) |
+		   (pixel & t->stencil ? BUFFER_BIT_STENCIL : 0);
+}
+
+static void setup_color_target(const struct gl_context *ctx, struct clear_target *t, GLbitfield buffers)
+{
+	int i;
+
+	t->buf = (u8 *) ctx->FrameBuffer;
+	t->bytes = color_bytes[ctx->ColorFormat];
+	t->bits = BUFFER_BITS_COLOR;
+	t->value = clear_color_value(ctx);
+	t->mask = t->all = t->stencil = 0;
+	for (i = 0; i < 4; i++) {
+		if ((buffers & BUFFER_BITS_COLOR) && ctx->Color.ColorMask[0][i])
+			t->mask |= color_channels[ctx->ColorFormat][i];
+		t->all |= color_channels[ctx->ColorFormat][i];
+	}
+	t->undefined = target_pixel(t, ctx->BufferUndefined);
+	t->known = target_pixel(t, ctx->BufferCleared);
+}
+
+/** The depth buffer keeps the stencil, if any, in the top byte */
+static void setup_depth_target(const struct gl_context *ctx, struct clear_target *t, GLbitfield buffers)
+{
+	t->buf = (u8 *) ctx->DepthBuffer;
+	t->bytes = depth_bytes(ctx->DepthFormat);
+	t->bits = BUFFER_BIT_DEPTH;
+	t->value = clear_depth_value(ctx);
+	t->all = ctx->DepthFormat == DEPTHBUF_16 ? 0xFFFF :
+			 ctx->DepthFormat == DEPTHBUF_24 ? 0xFFFFFF : 0xFFFFFFFF;
+	t->stencil = t->all & 0xFF000000;
+	t->mask = 0;
+	if (buffers & BUFFER_BIT_DEPTH)
+		t->mask |= t->all & 0xFFFFFF;
+	if (buffers & BUFFER_BIT_STENCIL)
+		t->mask |= t->stencil & (ctx->Stencil.WriteMask[0] & 0xFF) << 24;
+	t->undefined = target_pixel(t, ctx->BufferUndefined);
+	t->known = target_pixel(t, ctx->BufferCleared);
+}
+
+static void set_whole_rect(const struct gl_context *ctx, struct gl_screen_rect *r)
+{
+	r->x0 = r->y0 = 0;
+	r->x1 = ctx->BufferWidth;
+	r->y1 = ctx->BufferHeight;
+}
+
+static GLboolean whole_rect(const struct gl_context *ctx, const struct gl_screen_rect *r)
+{
+	return r->x0 == 0 && r->y0 == 0 && r->x1 == ctx->BufferWidth && r->y1 == ctx->BufferHeight;
+}
+
+static GLboolean empty_rect(const struct gl_screen_rect *r)
+{
+	return r->x0 >= r->x1 || r->y0 >= r->y1;
+}
+
+/** Grow \p a to the bounds of it and \p b */
+static void union_rect(struct gl_screen_rect *a, const struct gl_screen_rect *b)
+{
+	if (empty_rect(b))
+		return;
+	if (empty_rect(a)) {
+		*a = *b;
+		return;
+	}
+	a->x0 = MIN2(a->x0, b->x0);
+	a->y0 = MIN2(a->y0, b->y0);
+	a->x1 = MAX2(a->x1, b->x1);
+	a->y1 = MAX2(a->y1, b->y1);
+}
+
+/**
+ * The rectangle of the buffers under the window rectangle at \p x, \p y of
+ * \p width by \p height, as glViewport() and glScissor() take it.  The
+ * buffers are sideways: a column of the window is a row of the buffer, and
+ * a row of the window, bottom to top, is a column of the buffer.
+ */
+void _gl3ds_window_rect(const struct gl_context *ctx, struct gl_screen_rect *r,
+						GLint x, GLint y, GLint width, GLint height)
+{
+	r->x0 = y * ctx->ScaleX;
+	r->y0 = x * ctx->ScaleY;
+	r->x1 = (y + height) * ctx->ScaleX;
+	r->y1 = (x + width) * ctx->ScaleY;
+}
+
+/** Clip \p r to the window rectangle at \p x, \p y of \p width by \p height */
+static void clip_rect(const struct gl_context *ctx, struct gl_screen_rect *r,
+					  GLint x, GLint y, GLint width, GLint height)
+{
+	struct gl_screen_rect w;
+
+	_gl3ds_window_rect(ctx, &w, x, y, width, height);
+	r->x0 = MAX2(r->x0, w.x0);
+	r->y0 = MAX2(r->y0, w.y0);
+	r->x1 = MIN2(r->x1, w.x1);
+	r->y1 = MIN2(r->y1, w.y1);
+}
+
+/**
+ * Settle what a clear of \p t writes and whether a GX fill can write it:
+ * the fill units write rows of whole tiles and whole pixels.  The bits left
+ * out by the masks are written too where that changes nothing, so that a
+ * depth clear of D24S8 is a fill unless the stencil holds something drawn.
+ */
+static void prepare_clear(const struct gl_context *ctx, struct clear_target *t,
+						  const struct gl_screen_rect *r, u32 cleared)
+{
+	t->rect = *r;
+	t->keep = 0;
+
+	// A buffer holding nothing but the clear value is left alone
+	if (!(t->mask & ~t->known) && !((cleared ^ t->value) & t->mask))
+		t->mask = 0;
+
+	if (t->mask) {
+		// Invalidated bits may be written outside the masks and scissor box
+		if (t->undefined) {
+			t->mask |= t->undefined;
+			if (t->undefined == t->all)
+				set_whole_rect(ctx, &t->rect);
+		}
+
+		// Bits holding one value everywhere get it again
+		t->keep = t->known & t->all & ~t->mask;
+		t->value = (t->value & ~t->keep) | (cleared & t->keep);
+		t->mask |= t->keep;
+	}
+
+	t->fill = t->mask && t->mask == t->all && t->rect.x0 == 0 && t->rect.x1 == ctx->BufferWidth &&
+			  !(t->rect.y0 & 7) && !(t->rect.y1 & 7);
+}
+
+/** Note what the clear of \p t left in the buffer */
+static void finish_clear(struct gl_context *ctx, const struct clear_target *t, u32 *cleared)
+{
+	GLbitfield written = target_buffers(t, t->mask & ~t->keep);
+	u32 bits;
+
+	if (!written)
+		return;
+
+	_gl3ds_screen_buffers_written(ctx, written, &t->rect);
+	if (whole_rect(ctx, &t->rect)) {
+		// The buffers written in full hold the value now
+		written &= ~target_buffers(t, t->all & ~t->mask);
+		bits = target_pixel(t, written);
+		ctx->BufferCleared |= written;
+		*cleared = (*cleared & ~bits) | (t->value & bits);
+	}
+}
+
+/** The part of the buffers inside the scissor box, false if none */
+static GLboolean scissor_rect(const struct gl_context *ctx, struct gl_screen_rect *r)
+{
+	set_whole_rect(ctx, r);
+	if (ctx->Scissor.EnableFlags & 1) {
+		const struct gl_scissor_rect *s = &ctx->Scissor.ScissorArray[0];
+		clip_rect(ctx, r, s->X, s->Y, s->Width, s->Height);
+	}
+	return !empty_rect(r);
+}
+
+/** Byte offset of a pixel in a buffer made of 8x8 tiles, Morton ordered inside */
+static u32 tiled_offset(GLuint width, GLuint x, GLuint y, GLuint bytes)
+{
+	u32 tile = (y >> 3) * (width >> 3) + (x >> 3);
+	u32 i = (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2 | (x & 4) << 2 | (y & 4) << 3;
+
+	return (tile * 64 + i) * bytes;
+}
+
+/** Write the masked bits of the clear value to the pixels of \p t, with the CPU */
+static void write_rect(struct gl_context *ctx, const struct clear_target *t)
+{
+	GLint x, y;
+
+	for (y = t->rect.y0; y < t->rect.y1; y++) {
+		for (x = t->rect.x0; x < t->rect.x1; x++) {
+			u8 *p = t->buf + tiled_offset(ctx->BufferWidth, x, y, t->bytes);
+			u32 pixel = 0;
+
+			memcpy(&pixel, p, t->bytes);
+			pixel = (pixel & ~t->mask) | (t->value & t->mask);
+			memcpy(p, &pixel, t->bytes);
+		}
+	}
+	GSPGPU_FlushDataCache(t->buf, ctx->BufferWidth * ctx->BufferHeight * t->bytes);
+}
+
+/**
+ * Clear the \p buffers (BUFFER_BIT_*) inside the scissor box, through the
+ * color and stencil write masks.
+ *
+ * Buffers holding only the clear value already are skipped.  The stencil of
+ * a D24S8 depth clear is filled along with the depth when it holds one known
+ * value or nothing that was written.  A GX fill is
+ * queued after the draws before it and signals its event in the transfer
+ * record; the draws after it run behind it.  Clears the fill units can't
+ * do wait for the GPU and write the pixels with the CPU.
+ */
+void _gl3ds_clear_screen_buffers(struct gl_context *ctx, GLbitfield buffers)
+{
+	struct clear_target color, depth;
+	struct gl_screen_rect r;
+
+	if (!scissor_rect(ctx, &r))
+		return;
+
+	setup_color_target(ctx, &color, buffers);
+	setup_depth_target(ctx, &depth, buffers);
+	prepare_clear(ctx, &color, &r, ctx->ClearedColor);
+	prepare_clear(ctx, &depth, &r, ctx->ClearedDepth);
+	if (!color.mask && !depth.mask)
+		return;
+
+	// Each event is waited for before it is queued again
+	_gl3ds_finish_transfer(ctx);
+
+	if ((color.mask && !color.fill) || (depth.mask && !depth.fill)) {
+		// The CPU writes after the GPU is done with the buffers
+		if (ctx->Drawn) {
+			_gl3ds_run_commands(ctx);
+			gspWaitForP3D();
+		}
+		if (color.mask && !color.fill)
+			write_rect(ctx, &color);
+		if (depth.mask && !depth.fill)
+			write_rect(ctx, &depth);
+	} else if (ctx->Drawn) {
+		_gl3ds_run_commands(ctx);
+		ctx->TransferEvents |= 1 << GSPGPU_EVENT_P3D;
+	}
+
+	if (color.fill || depth.fill) {
+		u32 cstart = color.rect.y0 * ctx->BufferWidth * color.bytes;
+		u32 cend = color.rect.y1 * ctx->BufferWidth * color.bytes;
+		u32 dstart = depth.rect.y0 * ctx->BufferWidth * depth.bytes;
+		u32 dend = depth.rect.y1 * ctx->BufferWidth * depth.bytes;
+
+		GX_MemoryFill((u32 *) (color.buf + cstart), color.value, (u32 *) (color.buf + cend),
+					  color.fill ? GX_FILL_TRIGGER | fill_width(color.bytes) : 0,
+					  (u32 *) (depth.buf + dstart), depth.value, (u32 *) (depth.buf + dend),
+					  depth.fill ? GX_FILL_TRIGGER | fill_width(depth.bytes) : 0);
+		// Each fill unit signals its own event
+		if (color.fill)
+			ctx->TransferEvents |= 1 << GSPGPU_EVENT_PSC0;
+		if (depth.fill)
+			ctx->TransferEvents |= 1 << GSPGPU_EVENT_PSC1;
+	}
+
+	finish_clear(ctx, &color, &ctx->ClearedColor);
+	finish_clear(ctx, &depth, &ctx->ClearedDepth);
+}
+
+/**
+ * Note that \p buffers (BUFFER_BIT_*) were written to inside \p r: they
+ * are defined again, may hold more than a clear value, and the color
+ * buffer has to be presented there.  The depth and stencil are told apart,
+ * though they share a buffer.
+ */
+void _gl3ds_screen_buffers_written(struct gl_context *ctx, GLbitfield buffers,
+								   const struct gl_screen_rect *r)
+{
+	ctx->BufferUndefined &= ~buffers;
+	ctx->BufferCleared &= ~buffers;
+	if (buffers & BUFFER_BITS_COLOR)
+		union_rect(&ctx->Damage, r);
+}
+
+/**
+ * Note a draw: it writes inside the viewport and the scissor box, mapped to
+ * the buffers as the clear and the GPU registers map them.  Damage added
+ * with gl3ds_addDamage() stands for that of the draws.
+ */
+void _gl3ds_screen_buffers_drawn(struct gl_context *ctx)
+{
+	const struct gl_viewport_attrib *vp = &ctx->ViewportArray[0];
+	struct gl_screen_rect r;
+
+	if (ctx->DamageGiven) {
+		// Empty, only the other state changes
+		set_whole_rect(ctx, &r);
+		r.x1 = r.x0;
+	} else {
+		scissor_rect(ctx, &r);
+		clip_rect(ctx, &r, (GLint) vp->X, (GLint) vp->Y, (GLint) vp->Width, (GLint) vp->Height);
+	}
+	// Only draws with the stencil test on write the stencil
+	_gl3ds_screen_buffers_written(ctx, BUFFER_BITS_COLOR | BUFFER_BIT_DEPTH |
+								  (ctx->Stencil._WriteEnabled ? BUFFER_BIT_STENCIL : 0), &r);
+}
+
+/** gl3ds_addDamage(), with the rectangle given as to glScissor() */
+void _gl3ds_add_damage(struct gl_context *ctx, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	struct gl_screen_rect r;
+
+	set_whole_rect(ctx, &r);
+	clip_rect(ctx, &r, x, y, width, height);
+	union_rect(&ctx->Damage, &r);
+	ctx->DamageGiven = GL_TRUE;
+}
+
+/**
+ * glInvalidateFramebuffer() and glDiscardFramebufferEXT() of the window
+ * system framebuffer: the contents of the attachments become undefined.
+ */
+void _gl3ds_discard_screen_buffers(struct gl_context *ctx, struct gl_framebuffer *fb,
+								   GLsizei numAttachments, const GLenum *attachments)
+{
+	GLsizei i;
+
+	if (_mesa_is_user_fbo(fb))
+		return;
+
+	for (i = 0; i < numAttachments; i++) {
+		switch (attachments[i]) {
+		case GL_COLOR:
+			ctx->BufferUndefined |= BUFFER_BITS_COLOR;
+			break;
+		case GL_DEPTH:
+			ctx->BufferUndefined |= BUFFER_BIT_DEPTH;
+			break;
+		case GL_STENCIL:
+			ctx->BufferUndefined |= BUFFER_BIT_STENCIL;
+			break;
+		}
+	}
+}
+
+/** Flags of a display transfer from the color buffer to linear \p format */
+static u32 display_transfer_flags(const struct gl_context *ctx, u32 format)
+{
+	return GX_TRANSFER_FLIP_VERT(0) | GX_TRANSFER_OUT_TILED(0) | GX_TRANSFER_RAW_COPY(0) |
+		   GX_TRANSFER_IN_FORMAT(color_transfer[ctx->ColorFormat]) |
+		   GX_TRANSFER_OUT_FORMAT(format) |
+		   GX_TRANSFER_SCALING(ctx->ScaleY > 1 ? GX_TRANSFER_SCALE_XY :
+							   ctx->ScaleX > 1 ? GX_TRANSFER_SCALE_X : GX_TRANSFER_SCALE_NO);
+}
+
+/**
+ * Transfer the color buffer to the screen's framebuffer, where that differs
+ * from it, unless it was invalidated.  The screens are double buffered, so
+ * what either framebuffer is missing is kept track of.  Display transfers
+ * take whole rows of tiles, all rows with damage in them are transferred.
+ * Supersampled buffers are scaled down, averaging the samples of a pixel.
+ */
+void _gl3ds_present_screen_buffer(struct gl_context *ctx)
+{
+	u32 *fb = (u32 *) gfxGetFramebuffer(ctx->Screen, GFX_LEFT, NULL, NULL);
+	struct gl_screen_rect *stale;
+	u32 cbytes = color_bytes[ctx->ColorFormat];
+	GLint y0, y1, rows = 8 * ctx->ScaleY;
+	int i;
+
+	for (i = 0; i < 2; i++)
+		union_rect(&ctx->Stale[i], &ctx->Damage);
+	ctx->Damage.x1 = ctx->Damage.x0;
+	ctx->DamageGiven = GL_FALSE;
+
+	if (ctx->BufferUndefined & BUFFER_BITS_COLOR)
+		return;
+
+	if (fb == ctx->Presented[0]) {
+		stale = &ctx->Stale[0];
+	} else if (fb == ctx->Presented[1]) {
+		stale = &ctx->Stale[1];
+	} else {
+		// Not seen yet, or not lately: it gets all of it
+		ctx->Presented[1] = ctx->Presented[0];
+		ctx->Stale[1] = ctx->Stale[0];
+		ctx->Presented[0] = fb;
+		stale = &ctx->Stale[0];
+		set_whole_rect(ctx, stale);
+	}
+
+	if (empty_rect(stale))
+		return;
+
+	// Whole rows of tiles on the screen too
+	y0 = stale->y0 / rows * rows;
+	y1 = (stale->y1 + rows - 1) / rows * rows;
+	GX_DisplayTransfer((u32 *) ((u8 *) ctx->FrameBuffer + y0 * ctx->BufferWidth * cbytes),
+					   GX_BUFFER_DIM(ctx->BufferWidth, y1 - y0),
+					   (u32 *) ((u8 *) fb + y0 / ctx->ScaleY * (ctx->BufferWidth / ctx->ScaleX) * 3),
+					   GX_BUFFER_DIM(ctx->BufferWidth / ctx->ScaleX, (y1 - y0) / ctx->ScaleY),
+					   display_transfer_flags(ctx, GX_TRANSFER_FMT_RGB8));
+	gspWaitForPPF();
+
+	stale->x1 = stale->x0;
+}
+
+
+/** Reads of more pixels go through the display transfer */
+#define READ_PIXELS_CPU_MAX 4096
+
+/** Longest row glReadPixels() reads, the top screen's width */
+#define READ_PIXELS_ROW_MAX 400
+
+/** Unpack a pixel of a color buffer in \p format to RGBA */
+static void unpack_color(GLuint format, const u8 *p, GLubyte c[4])
+{
+	u32 v = p[0] | p[1] << 8;
+
+	switch (format) {
+	case COLORBUF_RGBA8:
+		c[0] = p[3]; c[1] = p[2]; c[2] = p[1]; c[3] = p[0];
+		break;
+	case COLORBUF_RGB8:
+		c[0] = p[2]; c[1] = p[1]; c[2] = p[0]; c[3] = 0xFF;
+		break;
+	case COLORBUF_RGB5A1:
+		c[0] = (v >> 11 & 0x1F) << 3 | (v >> 13 & 0x7);
+		c[1] = (v >> 6 & 0x1F) << 3 | (v >> 8 & 0x7);
+		c[2] = (v >> 1 & 0x1F) << 3 | (v >> 3 & 0x7);
+		c[3] = v & 1 ? 0xFF : 0;
+		break;
+	case COLORBUF_RGB565:
+		c[0] = (v >> 11 & 0x1F) << 3 | (v >> 13 & 0x7);
+		c[1] = (v >> 5 & 0x3F) << 2 | (v >> 9 & 0x3);
+		c[2] = (v & 0x1F) << 3 | (v >> 2 & 0x7);
+		c[3] = 0xFF;
+		break;
+	default:
+		c[0] = (v >> 12 & 0xF) * 17;
+		c[1] = (v >> 8 & 0xF) * 17;
+		c[2] = (v >> 4 & 0xF) * 17;
+		c[3] = (v & 0xF) * 17;
+		break;
+	}
+}
+
+static GLboolean pack_supported(GLenum format, GLenum type)
+{
+	switch (type) {
+	case GL_UNSIGNED_BYTE:
+		return format == GL_RGBA || format == GL_RGB || format == GL_BGRA || format == GL_ALPHA;
+	case GL_UNSIGNED_SHORT_5_6_5:
+		return format == GL_RGB;
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		return format == GL_RGBA;
+	default:
+		return GL_FALSE;
+	}
+}
+
+/** Store a row of RGBA pixels as \p format and \p type */
+static void pack_row(GLenum format, GLenum type, GLsizei n, GLubyte (*rgba)[4], GLubyte *dst)
+{
+	GLsizei i;
+	GLushort v;
+
+	if (format == GL_RGBA && type == GL_UNSIGNED_BYTE) {
+		memcpy(dst, rgba, n * 4);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		const GLubyte *c = rgba[i];
+
+		switch (type) {
+		case GL_UNSIGNED_SHORT_5_6_5:
+			v = (c[0] >> 3) << 11 | (c[1] >> 2) << 5 | c[2] >> 3;
+			memcpy(dst + i * 2, &v, 2);
+			break;
+		case GL_UNSIGNED_SHORT_4_4_4_4:
+			v = (c[0] >> 4) << 12 | (c[1] >> 4) << 8 | (c[2] >> 4) << 4 | c[3] >> 4;
+			memcpy(dst + i * 2, &v, 2);
+			break;
+		case GL_UNSIGNED_SHORT_5_5_5_1:
+			v = (c[0] >> 3) << 11 | (c[1] >> 3) << 6 | (c[2] >> 3) << 1 | c[3] >> 7;
+			memcpy(dst + i * 2, &v, 2);
+			break;
+		default:
+			if (format == GL_RGB) {
+				memcpy(dst + i * 3, c, 3);
+			} else if (format == GL_BGRA) {
+				dst[i * 4 + 0] = c[2];
+				dst[i * 4 + 1] = c[1];
+				dst[i * 4 + 2] = c[0];
+				dst[i * 4 + 3] = c[3];
+			} else {
+				dst[i] = c[3];
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * Queue the display transfer of the rows of the color buffer \p rb reads
+ * into staging memory, de-tiled, converted to RGBA8 and scaled down.  The
+ * transfer takes whole rows of tiles.
+ */
+static GLboolean stage_rows(struct gl_context *ctx, struct gl_readback_state *rb)
+{
+	GLint row1 = (rb->X + rb->Width + 7) & ~7;
+	GLuint cbytes = color_bytes[ctx->ColorFormat];
+
+	rb->Row0 = rb->X & ~7;
+	rb->StagingWidth = ctx->BufferWidth / ctx->ScaleX;
+	rb->StagingSize = (row1 - rb->Row0) * rb->StagingWidth * 4;
+	rb->Staging = linearMemAlign(rb->StagingSize, 0x80);
+	if (!rb->Staging)
+		return GL_FALSE;
+
+	GX_DisplayTransfer((u32 *) ((u8 *) ctx->FrameBuffer + rb->Row0 * ctx->ScaleY * ctx->BufferWidth * cbytes),
+					   GX_BUFFER_DIM(ctx->BufferWidth, (row1 - rb->Row0) * ctx->ScaleY),
+					   (u32 *) rb->Staging, GX_BUFFER_DIM(rb->StagingWidth, row1 - rb->Row0),
+					   display_transfer_flags(ctx, GX_TRANSFER_FMT_RGBA8));
+	return GL_TRUE;
+}
+
+/** Pack the pixels \p rb reads to \p pixels, from staging memory if any */
+static void pack_pixels(struct gl_context *ctx, const struct gl_readback_state *rb, GLvoid *pixels)
+{
+	GLuint cbytes = color_bytes[ctx->ColorFormat];
+	GLubyte rgba[READ_PIXELS_ROW_MAX][4];
+	GLint i, j;
+
+	for (j = 0; j < rb->Height; j++) {
+		GLint y = rb->Y + j;
+		GLubyte *dst = _mesa_image_address2d(&rb->Packing, pixels, rb->Width, rb->Height,
+											 rb->Format, rb->Type, j, 0);
+
+		for (i = 0; i < rb->Width; i++) {
+			GLint x = rb->X + i;
+
+			if (rb->Staging)
+				unpack_color(COLORBUF_RGBA8, rb->Staging + ((x - rb->Row0) * rb->StagingWidth + y) * 4, rgba[i]);
+			else
+				unpack_color(ctx->ColorFormat, (u8 *) ctx->FrameBuffer +
+							 tiled_offset(ctx->BufferWidth, y, x, cbytes), rgba[i]);
+		}
+		pack_row(rb->Format, rb->Type, rb->Width, rgba, dst);
+	}
+}
+
+/**
+ * Start the readback \p rb into the pixel pack buffer at \p offset and
+ * return without waiting for it.
+ */
+static void queue_readback(struct gl_context *ctx, struct gl_readback_state *rb,
+						   struct gl_buffer_object *bufObj, const GLvoid *offset)
+{
+	// One readback and each event are pending at a time
+	_gl3ds_finish_readback(ctx);
+	_gl3ds_finish_transfer(ctx);
+
+	if (ctx->Drawn) {
+		_gl3ds_run_commands(ctx);
+		ctx->TransferEvents |= 1 << GSPGPU_EVENT_P3D;
+	}
+	if (!stage_rows(ctx, rb)) {
+		_mesa_error(ctx, GL_OUT_OF_MEMORY, "glReadPixels");
+		return;
+	}
+	ctx->TransferEvents |= 1 << GSPGPU_EVENT_PPF;
+
+	rb->Offset = (GLintptr) offset;
+	rb->Packing.BufferObj = NULL;
+	ctx->ReadBack = *rb;
+	ctx->ReadBack.Buffer = NULL;
+	_mesa_reference_buffer_object(ctx, &ctx->ReadBack.Buffer, bufObj);
+}
+
+/**
+ * Pack the pixels of the pending readback into its buffer, after waiting
+ * for the transfer if it isn't done yet.
+ *
+ * The GPU can't write them there itself: the display transfer de-tiles the
+ * sideways color buffer, so its rows are the columns of the window.  The
+ * CPU repacks them in GL row order, into storage that is renamed first if
+ * draws queued since may still read the old one, as glBufferSubData()
+ * does.
+ */
+void _gl3ds_finish_readback(struct gl_context *ctx)
+{
+	struct gl_readback_state *rb = &ctx->ReadBack;
+	struct gl_buffer_object *bufObj = rb->Buffer;
+
+	if (!bufObj)
+		return;
+
+	// Deleting the buffer below comes back here
+	rb->Buffer = NULL;
+	_gl3ds_finish_transfer(ctx);
+
+	// Nobody else holds a buffer deleted meanwhile
+	if (bufObj->RefCount > 1 && bufObj->Data) {
+		const GLubyte *image = (const GLubyte *) rb->Offset;
+		const GLubyte *first = _mesa_image_address2d(&rb->Packing, image, rb->Width, rb->Height,
+													 rb->Format, rb->Type, 0, 0);
+		const GLubyte *last = _mesa_image_address2d(&rb->Packing, image, rb->Width, rb->Height,
+													rb->Format, rb->Type, rb->Height - 1, 0);
+		GLintptr begin = (GLintptr) MIN2(first, last);
+		GLintptr end = (GLintptr) MAX2(first, last) + rb->Width * _mesa_bytes_per_pixel(rb->Format, rb->Type);
+
+		_gl3ds_bufferobj_prepare_write(ctx, bufObj, begin, end - begin);
+		GSPGPU_InvalidateDataCache(rb->Staging, rb->StagingSize);
+		pack_pixels(ctx, rb, bufObj->Data + rb->Offset);
+		GSPGPU_FlushDataCache(bufObj->Data + begin, end - begin);
+		_gl3ds_invalidate_converted_arrays(ctx, bufObj, begin, end - begin);
+	}
+
+	linearFree(rb->Staging);
+	rb->Staging = NULL;
+	_mesa_reference_buffer_object(ctx, &bufObj, NULL);
+}
+
+/**
+ * ctx->Driver.ReadPixels(), from the color buffer.
+ *
+ * Like the screens, the buffer is stored sideways: a column of the window
+ * is a row of the buffer, bottom to top.  Small reads are de-tiled by the
+ * CPU.  Larger and supersampled ones have the display transfer de-tile,
+ * convert to RGBA8 and scale down whole rows of tiles into linear memory
+ * first.  Reads into a pixel pack buffer don't wait for that, the pixels
+ * are packed when the buffer is next used.
+ *
+ * Only the unsigned byte RGBA, RGB, BGRA and ALPHA, and the packed 16-bit
+ * RGB(A) formats are read.
+ */
+void _gl3ds_read_pixels(struct gl_context *ctx, GLint x, GLint y, GLsizei width, GLsizei height,
+						GLenum format, GLenum type, const struct gl_pixelstore_attrib *packing,
+						GLvoid *pixels)
+{
+	struct gl_readback_state rb;
+	GLint screen_width = ctx->BufferHeight / ctx->ScaleY;
+	GLint screen_height = ctx->BufferWidth / ctx->ScaleX;
+
+	if (!pack_supported(format, type)) {
+		_mesa_error(ctx, GL_INVALID_OPERATION, "glReadPixels(format %s and type %s)",
+					_mesa_lookup_enum_by_nr(format), _mesa_lookup_enum_by_nr(type));
+		return;
+	}
+
+	// Clip to the window, skipping what is left out in the destination
+	memset(&rb, 0, sizeof(rb));
+	rb.Packing = *packing;
+	if (rb.Packing.RowLength == 0)
+		rb.Packing.RowLength = width;
+	if (x < 0) {
+		rb.Packing.SkipPixels -= x;
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		rb.Packing.SkipRows -= y;
+		height += y;
+		y = 0;
+	}
+	rb.X = x;
+	rb.Y = y;
+	rb.Width = MIN2(width, screen_width - x);
+	rb.Height = MIN2(height, screen_height - y);
+	rb.Format = format;
+	rb.Type = type;
+	if (rb.Width <= 0 || rb.Height <= 0)
+		return;
+	assert(rb.Width <= READ_PIXELS_ROW_MAX);
+
+	if (_mesa_is_bufferobj(packing->BufferObj)) {
+		queue_readback(ctx, &rb, packing->BufferObj, pixels);
+		return;
+	}
+
+	// Everything queued before writes the buffer first
+	_gl3ds_finish_transfer(ctx);
+	if (ctx->Drawn) {
+		_gl3ds_run_commands(ctx);
+		gspWaitForP3D();
+	}
+
+	if (ctx->ScaleX > 1 || ctx->ScaleY > 1 || rb.Width * rb.Height > READ_PIXELS_CPU_MAX) {
+		if (!stage_rows(ctx, &rb)) {
+			_mesa_error(ctx, GL_OUT_OF_MEMORY, "glReadPixels");
+			return;
+		}
+		gspWaitForPPF();
+		GSPGPU_InvalidateDataCache(rb.Staging, rb.StagingSize);
+	}
+
+	pack_pixels(ctx, &rb, pixels);
+
+	if (rb.Staging)
+		linearFree(rb.Staging);
+}
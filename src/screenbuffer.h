@@ -0,0 +1,45 @@
+#ifndef GL3DS_SCREENBUFFER
+#define GL3DS_SCREENBUFFER
+
+#include "glheader.h"
+
+struct gl_context;
+struct gl_config;
+struct gl_framebuffer;
+struct gl_screen_rect;
+struct gl_pixelstore_attrib;
+
+/** GPUREG_COLORBUFFER_FORMAT formats */
+enum {
+	COLORBUF_RGBA8,
+	COLORBUF_RGB8,
+	COLORBUF_RGB5A1,
+	COLORBUF_RGB565,
+	COLORBUF_RGBA4
+};
+
+/** GPUREG_DEPTHBUFFER_FORMAT formats */
+enum {
+	DEPTHBUF_16 = 0,
+	DEPTHBUF_24 = 2,
+	DEPTHBUF_24_STENCIL8 = 3
+};
+
+GLboolean _gl3ds_alloc_screen_buffers(struct gl_context *ctx, const struct gl_config *visual);
+void _gl3ds_free_screen_buffers(struct gl_context *ctx);
+void _gl3ds_emit_buffer_formats(struct gl_context *ctx);
+void _gl3ds_window_rect(const struct gl_context *ctx, struct gl_screen_rect *r,
+						GLint x, GLint y, GLint width, GLint height);
+void _gl3ds_clear_screen_buffers(struct gl_context *ctx, GLbitfield buffers);
+void _gl3ds_screen_buffers_written(struct gl_context *ctx, GLbitfield buffers,
+								   const struct gl_screen_rect *r);
+void _gl3ds_screen_buffers_drawn(struct gl_context *ctx);
+void _gl3ds_add_damage(struct gl_context *ctx, GLint x, GLint y, GLsizei width, GLsizei height);
+void _gl3ds_discard_screen_buffers(struct gl_context *ctx, struct gl_framebuffer *fb,
+								   GLsizei numAttachments, const GLenum *attachments);
+void _gl3ds_present_screen_buffer(struct gl_context *ctx);
+void _gl3ds_read_pixels(struct gl_context *ctx, GLint x, GLint y, GLsizei width, GLsizei height,
+						GLenum format, GLenum type, const struct gl_pixelstore_attrib *packing,
+						GLvoid *pixels);
+
+#endif
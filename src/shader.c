@@ -1,5 +1,11 @@
 #include "glheader.h"
 #include "context.h"
+#include "ffvertex.h"
+#include "float24.h"
+#include "hash.h"
+#include "shader.h"
+#include "util/bitset.h"
+#include "util/hash_table.h"
 
 
 GLuint glCreateShader(GLenum shaderType)
@@ -13,44 +19,172 @@ void glAttachShader(GLuint program, GLuint shader)
 }
 
 
-GLuint glCreateProgram(void)
+static struct gl_pica_program *lookup_program(struct gl_context *ctx, GLuint program, const char *func)
 {
-	// TODO: store in shared context hash, return hash value
-	shaderProgram_s* prog = (shaderProgram_s*) malloc(sizeof(shaderProgram_s));
-	shaderProgramInit(prog);
-	return (GLuint) prog;
+	struct gl_pica_program *prog = _mesa_HashLookup(ctx->Shared->Shader->Programs, program);
+
+	if (!prog)
+		_mesa_error(ctx, GL_INVALID_VALUE, "%s(program=%u)", func, program);
+	return prog;
 }
 
+/** Hash table key of a content hash, 0 and 1 are reserved */
+static GLuint binary_key(GLuint hash)
+{
+	return hash < 2 ? hash + 2 : hash;
+}
 
-void glDeleteProgram(GLuint program)
+/**
+ * Find the parsed copy of a shader binary, parsing it if no program was
+ * given the same binary before.
+ */
+static struct gl_shader_binary *get_binary(struct gl_shader_program *shader, const void *data, GLsizei size)
 {
-	shaderProgram_s* prog = (shaderProgram_s*) program;
+	GLuint hash = _mesa_hash_data(data, size);
+	struct gl_shader_binary *head = _mesa_HashLookup(shader->Binaries, binary_key(hash));
+	struct gl_shader_binary *bin;
+
+	for (bin = head; bin; bin = bin->Next) {
+		if (bin->Hash == hash && bin->Size == size && !memcmp(bin->Data, data, size)) {
+			bin->RefCount++;
+			return bin;
+		}
+	}
+
+	bin = CALLOC_STRUCT(gl_shader_binary);
+	if (!bin)
+		return NULL;
+
+	bin->Data = malloc(size);
+	if (!bin->Data) {
+		free(bin);
+		return NULL;
+	}
+	memcpy(bin->Data, data, size);
 
-	if (prog == NULL)
+	bin->Dvlb = DVLB_ParseFile(bin->Data, size);
+	if (!bin->Dvlb || !bin->Dvlb->numDVLE) {
+		if (bin->Dvlb)
+			DVLB_Free(bin->Dvlb);
+		free(bin->Data);
+		free(bin);
+		return NULL;
+	}
+
+	bin->Hash = hash;
+	bin->Size = size;
+	bin->RefCount = 1;
+	bin->Next = head;
+	_mesa_HashInsert(shader->Binaries, binary_key(hash), bin);
+	return bin;
+}
+
+static void release_binary(struct gl_shader_program *shader, struct gl_shader_binary *bin)
+{
+	GLuint key;
+	struct gl_shader_binary *head, **prev;
+
+	if (!bin || --bin->RefCount > 0)
 		return;
 
-	GET_CURRENT_CONTEXT(ctx);
-	if (ctx->Shared->Shader->Program == prog)
-		ctx->Shared->Shader->Program = NULL;
+	key = binary_key(bin->Hash);
+	head = _mesa_HashLookup(shader->Binaries, key);
+	if (head == bin) {
+		if (bin->Next)
+			_mesa_HashInsert(shader->Binaries, key, bin->Next);
+		else
+			_mesa_HashRemove(shader->Binaries, key);
+	} else {
+		for (prev = &head->Next; *prev != bin; prev = &(*prev)->Next)
+			;
+		*prev = bin->Next;
+	}
+
+	DVLB_Free(bin->Dvlb);
+	free(bin->Data);
+	free(bin);
+}
 
+static void free_program(struct gl_shader_program *shader, struct gl_pica_program *prog)
+{
+	shaderProgramFree(&prog->Program);
+	release_binary(shader, prog->VertexBinary);
+	release_binary(shader, prog->GeometryBinary);
 	free(prog);
 }
 
-void glUseProgram(GLuint program) {
-	// TODO: unset program when 0?
+
+GLuint glCreateProgram(void)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+	struct gl_pica_program *prog;
+	GLuint name;
+
+	name = _mesa_HashFindFreeKeyBlock(shader->Programs, 1);
+	prog = CALLOC_STRUCT(gl_pica_program);
+	if (!name || !prog) {
+		free(prog);
+		_mesa_error(ctx, GL_OUT_OF_MEMORY, "glCreateProgram");
+		return 0;
+	}
+
+	prog->Name = name;
+	prog->ProjectionUniform = -1;
+	prog->ModelviewUniform = -1;
+	prog->TextureUniform = -1;
+	shaderProgramInit(&prog->Program);
+	_mesa_HashInsert(shader->Programs, name, prog);
+	return name;
+}
+
+
+void glDeleteProgram(GLuint program)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+	struct gl_pica_program *prog;
+
 	if (program == 0)
 		return;
 
+	prog = lookup_program(ctx, program, "glDeleteProgram");
+	if (!prog)
+		return;
+
+	if (shader->Program == prog) {
+		FLUSH_VERTICES(ctx, _NEW_PROGRAM);
+		shader->Program = NULL;
+	}
+	if (shader->_Current == prog) {
+		shader->_Current = NULL;
+		shader->Uniforms = NULL;
+	}
+	if (shader->BoundProgram == prog)
+		shader->BoundProgram = NULL;
+
+	_mesa_HashRemove(shader->Programs, program);
+	free_program(shader, prog);
+}
+
+void glUseProgram(GLuint program) {
 	GET_CURRENT_CONTEXT(ctx);
 
-	shaderProgram_s* prog = (shaderProgram_s*) program;
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+	struct gl_pica_program *prog = NULL;
 
-	if (ctx->Shared->Shader->Program == prog)
+	// Program 0 draws with the fixed-function state
+	if (program != 0) {
+		prog = lookup_program(ctx, program, "glUseProgram");
+		if (!prog)
+			return;
+	}
+	if (shader->Program == prog)
 		return;
 
-	ctx->Shared->Shader->Program = prog;
-
 	FLUSH_VERTICES(ctx, _NEW_PROGRAM);
+
+	shader->Program = prog;
 }
 
 
@@ -59,65 +193,220 @@ void glProgramBinary(GLuint program, GLenum binaryFormat, const void *binary, GL
 	GET_CURRENT_CONTEXT(ctx);
 
 	// set GL_PROGRAM_BINARY_FORMATS enum
-	shaderProgram_s* prog = (shaderProgram_s*) program;
-	DVLB_s* dvlb;
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+	struct gl_pica_program *prog;
+	struct gl_shader_binary *bin;
+
+	prog = lookup_program(ctx, program, "glProgramBinary");
+	if (!prog)
+		return;
+
+	if (!(binaryFormat & (GL_VERTEX_SHADER_BINARY | GL_GEOMETRY_SHADER_BINARY))) {
+		_mesa_error(ctx, GL_INVALID_ENUM, "glProgramBinary(binaryFormat=0x%x)", binaryFormat);
+		return;
+	}
+
+	bin = get_binary(shader, binary, length);
+	if (!bin) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "glProgramBinary(invalid binary)");
+		return;
+	}
 
 	if (binaryFormat & GL_VERTEX_SHADER_BINARY)
 	{
-		dvlb = DVLB_ParseFile((u32*)binary, length);
-		shaderProgramSetVsh(prog, &dvlb->DVLE[0]);
+		shaderProgramSetVsh(&prog->Program, &bin->Dvlb->DVLE[0]);
+		release_binary(shader, prog->VertexBinary);
+		prog->VertexBinary = bin;
+
+		// TODO: something better than forcing usage of these uniforms?
+		prog->ProjectionUniform = shaderInstanceGetUniformLocation(prog->Program.vertexShader, "projection");
+		prog->ModelviewUniform = shaderInstanceGetUniformLocation(prog->Program.vertexShader, "modelview");
+		prog->TextureUniform = shaderInstanceGetUniformLocation(prog->Program.vertexShader, "texture");
 	}
-	else if (binaryFormat & GL_GEOMETRY_SHADER_BINARY)
+	else
 	{
-		dvlb = DVLB_ParseFile((u32*)binary, length);
-		shaderProgramSetGsh(prog, &dvlb->DVLE[0], 1); // TODO: figure out geometry stride
+		shaderProgramSetGsh(&prog->Program, &bin->Dvlb->DVLE[0], 1); // TODO: figure out geometry stride
+		release_binary(shader, prog->GeometryBinary);
+		prog->GeometryBinary = bin;
+	}
+
+	// The program has to be set up again
+	if (shader->BoundProgram == prog) {
+		FLUSH_VERTICES(ctx, _NEW_PROGRAM);
+		shader->BoundProgram = NULL;
 	}
 }
 
 void _mesa_init_program(struct gl_context *ctx)
 {
 	ctx->Shared->Shader = CALLOC_STRUCT(gl_shader_program);
+	ctx->Shared->Shader->Programs = _mesa_NewHashTable();
+	ctx->Shared->Shader->Binaries = _mesa_NewHashTable();
+	_gl3ds_init_ff_vertex(ctx);
+}
+
+static void delete_program_cb(GLuint id, void *data, void *userData)
+{
+	free_program(userData, data);
 }
 
 void _mesa_free_program_data(struct gl_context *ctx)
 {
-	if (ctx->Shared->Shader->Program)
-		shaderProgramFree(ctx->Shared->Shader->Program);
+	struct gl_shader_program *shader = ctx->Shared->Shader;
 
-	int i;
-	for (i = 0; i < ctx->Shared->Shader->UniformCount; i++) {
-		free(ctx->Shared->Shader->UniformVals[i].value);
+	// Releases all the binaries as well
+	_mesa_HashDeleteAll(shader->Programs, delete_program_cb, shader);
+	_mesa_DeleteHashTable(shader->Programs);
+	_mesa_DeleteHashTable(shader->Binaries);
+	_gl3ds_free_ff_vertex(ctx);
+	free(shader);
+}
+
+static void upload_program(struct gl_context *ctx)
+{
+
+}
+
+/** Registers a single GPUCMD_Add can carry, 256 words of 3 per register */
+#define MAX_UNIFORM_BURST 85
+
+/**
+ * Upload the uniforms of the current program set since the last upload,
+ * skipping float registers the GPU holds the value of already.  Each run
+ * of consecutive float registers goes in a single command.
+ */
+static void upload_uniforms(struct gl_shader_program *shader)
+{
+	struct gl_program_uniforms *uniforms = shader->Uniforms;
+	u32 packed[MAX_UNIFORM_BURST * 3];
+	int reg, end;
+
+	for (reg = 0; reg < MAX_FLOAT_UNIFORM_REGS; reg++) {
+		if (!BITSET_TEST(uniforms->FloatDirty, reg))
+			continue;
+		if (BITSET_TEST(shader->UniformKnown, reg) &&
+			!memcmp(shader->UniformRegs[reg], uniforms->Float[reg], sizeof(uniforms->Float[reg]))) {
+			BITSET_CLEAR(uniforms->FloatDirty, reg);
+			continue;
+		}
+		memcpy(shader->UniformRegs[reg], uniforms->Float[reg], sizeof(uniforms->Float[reg]));
+		BITSET_SET(shader->UniformKnown, reg);
 	}
 
-	free(ctx->Shared->Shader);
+	reg = 0;
+	while (reg < MAX_FLOAT_UNIFORM_REGS) {
+		BITSET_WORD bits = uniforms->FloatDirty[BITSET_BITWORD(reg)] >> (reg % BITSET_WORDBITS);
+		if (!bits) {
+			reg = (reg | (BITSET_WORDBITS - 1)) + 1;
+			continue;
+		}
+		reg += ffs(bits) - 1;
+
+		for (end = reg + 1; end < MAX_FLOAT_UNIFORM_REGS && end - reg < MAX_UNIFORM_BURST; end++) {
+			if (!BITSET_TEST(uniforms->FloatDirty, end))
+				break;
+		}
+
+		// A clear bit 31 in the config selects float24 data
+		_gl3ds_pack_float24(packed, &shader->UniformRegs[reg], end - reg);
+		GPUCMD_AddWrite(GPUREG_VSH_FLOATUNIFORM_CONFIG, reg);
+		GPUCMD_AddWrites(GPUREG_VSH_FLOATUNIFORM_DATA, packed, (end - reg) * 3);
+		reg = end;
+	}
+
+	BITSET_ZERO(uniforms->FloatDirty);
+
+	if (uniforms->IntBoolDirty) {
+		// Booleans the application didn't set keep the shader's defaults
+		u16 bools = (shader->_Current->Program.vertexShader->boolUniforms & ~uniforms->BoolSet) |
+					(uniforms->Bool & uniforms->BoolSet);
+		GPUCMD_AddWrite(GPUREG_VSH_BOOLUNIFORM, 0x7FFF0000 | bools);
+
+		for (reg = 0; reg < 4; reg++) {
+			if (uniforms->IntSet & (1 << reg))
+				GPUCMD_AddWrite(GPUREG_VSH_INTUNIFORM_I0 + reg, uniforms->Int[reg]);
+		}
+		uniforms->IntBoolDirty = GL_FALSE;
+	}
 }
 
-static void upload_program(struct gl_context *ctx)
+/**
+ * Pick the program to draw with, the application's or without one, the
+ * fixed-function program for the current state.  Returns whether it changed.
+ */
+GLboolean _gl3ds_select_program(struct gl_context *ctx, GLbitfield new_state)
+{
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+	struct gl_pica_program *prog = shader->Program;
+
+	if (!prog) {
+		if (shader->_Current && !(new_state & _FF_VERTEX_PROGRAM_STATE))
+			return GL_FALSE;
+		prog = _gl3ds_ff_vertex_program(ctx);
+	}
+
+	if (prog == shader->_Current)
+		return GL_FALSE;
+
+	shader->_Current = prog;
+	shader->Uniforms = prog ? &prog->Uniforms : NULL;
+	return GL_TRUE;
+}
+
+/**
+ * Set the current program up on the GPU if it isn't already.  Its float
+ * constants overwrite registers, and its uniforms have to be checked
+ * against what the previous program left in the others.
+ */
+void _gl3ds_bind_program(struct gl_context *ctx)
 {
+	struct gl_shader_program *shader = ctx->Shared->Shader;
+	shaderInstance_s *vsh;
+	int i;
+
+	if (!shader->_Current || shader->_Current == shader->BoundProgram)
+		return;
 
+	vsh = shader->_Current->Program.vertexShader;
+	if (!vsh)
+		return;
+
+	shaderProgramUse(&shader->_Current->Program);
+	shader->BoundProgram = shader->_Current;
+
+	for (i = 0; i < vsh->numFloat24Uniforms; i++) {
+		if (vsh->float24Uniforms[i].id < MAX_FLOAT_UNIFORM_REGS)
+			BITSET_CLEAR(shader->UniformKnown, vsh->float24Uniforms[i].id);
+	}
+
+	for (i = 0; i < BITSET_WORDS(MAX_FLOAT_UNIFORM_REGS); i++)
+		shader->Uniforms->FloatDirty[i] |= shader->Uniforms->FloatSet[i];
+	shader->Uniforms->IntBoolDirty = GL_TRUE;
+
+	shader->ProjectionUniform = shader->_Current->ProjectionUniform;
+	shader->ModelviewUniform = shader->_Current->ModelviewUniform;
+	shader->TextureUniform = shader->_Current->TextureUniform;
 }
 
-#define GET_VSH_UNIFORM(name) (GLint) shaderInstanceGetUniformLocation(ctx->Shared->Shader->Program->vertexShader, name)
+/**
+ * Forget the program and uniforms set up on the GPU, after it was reset
+ * or used by another context.
+ */
+void _gl3ds_reset_program(struct gl_context *ctx)
+{
+	ctx->Shared->Shader->BoundProgram = NULL;
+	BITSET_ZERO(ctx->Shared->Shader->UniformKnown);
+}
 
 void _gl3ds_update_program(struct gl_context *ctx)
 {
-	if (ctx->Shared->Shader->Program)
+	if (ctx->Shared->Shader->_Current && ctx->Shared->Shader->_Current->Program.vertexShader)
 	{
-		shaderProgramUse(ctx->Shared->Shader->Program);
+		_gl3ds_bind_program(ctx);
+		upload_uniforms(ctx->Shared->Shader);
+		// Matrices set during this update are uploaded already
+		ctx->NewState &= ~_NEW_PROGRAM_CONSTANTS;
 
-		// TODO: something better than forcing usage of these uniforms?
-		ctx->Shared->Shader->ProjectionUniform = GET_VSH_UNIFORM("projection");
-		ctx->Shared->Shader->ModelviewUniform = GET_VSH_UNIFORM("modelview");
-		ctx->Shared->Shader->TextureUniform = GET_VSH_UNIFORM("texture");
-
-		int i;
-		for (i = 0; i < ctx->Shared->Shader->UniformCount; i++) {
-			struct gl_shader_uniform* uniform = &ctx->Shared->Shader->UniformVals[i];
-			if (uniform->changed) {
-				GPU_SetFloatUniform(GPU_VERTEX_SHADER, uniform->location, (u32*) uniform->value, uniform->count);
-				uniform->changed = false;
-			}
-		}
 		if (!ctx->Shared->Shader->Uploaded) {
 			ctx->Shared->Shader->Uploaded = GL_TRUE;
 		}
@@ -1,10 +1,19 @@
 #ifndef GL3DS_SHADER
 #define GL3DS_SHADER
 
+#include "glheader.h"
+
 struct gl_context;
 
+struct gl_program_uniforms;
+
+GLboolean _gl3ds_select_program(struct gl_context *ctx, GLbitfield new_state);
+void _gl3ds_bind_program(struct gl_context *ctx);
+void _gl3ds_reset_program(struct gl_context *ctx);
 void _gl3ds_update_program(struct gl_context *ctx);
 void _mesa_init_program(struct gl_context *ctx);
 void _mesa_free_program_data(struct gl_context *ctx);
+void _gl3ds_set_uniforms(struct gl_context *ctx, struct gl_program_uniforms *uniforms,
+						 GLint location, GLsizei count, const GLfloat *value);
 
 #endif
@@ -32,6 +32,7 @@
 #include "hash.h"
 //#include "atifragshader.h"
 #include "bufferobj.h"
+#include "bufferalloc.h"
 #include "shared.h"
 //#include "program/program.h"
 //#include "dlist.h"
@@ -81,6 +82,7 @@ _mesa_alloc_shared_state(struct gl_context *ctx)
 //   shared->ShaderObjects = _mesa_NewHashTable();
 
    shared->BufferObjects = _mesa_NewHashTable();
+   shared->BufferPool = _gl3ds_new_buffer_pool(&shared->Mutex);
 
    /* GL_ARB_sampler_objects */
    shared->SamplerObjects = _mesa_NewHashTable();
@@ -329,6 +331,7 @@ free_shared_state(struct gl_context *ctx, struct gl_shared_state *shared)
    _mesa_DeleteHashTable(shared->RenderBuffers);
 
    _mesa_reference_buffer_object(ctx, &shared->NullBufferObj, NULL);
+   _gl3ds_delete_buffer_pool(shared->BufferPool);
 
 //   {
 //      struct set_entry *entry;
@@ -401,3 +404,82 @@ _mesa_reference_shared_state(struct gl_context *ctx,
       mtx_unlock(&state->Mutex);
    }
 }
+
+
+/**
+ * Recompute the lowest fence of the frames the contexts sharing the state
+ * are recording.  With none left, every frame has executed.
+ */
+static void
+update_pending_fence(struct gl_shared_state *shared)
+{
+   struct gl_context *ctx;
+
+   shared->PendingFence = shared->LastFence + 1;
+   for (ctx = shared->Contexts; ctx; ctx = ctx->NextShared) {
+      if ((GLint) (ctx->FrameFence - shared->PendingFence) < 0)
+         shared->PendingFence = ctx->FrameFence;
+   }
+}
+
+
+/**
+ * Add a context to those sharing its state, recording a frame of its own.
+ */
+void
+_gl3ds_shared_attach_context(struct gl_context *ctx)
+{
+   struct gl_shared_state *shared = ctx->Shared;
+
+   mtx_lock(&shared->Mutex);
+   ctx->FrameFence = ++shared->LastFence;
+   ctx->NextShared = shared->Contexts;
+   shared->Contexts = ctx;
+   update_pending_fence(shared);
+   mtx_unlock(&shared->Mutex);
+}
+
+
+/**
+ * Remove a context from those sharing its state, before it lets go of it.
+ */
+void
+_gl3ds_shared_detach_context(struct gl_context *ctx)
+{
+   struct gl_shared_state *shared = ctx->Shared;
+   struct gl_context **prev;
+
+   mtx_lock(&shared->Mutex);
+   for (prev = &shared->Contexts; *prev; prev = &(*prev)->NextShared) {
+      if (*prev == ctx) {
+         *prev = ctx->NextShared;
+         break;
+      }
+   }
+   ctx->NextShared = NULL;
+   update_pending_fence(shared);
+   mtx_unlock(&shared->Mutex);
+}
+
+
+/**
+ * Start the next frame of a context, once the GPU has executed its
+ * commands.  The storage retired before the frames every context is
+ * recording is released.
+ */
+void
+_gl3ds_shared_next_frame(struct gl_context *ctx)
+{
+   struct gl_shared_state *shared = ctx->Shared;
+
+   GLuint pending;
+
+   mtx_lock(&shared->Mutex);
+   ctx->FrameFence = ++shared->LastFence;
+   update_pending_fence(shared);
+   pending = shared->PendingFence;
+   mtx_unlock(&shared->Mutex);
+
+   /* Takes the lock itself */
+   _gl3ds_buffer_collect(shared->BufferPool, pending);
+}
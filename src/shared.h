@@ -37,4 +37,14 @@ struct gl_shared_state *
 _mesa_alloc_shared_state(struct gl_context *ctx);
 
 
+void
+_gl3ds_shared_attach_context(struct gl_context *ctx);
+
+void
+_gl3ds_shared_detach_context(struct gl_context *ctx);
+
+void
+_gl3ds_shared_next_frame(struct gl_context *ctx);
+
+
 #endif
@@ -39,7 +39,7 @@
 #include "macros.h"
 //#include "ffvertex_prog.h"
 #include "framebuffer.h"
-//#include "light.h"
+#include "light.h"
 #include "matrix.h"
 #include "pixel.h"
 //#include "program/program.h"
@@ -168,8 +168,8 @@ _mesa_update_state_locked( struct gl_context *ctx )
    if (new_state & (_NEW_SCISSOR | _NEW_BUFFERS | _NEW_VIEWPORT))
       _mesa_update_draw_buffer_bounds(ctx, ctx->DrawBuffer);
 
-//   if (new_state & _NEW_LIGHT)
-//      _mesa_update_lighting( ctx );
+   if (new_state & _NEW_LIGHT)
+      _mesa_update_lighting( ctx );
 
 //   if (new_state & (_NEW_LIGHT | _NEW_PROGRAM))
 //      update_twoside( ctx );
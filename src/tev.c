@@ -0,0 +1,228 @@
+/*
+ * Texture environments on the PICA200 texture combiner (TEV) stages.
+ *
+ * Each texture unit with an image gets a stage of its own, in unit order,
+ * and the remaining stages pass the previous result through.  Only stages
+ * whose registers changed since they were written are sent to the GPU.
+ *
+ * With fragment lighting the first stages make the lit color and keep it
+ * in the combiner buffer, where later stages find it as the primary color.
+ */
+
+#include "glheader.h"
+#include "context.h"
+#include "mtypes.h"
+#include "fraglight.h"
+#include "tev.h"
+#include "teximage.h"
+#include "texstate.h"
+
+/** First register of each stage, the last two come after the fog ones */
+static const u32 stage_regs[PICA_TEV_STAGES] = {
+	GPUREG_TEXENV0_SOURCE, GPUREG_TEXENV1_SOURCE, GPUREG_TEXENV2_SOURCE,
+	GPUREG_TEXENV3_SOURCE, GPUREG_TEXENV4_SOURCE, GPUREG_TEXENV5_SOURCE
+};
+
+/** Stage passing the previous result, or the primary color for stage 0 */
+static const struct gl_tex_env_combine_state passthrough = {
+	GL_REPLACE, GL_REPLACE,
+	{ GL_PREVIOUS, GL_PREVIOUS, GL_PREVIOUS },
+	{ GL_PREVIOUS, GL_PREVIOUS, GL_PREVIOUS },
+	{ GL_SRC_COLOR, GL_SRC_COLOR, GL_SRC_COLOR },
+	{ GL_SRC_ALPHA, GL_SRC_ALPHA, GL_SRC_ALPHA },
+	0, 0, 1, 1
+};
+
+/** The source enums are the GPU ones, but for the previous and lit colors */
+static u32 tev_source(GLenum source, GLuint stage, GLboolean lit)
+{
+	if (source == GL_PRIMARY_COLOR && lit)
+		return GPU_PREVIOUS_BUFFER;
+	// The first stage has only the fragment's color before it
+	if (source == GL_PREVIOUS && stage == 0)
+		return GPU_PRIMARY_COLOR;
+	return source;
+}
+
+static u32 tev_operand_rgb(GLenum operand)
+{
+	switch (operand) {
+	case GL_ONE_MINUS_SRC_COLOR:
+		return GPU_TEVOP_RGB_ONE_MINUS_SRC_COLOR;
+	case GL_SRC_ALPHA:
+		return GPU_TEVOP_RGB_SRC_ALPHA;
+	case GL_ONE_MINUS_SRC_ALPHA:
+		return GPU_TEVOP_RGB_ONE_MINUS_SRC_ALPHA;
+	default:
+		return GPU_TEVOP_RGB_SRC_COLOR;
+	}
+}
+
+static u32 tev_operand_alpha(GLenum operand)
+{
+	return operand == GL_ONE_MINUS_SRC_ALPHA ? GPU_TEVOP_A_ONE_MINUS_SRC_ALPHA : GPU_TEVOP_A_SRC_ALPHA;
+}
+
+static void compile_stage(u32 regs[5], const struct gl_tex_env_combine_state *combine,
+						  GLuint stage, GLboolean lit, const GLfloat color[4])
+{
+	u32 rgb = 0, alpha = 0;
+	GLubyte c[4];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		rgb |= tev_source(combine->SourceRGB[i], stage, lit) << (i * 4);
+		alpha |= tev_source(combine->SourceA[i], stage, lit) << (i * 4);
+	}
+	regs[0] = rgb | alpha << 16;
+
+	rgb = alpha = 0;
+	for (i = 0; i < 3; i++) {
+		rgb |= tev_operand_rgb(combine->OperandRGB[i]) << (i * 4);
+		alpha |= tev_operand_alpha(combine->OperandA[i]) << (i * 4);
+	}
+	regs[1] = rgb | alpha << 12;
+
+	// The combine mode enums are the GPU ones too
+	regs[2] = combine->ModeRGB | combine->ModeA << 16;
+
+	for (i = 0; i < 4; i++)
+		UNCLAMPED_FLOAT_TO_UBYTE(c[i], color[i]);
+	regs[3] = c[0] | c[1] << 8 | c[2] << 16 | (u32) c[3] << 24;
+
+	// Scales of 1, 2 and 4 are the same shifts GL uses
+	regs[4] = combine->ScaleShiftRGB | combine->ScaleShiftA << 16;
+}
+
+/**
+ * The stages adding the lit colors up, into \p stages.  With color
+ * material the first one multiplies what the unit made by the vertex
+ * color, and the second adds the terms of the material colors the vertex
+ * color doesn't track, or with only the ambient tracked, multiplies those
+ * it does.  Alpha is that of the diffuse material or vertex color.
+ *
+ * \return the number of stages
+ */
+static GLuint compile_lighting_stages(u32 (*stages)[5], struct gl_context *ctx)
+{
+	GLbitfield cm = ctx->Light.ColorMaterialEnabled ? ctx->Light._ColorMaterialBitmask : 0;
+	GLfloat color[3];
+	GLubyte c[3], alpha;
+	u32 *regs = stages[0];
+	int i;
+
+	if (cm & MAT_BIT_FRONT_DIFFUSE) {
+		regs[0] = GPU_FRAGMENT_PRIMARY_COLOR | GPU_PRIMARY_COLOR << 4 | GPU_FRAGMENT_SECONDARY_COLOR << 8;
+		regs[2] = GPU_MULTIPLY_ADD;
+	} else {
+		regs[0] = GPU_FRAGMENT_PRIMARY_COLOR | GPU_FRAGMENT_SECONDARY_COLOR << 4;
+		regs[2] = GPU_ADD;
+	}
+	regs[0] |= (cm & MAT_BIT_FRONT_DIFFUSE ? GPU_PRIMARY_COLOR : GPU_CONSTANT) << 16;
+	regs[2] |= GPU_REPLACE << 16;
+	regs[1] = 0;
+
+	UNCLAMPED_FLOAT_TO_UBYTE(alpha, ctx->Light.Material.Attrib[MAT_ATTRIB_FRONT_DIFFUSE][3]);
+	regs[3] = (u32) alpha << 24;
+	regs[4] = 0;
+
+	if (!(cm & (MAT_BIT_FRONT_AMBIENT | MAT_BIT_FRONT_DIFFUSE)))
+		return 1;
+
+	regs = stages[1];
+	if (cm & MAT_BIT_FRONT_DIFFUSE) {
+		regs[0] = GPU_PREVIOUS | GPU_CONSTANT << 4;
+		regs[2] = GPU_ADD;
+	} else {
+		regs[0] = GPU_CONSTANT | GPU_PRIMARY_COLOR << 4 | GPU_PREVIOUS << 8;
+		regs[2] = GPU_MULTIPLY_ADD;
+	}
+	regs[0] |= GPU_PREVIOUS << 16;
+	regs[2] |= GPU_REPLACE << 16;
+	regs[1] = 0;
+
+	_gl3ds_lighting_color(ctx, color);
+	for (i = 0; i < 3; i++)
+		UNCLAMPED_FLOAT_TO_UBYTE(c[i], color[i]);
+	regs[3] = c[0] | c[1] << 8 | c[2] << 16;
+	regs[4] = 0;
+	return 2;
+}
+
+/**
+ * Compile the texture environment of the units with an image into stages,
+ * and write the stages that changed.
+ */
+void _gl3ds_update_tev(struct gl_context *ctx)
+{
+	static const GLfloat zero[4] = { 0.0F, 0.0F, 0.0F, 0.0F };
+	struct gl_tev_state *tev = &ctx->Tev;
+	GLboolean lit = _gl3ds_fragment_lighting(ctx);
+	GLuint stage = 0, unit;
+	GLubyte buffer = 0;
+
+	if (lit) {
+		stage = compile_lighting_stages(tev->Stage, ctx);
+		// RGB and alpha of the last of them go to the buffer
+		buffer = 0x11 << (stage - 1);
+	}
+
+	for (unit = 0; unit < PICA_TEXTURE_UNITS; unit++) {
+		struct gl_texture_unit *texUnit = &ctx->Texture.Unit[unit];
+		struct gl_texture_image *image;
+		struct gl_tex_env_combine_state derived;
+		GLuint i;
+		const struct gl_tex_env_combine_state *combine = &texUnit->Combine;
+
+		image = _mesa_select_tex_image(texUnit->CurrentTex[TEXTURE_2D_INDEX], GL_TEXTURE_2D, 0);
+		if (!image)
+			continue;
+
+		if (texUnit->EnvMode != GL_COMBINE) {
+			_mesa_calculate_derived_texenv(&derived, texUnit->EnvMode, image->_BaseFormat);
+			// GL_TEXTURE aliases GL_TEXTURE1 here, name the unit itself
+			for (i = 0; i < 3; i++) {
+				if (derived.SourceRGB[i] == GL_TEXTURE)
+					derived.SourceRGB[i] = GL_TEXTURE0 + unit;
+				if (derived.SourceA[i] == GL_TEXTURE)
+					derived.SourceA[i] = GL_TEXTURE0 + unit;
+			}
+			combine = &derived;
+		}
+		compile_stage(tev->Stage[stage], combine, stage, lit, texUnit->EnvColor);
+		stage++;
+	}
+
+	for (; stage < PICA_TEV_STAGES; stage++)
+		compile_stage(tev->Stage[stage], &passthrough, stage, lit, zero);
+
+	for (stage = 0; stage < PICA_TEV_STAGES; stage++) {
+		if ((tev->Known & (1 << stage)) &&
+			!memcmp(tev->Emitted[stage], tev->Stage[stage], sizeof(tev->Stage[stage])))
+			continue;
+
+		GPUCMD_AddIncrementalWrites(stage_regs[stage], tev->Stage[stage], 5);
+		memcpy(tev->Emitted[stage], tev->Stage[stage], sizeof(tev->Stage[stage]));
+		tev->Known |= 1 << stage;
+	}
+
+	if (!tev->BufferKnown || tev->Buffer != buffer) {
+		// Only the buffer update bits, leave the fog ones alone
+		GPUCMD_AddMaskedWrite(GPUREG_TEXENV_UPDATE_BUFFER, 0x2, (u32) buffer << 8);
+		if (!tev->BufferKnown)
+			GPUCMD_AddWrite(GPUREG_TEXENV_BUFFER_COLOR, 0);
+		tev->Buffer = buffer;
+		tev->BufferKnown = GL_TRUE;
+	}
+}
+
+/**
+ * Forget the stages set up on the GPU, after it was reset or used by
+ * another context.
+ */
+void _gl3ds_reset_tev(struct gl_context *ctx)
+{
+	ctx->Tev.Known = 0;
+	ctx->Tev.BufferKnown = GL_FALSE;
+	ctx->NewState |= _NEW_TEXTURE;
+}
@@ -0,0 +1,14 @@
+#ifndef GL3DS_TEV
+#define GL3DS_TEV
+
+#include "glheader.h"
+
+struct gl_context;
+
+/** State the combiner stages are compiled from */
+#define _TEV_STATE (_NEW_TEXTURE | _NEW_LIGHT | _NEW_PROGRAM)
+
+void _gl3ds_update_tev(struct gl_context *ctx);
+void _gl3ds_reset_tev(struct gl_context *ctx);
+
+#endif
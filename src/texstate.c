@@ -159,9 +159,9 @@ _mesa_print_texunit_state( struct gl_context *ctx, GLuint unit )
  * \param texBaseFormat  Base format of the texture associated with the
  *               texture unit.
  */
-static void
-calculate_derived_texenv( struct gl_tex_env_combine_state *state,
-			  GLenum mode, GLenum texBaseFormat )
+void
+_mesa_calculate_derived_texenv( struct gl_tex_env_combine_state *state,
+                                GLenum mode, GLenum texBaseFormat )
 {
    GLenum mode_rgb;
    GLenum mode_a;
@@ -181,10 +181,10 @@ calculate_derived_texenv( struct gl_tex_env_combine_state *state,
 //   case GL_LUMINANCE:
 //   case GL_RED:
 //   case GL_RG:
-//   case GL_RGB:
+   case GL_RGB:
 //   case GL_YCBCR_MESA:
-//      state->SourceA[0] = GL_PREVIOUS;
-//      break;
+      state->SourceA[0] = GL_PREVIOUS;
+      break;
 
    default:
       _mesa_problem(NULL,
@@ -399,7 +399,7 @@ update_tex_combine(struct gl_context *ctx, struct gl_texture_unit *texUnit)
       if (format == GL_DEPTH_COMPONENT || format == GL_DEPTH_STENCIL) {
          format = texObj->DepthMode;
       }
-      calculate_derived_texenv(&texUnit->_EnvMode, texUnit->EnvMode, format);
+      _mesa_calculate_derived_texenv(&texUnit->_EnvMode, texUnit->EnvMode, format);
       texUnit->_CurrentCombine = & texUnit->_EnvMode;
    }
 
@@ -98,6 +98,10 @@ _mesa_print_texunit_state( struct gl_context *ctx, GLuint unit );
 extern void 
 _mesa_update_texture( struct gl_context *ctx, GLuint new_state );
 
+extern void
+_mesa_calculate_derived_texenv( struct gl_tex_env_combine_state *state,
+                                GLenum mode, GLenum texBaseFormat );
+
 extern GLboolean
 _mesa_init_texture( struct gl_context *ctx );
 
@@ -2,75 +2,188 @@
 #include "mtypes.h"
 #include "errors.h"
 #include "context.h"
+#include "hash.h"
+#include "shader.h"
+#include "util/bitset.h"
+
+/** Locations of the integer and boolean registers, after the 96 float ones */
+#define INT_UNIFORM_LOCATION	0x60
+#define BOOL_UNIFORM_LOCATION	0x68
+
+/**
+ * Store float vectors in a program's uniform registers, marking those
+ * whose value changed for upload.
+ */
+static void store_uniform(struct gl_context *ctx, struct gl_program_uniforms *uniforms,
+						  GLint location, GLsizei count, const GLfloat* value, bool need_swap)
+{
+	GLfloat swapped[4];
+	int i;
+
+	if (count < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "glUniform(count=%d)", count);
+		return;
+	}
+
+	if (location < 0 || location + count > MAX_FLOAT_UNIFORM_REGS) {
+		_mesa_error(ctx, GL_INVALID_OPERATION,
+					"glUniform(location=%d, count=%d)", location, count);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		const GLfloat *v = value + i*4;
+		GLfloat *reg = uniforms->Float[location + i];
+
+		if (need_swap) {
+			swapped[0] = v[3];
+			swapped[1] = v[2];
+			swapped[2] = v[1];
+			swapped[3] = v[0];
+			v = swapped;
+		}
+
+		if (BITSET_TEST(uniforms->FloatSet, location + i) &&
+			!memcmp(reg, v, sizeof(swapped)))
+			continue;
+
+		memcpy(reg, v, sizeof(swapped));
+		BITSET_SET(uniforms->FloatSet, location + i);
+		BITSET_SET(uniforms->FloatDirty, location + i);
+		ctx->NewState |= _NEW_PROGRAM_CONSTANTS;
+	}
+}
 
+/** Store float vectors in the uniforms of the program in use */
 static void set_uniform(GLint location, GLsizei count, const GLfloat* value, bool need_swap)
 {
 	GET_CURRENT_CONTEXT(ctx);
-	if (ctx->Shared->Shader->Program)
-	{
-		int i;
-		struct gl_shader_uniform* uniform;
-		for (i = 0; i < ctx->Shared->Shader->UniformCount; i++) {
-			if (ctx->Shared->Shader->UniformVals[i].location == location) {
-				break;
-			}
-		}
-		uniform = &ctx->Shared->Shader->UniformVals[i];
-		if (i == ctx->Shared->Shader->UniformCount) {
-			uniform->count = (u8) count;
-			uniform->location = (u32) location;
-			uniform->value = malloc(sizeof(float) * count * 4);
-			if (!uniform->value)
-				return;
-			ctx->Shared->Shader->UniformCount++;
+	struct gl_pica_program *prog = ctx->Shared->Shader->Program;
+
+	if (!prog || location == -1)
+		return;
+
+	store_uniform(ctx, &prog->Uniforms, location, count, value, need_swap);
+}
+
+/**
+ * Store float vectors, components in x, y, z, w order, in the uniforms of
+ * a program the driver sets up.  Location -1 is ignored.
+ */
+void _gl3ds_set_uniforms(struct gl_context *ctx, struct gl_program_uniforms *uniforms,
+						 GLint location, GLsizei count, const GLfloat *value)
+{
+	if (uniforms && location != -1)
+		store_uniform(ctx, uniforms, location, count, value, true);
+}
+
+/**
+ * Store integer vectors of \p size components in the current program's
+ * uniforms.  Depending on the location they set integer, boolean or float
+ * registers.
+ */
+static void set_int_uniform(GLint location, GLsizei count, const GLint* value, int size)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	struct gl_pica_program *prog = ctx->Shared->Shader->Program;
+	struct gl_program_uniforms *uniforms;
+	int i, j;
+
+	if (count < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "glUniform(count=%d)", count);
+		return;
+	}
+
+	if (!prog || location == -1)
+		return;
+	uniforms = &prog->Uniforms;
+
+	if (location >= 0 && location < MAX_FLOAT_UNIFORM_REGS) {
+		for (i = 0; i < count; i++) {
+			GLfloat v[4] = {0, 0, 0, 0};
+			for (j = 0; j < size; j++)
+				v[3 - j] = (GLfloat) value[i*size + j];
+			set_uniform(location + i, 1, v, false);
 		}
+		return;
+	}
 
-		if (need_swap) {
-			for (i = 0; i < count*4; i+=4) {
-				uniform->value[i]   = value[i+3];
-				uniform->value[i+1] = value[i+2];
-				uniform->value[i+2] = value[i+1];
-				uniform->value[i+3] = value[i];
-			}
-		} else {
-			memcpy(uniform->value, value, sizeof(float) * count * 4);
+	if (location >= INT_UNIFORM_LOCATION && location + count <= INT_UNIFORM_LOCATION + 4) {
+		for (i = 0; i < count; i++) {
+			int reg = location - INT_UNIFORM_LOCATION + i;
+			u32 packed = 0;
+			for (j = 0; j < size; j++)
+				packed |= (u32) (value[i*size + j] & 0xFF) << (8 * j);
+
+			if ((uniforms->IntSet & (1 << reg)) && uniforms->Int[reg] == packed)
+				continue;
+
+			uniforms->Int[reg] = packed;
+			uniforms->IntSet |= 1 << reg;
+			uniforms->IntBoolDirty = GL_TRUE;
+			ctx->NewState |= _NEW_PROGRAM_CONSTANTS;
 		}
+		return;
+	}
+
+	if (size == 1 && location >= BOOL_UNIFORM_LOCATION && location + count <= BOOL_UNIFORM_LOCATION + 16) {
+		for (i = 0; i < count; i++) {
+			GLushort bit = 1 << (location - BOOL_UNIFORM_LOCATION + i);
+			GLushort bools = value[i] ? (uniforms->Bool | bit) : (uniforms->Bool & ~bit);
+
+			if ((uniforms->BoolSet & bit) && uniforms->Bool == bools)
+				continue;
 
-		uniform->changed = true;
+			uniforms->Bool = bools;
+			uniforms->BoolSet |= bit;
+			uniforms->IntBoolDirty = GL_TRUE;
+			ctx->NewState |= _NEW_PROGRAM_CONSTANTS;
+		}
+		return;
 	}
+
+	_mesa_error(ctx, GL_INVALID_OPERATION,
+				"glUniform(location=%d, count=%d)", location, count);
 }
 
 void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
 {
 	GET_CURRENT_CONTEXT(ctx);
+	int i;
 
-	// TODO: make use of transpose according to OGL standards
-	if (location < 0) {
+	if (location < 0 || count < 0) {
 		_mesa_error(ctx, GL_INVALID_VALUE,
-					"glUniformMatrix4fv(location=%d)",
-					location);
+					"glUniformMatrix4fv(location=%d, count=%d)",
+					location, count);
 		return;
 	}
 
-	if (!transpose) {
-		GLfloat copy[16];
-		_math_transposef(copy, value);
-		memcpy(value, copy, sizeof(GLfloat)*16);
+	// The registers hold the rows of the matrix
+	for (i = 0; i < count; i++) {
+		if (!transpose) {
+			GLfloat copy[16];
+			_math_transposef(copy, value + i*16);
+			set_uniform(location + i*4, 4, copy, true);
+		} else {
+			set_uniform(location + i*4, 4, value + i*16, true);
+		}
 	}
-
-//	printf("\nv:%f,%f,%f,%f\nv:%f,%f,%f,%f\nv:%f,%f,%f,%f\nv:%f,%f,%f,%f\n",
-//		   value[0],value[1],value[2],value[3],
-//		   value[4],value[5],value[6],value[7],
-//		   value[8],value[9],value[10],value[11],
-//		   value[12],value[13],value[14],value[15]);
-	set_uniform(location, count * 4, value, true);
 }
 
 GLint glGetUniformLocation(GLuint program, const GLchar* name)
 {
-	shaderProgram_s* prog = (shaderProgram_s*) program;
+	GET_CURRENT_CONTEXT(ctx);
+	struct gl_pica_program *prog = _mesa_HashLookup(ctx->Shared->Shader->Programs, program);
+
+	if (!prog) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "glGetUniformLocation(program=%u)", program);
+		return -1;
+	}
+
 	// TODO: need to check geometry shader too?
-	return (GLint) shaderInstanceGetUniformLocation(prog->vertexShader, name);
+	if (!prog->Program.vertexShader)
+		return -1;
+	return (GLint) shaderInstanceGetUniformLocation(prog->Program.vertexShader, name);
 }
 
 /* UNIFORM FUNCTIONS */
@@ -94,21 +207,33 @@ void glUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
 	set_uniform(location, 1, params, false);
 }
 
-void glUniform1i(GLint location, GLint v0){}
-void glUniform2i(GLint location, GLint v0, GLint v1){}
-void glUniform3i(GLint location, GLint v0, GLint v1, GLint v2){}
-void glUniform4i(GLint location, GLint v0, GLint v1, GLint v2, GLint v3){}
+void glUniform1i(GLint location, GLint v0){
+	GLint params[1] = {v0};
+	set_int_uniform(location, 1, params, 1);
+}
+
+void glUniform2i(GLint location, GLint v0, GLint v1){
+	GLint params[2] = {v0, v1};
+	set_int_uniform(location, 1, params, 2);
+}
+
+void glUniform3i(GLint location, GLint v0, GLint v1, GLint v2){
+	GLint params[3] = {v0, v1, v2};
+	set_int_uniform(location, 1, params, 3);
+}
+
+void glUniform4i(GLint location, GLint v0, GLint v1, GLint v2, GLint v3){
+	GLint params[4] = {v0, v1, v2, v3};
+	set_int_uniform(location, 1, params, 4);
+}
 
 void glUniform4iv(GLint location, GLsizei count, const GLint *value)
 {
-	GPUCMD_AddSingleParam(0x000F02C0, 0x80000000 | location);
-	GPUCMD_Add(0x000F02C1, (u32*) value, count * 4);
+	set_int_uniform(location, count, value, 4);
 }
 
 
 void glUniform4fv(GLint location, GLsizei count, const GLfloat* value)
 {
-	// TODO: update shader state
-	GPUCMD_AddSingleParam(0x000F02C0, 0x80000000 | location);
-	GPUCMD_Add(0x000F02C1, (u32*) value, count * 4);
+	set_uniform(location, count, value, true);
 }
@@ -29,8 +29,10 @@
 
 #include "glheader.h"
 #include "imports.h"
+#include "bufferalloc.h"
 #include "bufferobj.h"
 #include "context.h"
+#include "cull.h"
 #include "enable.h"
 #include "enums.h"
 #include "hash.h"
@@ -96,23 +98,20 @@ type_to_bit(const struct gl_context *ctx, GLenum type)
 			return UNSIGNED_BYTE_BIT;
 		case GL_SHORT:
 			return SHORT_BIT;
-//		case GL_UNSIGNED_SHORT:
-//			return UNSIGNED_SHORT_BIT;
-//		case GL_INT:
-//			return INT_BIT;
-//		case GL_UNSIGNED_INT:
-//			return UNSIGNED_INT_BIT;
-//		case GL_HALF_FLOAT:
-//			if (ctx->Extensions.ARB_half_float_vertex)
-//				return HALF_BIT;
-//			else
-//				return 0x0;
+		case GL_UNSIGNED_SHORT:
+			return UNSIGNED_SHORT_BIT;
+		case GL_INT:
+			return INT_BIT;
+		case GL_UNSIGNED_INT:
+			return UNSIGNED_INT_BIT;
+		case GL_HALF_FLOAT:
+			return HALF_BIT;
 		case GL_FLOAT:
 			return FLOAT_BIT;
-//		case GL_DOUBLE:
-//			return DOUBLE_BIT;
-//		case GL_FIXED:
-//			return _mesa_is_desktop_gl(ctx) ? FIXED_GL_BIT : FIXED_ES_BIT;
+		case GL_DOUBLE:
+			return DOUBLE_BIT;
+		case GL_FIXED:
+			return FIXED_GL_BIT | FIXED_ES_BIT;
 //		case GL_UNSIGNED_INT_2_10_10_10_REV:
 //			return UNSIGNED_INT_2_10_10_10_REV_BIT;
 //		case GL_INT_2_10_10_10_REV:
@@ -210,39 +209,13 @@ get_legal_types_mask(const struct gl_context *ctx)
 {
 	GLbitfield legalTypesMask = ALL_TYPE_BITS;
 
-//	if (_mesa_is_gles(ctx)) {
-		legalTypesMask &= ~(FIXED_GL_BIT |
-							DOUBLE_BIT |
-							UNSIGNED_INT_10F_11F_11F_REV_BIT);
-
-		/* GL_INT and GL_UNSIGNED_INT data is not allowed in OpenGL ES until
-		   * 3.0.  The 2_10_10_10 types are added in OpenGL ES 3.0 or
-		   * GL_OES_vertex_type_10_10_10_2.  GL_HALF_FLOAT data is not allowed
-		   * until 3.0 or with the GL_OES_vertex_half float extension, which isn't
-		   * quite as trivial as we'd like because it uses a different enum value
-		   * for GL_HALF_FLOAT_OES.
-		   */
-//		if (ctx->Version < 30) {
-			legalTypesMask &= ~(UNSIGNED_INT_BIT |
-								INT_BIT |
-								UNSIGNED_INT_2_10_10_10_REV_BIT |
-								INT_2_10_10_10_REV_BIT |
-								HALF_BIT);
-//		}
-//	}
-//	else {
-//		legalTypesMask &= ~FIXED_ES_BIT;
-//
-//		if (!ctx->Extensions.ARB_ES2_compatibility)
-//			legalTypesMask &= ~FIXED_GL_BIT;
-//
-//		if (!ctx->Extensions.ARB_vertex_type_2_10_10_10_rev)
-//			legalTypesMask &= ~(UNSIGNED_INT_2_10_10_10_REV_BIT |
-//								INT_2_10_10_10_REV_BIT);
-//
-//		if (!ctx->Extensions.ARB_vertex_type_10f_11f_11f_rev)
-//			legalTypesMask &= ~UNSIGNED_INT_10F_11F_11F_REV_BIT;
-//	}
+	/* Types the PICA200 attribute loader can't fetch (anything other than
+	 * byte, ubyte, short and float) are converted to float at draw time by
+	 * _gl3ds_update_arrays(), so only the packed formats are rejected.
+	 */
+	legalTypesMask &= ~(UNSIGNED_INT_2_10_10_10_REV_BIT |
+						INT_2_10_10_10_REV_BIT |
+						UNSIGNED_INT_10F_11F_11F_REV_BIT);
 
 	return legalTypesMask;
 }
@@ -1435,64 +1408,6 @@ void glUnlockArraysEXT( void )
 }
 
 
-/* GL_EXT_multi_draw_arrays */
-void glMultiDrawArrays( GLenum mode, const GLint *first,
-const GLsizei *count, GLsizei primcount )
-{
-	GET_CURRENT_CONTEXT(ctx);
-	GLint i;
-
-	FLUSH_VERTICES(ctx, 0);
-
-	for (i = 0; i < primcount; i++) {
-		if (count[i] > 0) {
-//			CALL_DrawArrays(ctx->CurrentDispatch, (mode, first[i], count[i]));
-		}
-	}
-}
-
-
-/* GL_IBM_multimode_draw_arrays */
-void glMultiModeDrawArraysIBM( const GLenum * mode, const GLint * first,
-									  const GLsizei * count,
-									  GLsizei primcount, GLint modestride )
-{
-	GET_CURRENT_CONTEXT(ctx);
-	GLint i;
-
-	FLUSH_VERTICES(ctx, 0);
-
-	for ( i = 0 ; i < primcount ; i++ ) {
-		if ( count[i] > 0 ) {
-			GLenum m = *((GLenum *) ((GLubyte *) mode + i * modestride));
-//			CALL_DrawArrays(ctx->CurrentDispatch, ( m, first[i], count[i] ));
-		}
-	}
-}
-
-
-/* GL_IBM_multimode_draw_arrays */
-void glMultiModeDrawElementsIBM( const GLenum * mode, const GLsizei * count,
-										GLenum type, const GLvoid * const * indices,
-										GLsizei primcount, GLint modestride )
-{
-	GET_CURRENT_CONTEXT(ctx);
-	GLint i;
-
-	FLUSH_VERTICES(ctx, 0);
-
-	/* XXX not sure about ARB_vertex_buffer_object handling here */
-
-	for ( i = 0 ; i < primcount ; i++ ) {
-		if ( count[i] > 0 ) {
-			GLenum m = *((GLenum *) ((GLubyte *) mode + i * modestride));
-//			CALL_DrawElements(ctx->CurrentDispatch, ( m, count[i], type,
-//					indices[i] ));
-		}
-	}
-}
-
-
 /**
  * GL_NV_primitive_restart and GL 3.1
  */
@@ -2302,96 +2217,812 @@ _mesa_free_varray_data(struct gl_context *ctx)
 }
 
 
+
+
 extern u32 __linear_heap;
 
-static int update_attrib_format(struct gl_vertex_array_object* vao)
-{
-	int x, index = 0;
-	struct gl_vertex_attrib_array* attrib;
-	for (x = 0; x < VERT_ATTRIB_MAX; ++x) {
-		attrib = &vao->VertexAttrib[x];
-		if (attrib->Enabled) {
-			vao->AttributeFormats |= GPU_ATTRIBFMT(index, attrib->Size, attrib->Type);
-//			vao->AttributeFormats |= ((attrib->Size-1 << 2) | attrib->Type) << (index * 4);
-			vao->AttributePermutation |= index << (index * 4);
-			vao->BufferStrides[index] = attrib->Stride;
-			vao->BufferOffsets[index] = (u32)attrib->Ptr - __linear_heap;
-			vao->BufferPermutations[index] = index;// << (index * 4);
-			index++;
+/**
+ * Return the address of the first element of a vertex array.  VBO backed
+ * arrays store an offset in Ptr which is resolved against the buffer's
+ * linear memory storage.
+ */
+static const GLubyte *
+array_address(const struct gl_client_array *array)
+{
+	if (_mesa_is_bufferobj(array->BufferObj))
+		return array->BufferObj->Data + (GLintptr) array->Ptr;
+	return array->Ptr;
+}
+
+
+/**
+ * Can the PICA200 attribute loader fetch this datatype directly?
+ */
+static inline GLboolean
+native_attrib_type(GLenum type)
+{
+	return type == GL_BYTE || type == GL_UNSIGNED_BYTE ||
+		   type == GL_SHORT || type == GL_FLOAT;
+}
+
+
+#define CONVERT(TYPE, EXPR)                                          \
+	for (i = 0; i < count; i++, src += stride, dst += size) {        \
+		const TYPE *in = (const TYPE *) src;                         \
+		for (c = 0; c < size; c++)                                   \
+			dst[c] = (EXPR);                                         \
+	}
+
+/**
+ * Convert \p count elements of a vertex array into tightly packed floats.
+ * Natively fetched types are converted the way the attribute loader reads
+ * them, without normalization.
+ */
+static void
+convert_array(GLfloat *dst, const GLubyte *src, GLsizei stride,
+			  GLint size, GLenum type, GLboolean normalized, GLuint count)
+{
+	GLuint i;
+	GLint c;
+
+	switch (type) {
+		case GL_BYTE:
+			CONVERT(GLbyte, (GLfloat) in[c])
+			break;
+		case GL_UNSIGNED_BYTE:
+			CONVERT(GLubyte, (GLfloat) in[c])
+			break;
+		case GL_SHORT:
+			CONVERT(GLshort, (GLfloat) in[c])
+			break;
+		case GL_FLOAT:
+			CONVERT(GLfloat, in[c])
+			break;
+		case GL_UNSIGNED_SHORT:
+			if (normalized)
+				CONVERT(GLushort, USHORT_TO_FLOAT(in[c]))
+			else
+				CONVERT(GLushort, (GLfloat) in[c])
+			break;
+		case GL_INT:
+			if (normalized)
+				CONVERT(GLint, INT_TO_FLOAT(in[c]))
+			else
+				CONVERT(GLint, (GLfloat) in[c])
+			break;
+		case GL_UNSIGNED_INT:
+			if (normalized)
+				CONVERT(GLuint, UINT_TO_FLOAT(in[c]))
+			else
+				CONVERT(GLuint, (GLfloat) in[c])
+			break;
+		case GL_HALF_FLOAT:
+			CONVERT(GLhalfARB, _mesa_half_to_float(in[c]))
+			break;
+		case GL_DOUBLE:
+			CONVERT(GLdouble, (GLfloat) in[c])
+			break;
+		case GL_FIXED:
+			CONVERT(GLfixed, (GLfloat) in[c] * (1.0F / 65536.0F))
+			break;
+		default:
+			assert(!"unexpected vertex array type");
+	}
+}
+
+#undef CONVERT
+
+
+/**
+ * Return the float copy of a VBO backed array, converting the buffer data
+ * on first use or after the source range was modified.  A copy draws yet
+ * to execute read is retired rather than converted over.
+ */
+static struct gl_converted_array *
+converted_array(struct gl_context *ctx, const struct gl_client_array *array)
+{
+	struct gl_buffer_object *bufObj = array->BufferObj;
+	const GLintptr offset = (GLintptr) array->Ptr;
+	struct gl_converted_array *conv;
+
+	for (conv = bufObj->Converted; conv; conv = conv->Next) {
+		if (conv->Offset == offset && conv->StrideB == array->StrideB &&
+			conv->Size == array->Size && conv->Type == array->Type &&
+			conv->Normalized == array->Normalized)
+			break;
+	}
+
+	if (!conv) {
+		if (offset + array->_ElementSize > bufObj->Size)
+			return NULL;
+
+		conv = CALLOC_STRUCT(gl_converted_array);
+		if (!conv)
+			return NULL;
+
+		conv->Offset = offset;
+		conv->StrideB = array->StrideB;
+		conv->Size = array->Size;
+		conv->Type = array->Type;
+		conv->Normalized = array->Normalized;
+		conv->Count = array->StrideB ?
+			(bufObj->Size - offset - array->_ElementSize) / array->StrideB + 1 : 1;
+		conv->Data = _gl3ds_buffer_alloc(ctx->Shared->BufferPool,
+										 conv->Count * conv->Size * sizeof(GLfloat));
+		if (!conv->Data) {
+			free(conv);
+			return NULL;
 		}
+		conv->Stale = GL_TRUE;
+		conv->Next = bufObj->Converted;
+		bufObj->Converted = conv;
+	}
+
+	if (conv->Stale) {
+		const GLsizeiptr bytes = conv->Count * conv->Size * sizeof(GLfloat);
+
+		if (_gl3ds_fence_pending(ctx, conv->LastUseFence)) {
+			// Converted in place if no storage is available
+			GLfloat *data = _gl3ds_buffer_alloc(ctx->Shared->BufferPool, bytes);
+			if (data) {
+				_gl3ds_buffer_retire(ctx->Shared->BufferPool, conv->Data, bytes,
+									 conv->LastUseFence);
+				conv->Data = data;
+			}
+		}
+
+		_gl3ds_bufferobj_sync(ctx, bufObj);
+		convert_array(conv->Data, bufObj->Data + offset, conv->StrideB,
+					  conv->Size, conv->Type, conv->Normalized, conv->Count);
+		GSPGPU_FlushDataCache(conv->Data, bytes);
+		conv->Stale = GL_FALSE;
+	}
+
+	// Another context may be recording a later frame
+	if ((GLint) (ctx->FrameFence - conv->LastUseFence) > 0)
+		conv->LastUseFence = ctx->FrameFence;
+
+	return conv;
+}
+
+
+/**
+ * Allocate \p size bytes from the per-frame stream buffer, at least
+ * \p bias bytes past the start of the linear heap.  The buffer is
+ * recycled by gl3ds_flushContext() once the GPU has consumed the frame.
+ */
+static void *
+stream_alloc(struct gl_context *ctx, GLuint size, GLuint bias)
+{
+	const u32 base = (u32) ctx->StreamBuffer - __linear_heap;
+	GLuint offset = ALIGN(ctx->StreamBufferOffset, 16);
+
+	if (base + offset < bias)
+		offset = ALIGN(bias - base, 16);
+	if (offset + size > ctx->StreamBufferSize)
+		return NULL;
+
+	ctx->StreamBufferOffset = offset + size;
+	return ctx->StreamBuffer + offset;
+}
+
+
+/**
+ * Emit the attribute loader configuration for the enabled arrays of the
+ * current VAO.  Each enabled array feeds the vertex shader input register
+ * of its index in VERT_ATTRIB order, through its own loader.
+ * Addresses are relative to the start of the linear heap, so client arrays
+ * must live in linear memory.
+ *
+ * Arrays of types the loader can't fetch are read as floats instead: VBO
+ * backed ones from a cached copy attached to the buffer object, client
+ * arrays from the stream buffer, filled in per draw by stream_arrays().
+ *
+ * Arrays with an instance divisor get no loader.  Their input is a fixed
+ * attribute, set for each instance by instance_attribs().
+ *
+ * If no arrays are enabled the loader is left alone, so applications that
+ * configure it directly through ctrulib keep working.
+ */
+void _gl3ds_update_arrays(struct gl_context *ctx)
+{
+	struct gl_vertex_array_object *vao = ctx->Array.VAO;
+	GLbitfield64 enabled = vao->_Enabled;
+	u32 param[3 + 3 * PICA_MAX_ATTRIBS];
+	u64 formats = 0, permutation = 0;
+	u32 count = 0, loaders = 0, fixed = 0;
+
+	ctx->Array._StreamArrays = 0;
+	ctx->Array._InstancedArrays = 0;
+
+	if (!enabled)
+		return;
+
+	memset(param, 0x00, sizeof(param));
+
+	while (enabled && count < PICA_MAX_ATTRIBS) {
+		const GLint attrib = ffsll(enabled) - 1;
+		const struct gl_client_array *array = &vao->_VertexAttrib[attrib];
+		const GLubyte *address = array_address(array);
+		GLenum type = array->Type;
+		GLsizei stride = array->StrideB;
+		u32 *loader = &param[3 * (loaders + 1)];
+
+		enabled ^= BITFIELD64_BIT(attrib);
+		permutation |= (u64) count << (count * 4);
+
+		if (_mesa_is_bufferobj(array->BufferObj))
+			_gl3ds_bufferobj_use(ctx, array->BufferObj);
+
+		if (array->InstanceDivisor) {
+			ctx->Array._InstancedArrays |= BITFIELD64_BIT(attrib);
+			fixed |= 1 << count;
+			count++;
+			continue;
+		}
+
+		if (!native_attrib_type(type)) {
+			if (_mesa_is_bufferobj(array->BufferObj)) {
+				struct gl_converted_array *conv = converted_array(ctx, array);
+				if (!conv) {
+					_mesa_error(ctx, GL_OUT_OF_MEMORY, "vertex array conversion");
+					return;
+				}
+				address = (const GLubyte *) conv->Data;
+			}
+			else {
+				ctx->Array._StreamArrays |= BITFIELD64_BIT(attrib);
+			}
+			type = GL_FLOAT;
+			stride = array->StrideB ? array->Size * sizeof(GLfloat) : 0;
+		}
+
+		formats |= (u64) (((array->Size - 1) << 2) | (type & 3)) << (count * 4);
+
+		loader[0] = (u32) address - __linear_heap;
+		loader[1] = count;
+		loader[2] = (1 << 28) | ((stride & 0xFFF) << 16);
+		loaders++;
+		count++;
+	}
+
+	/* Unused attributes read fixed values too */
+	fixed |= 0xFFF & ~((1 << count) - 1);
+
+	param[0] = osConvertVirtToPhys(__linear_heap) >> 3;
+	param[1] = formats & 0xFFFFFFFF;
+	param[2] = ((count - 1) << 28) | (fixed << 16) | ((formats >> 32) & 0xFFFF);
+
+	GPUCMD_AddIncrementalWrites(GPUREG_ATTRIBBUFFERS_LOC, param, ARRAY_SIZE(param));
+
+	GPUCMD_AddMaskedWrite(GPUREG_VSH_INPUTBUFFER_CONFIG, 0xB, 0xA0000000 | (count - 1));
+	GPUCMD_AddWrite(GPUREG_VSH_NUM_ATTR, count - 1);
+
+	GPUCMD_AddIncrementalWrites(GPUREG_VSH_ATTRIBUTES_PERMUTATION_LOW,
+		((u32[]){permutation & 0xFFFFFFFF, (permutation >> 32) & 0xFFFF}), 2);
+}
+
+
+/**
+ * Convert the elements [min, max] of the client arrays flagged by
+ * _gl3ds_update_arrays() into the stream buffer and point their loaders
+ * at the copies.  Must be called after update_context().
+ */
+static GLboolean
+stream_arrays(struct gl_context *ctx, GLuint min, GLuint max, const char *func)
+{
+	struct gl_vertex_array_object *vao = ctx->Array.VAO;
+	GLbitfield64 arrays = ctx->Array._StreamArrays;
+
+	while (arrays) {
+		const GLint attrib = ffsll(arrays) - 1;
+		const struct gl_client_array *array = &vao->_VertexAttrib[attrib];
+		const GLuint slot = _mesa_bitcount_64(vao->_Enabled &
+											  ~ctx->Array._InstancedArrays &
+											  (BITFIELD64_BIT(attrib) - 1));
+		const GLuint first = array->StrideB ? min : 0;
+		const GLuint last = array->StrideB ? max : 0;
+		const GLuint size = (last - first + 1) * array->Size * sizeof(GLfloat);
+		const GLuint bias = first * array->Size * sizeof(GLfloat);
+		GLfloat *data;
+
+		arrays ^= BITFIELD64_BIT(attrib);
+
+		/* Only [first, last] is copied, the loader offset is moved back by
+		 * first elements, which must not take it before the heap.
+		 */
+		data = stream_alloc(ctx, size, bias);
+		if (!data) {
+			_mesa_error(ctx, GL_OUT_OF_MEMORY, "%s(vertex array conversion)", func);
+			return GL_FALSE;
+		}
+
+		convert_array(data, (const GLubyte *) array->Ptr + first * array->StrideB,
+					  array->StrideB, array->Size, array->Type,
+					  array->Normalized, last - first + 1);
+		GSPGPU_FlushDataCache(data, size);
+
+		GPUCMD_AddWrite(GPUREG_ATTRIBBUFFER0_OFFSET + 3 * slot,
+						(u32) data - __linear_heap - bias);
+	}
+
+	return GL_TRUE;
+}
+
+
+/**
+ * Load the fixed attributes of the arrays with an instance divisor with
+ * their values for \p instance.  Values only change every divisor
+ * instances, so the others are skipped.
+ */
+static void
+instance_attribs(struct gl_context *ctx, GLuint instance)
+{
+	struct gl_vertex_array_object *vao = ctx->Array.VAO;
+	GLbitfield64 arrays = ctx->Array._InstancedArrays;
+
+	while (arrays) {
+		const GLint attrib = ffsll(arrays) - 1;
+		const struct gl_client_array *array = &vao->_VertexAttrib[attrib];
+		GLfloat v[4] = { 0.0F, 0.0F, 0.0F, 1.0F };
+		u32 data[3];
+
+		arrays ^= BITFIELD64_BIT(attrib);
+
+		if (instance % array->InstanceDivisor)
+			continue;
+
+		convert_array(v, array_address(array) +
+					  (instance / array->InstanceDivisor) * array->StrideB,
+					  0, array->Size, array->Type, array->Normalized, 1);
+
+		data[0] = f32tof24(v[3]) << 8 | f32tof24(v[2]) >> 16;
+		data[1] = f32tof24(v[2]) << 16 | f32tof24(v[1]) >> 8;
+		data[2] = f32tof24(v[1]) << 24 | f32tof24(v[0]);
+
+		GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_INDEX,
+						_mesa_bitcount_64(vao->_Enabled & (BITFIELD64_BIT(attrib) - 1)));
+		GPUCMD_AddIncrementalWrites(GPUREG_FIXEDATTRIB_DATA0, data, 3);
+	}
+}
+
+
+/**
+ * Check a draw call's primitive mode against what the PICA200 rasterizes.
+ */
+static GLboolean
+valid_prim_mode(struct gl_context *ctx, GLenum mode, const char *func)
+{
+	switch (mode) {
+		case GL_TRIANGLES:
+		case GL_TRIANGLE_STRIP:
+		case GL_TRIANGLE_FAN:
+			return GL_TRUE;
+		default:
+			_mesa_error(ctx, GL_INVALID_ENUM, "%s(mode=0x%x)", func, mode);
+			return GL_FALSE;
+	}
+}
+
+
+/**
+ * Check the index type of an indexed draw call.  ctrulib's GPU_DrawElements()
+ * always configures the index loader for 16-bit indices.
+ */
+static GLboolean
+valid_elements_type(struct gl_context *ctx, GLenum type, const char *func)
+{
+	if (type != GL_UNSIGNED_SHORT) {
+		_mesa_error(ctx, GL_INVALID_ENUM, "%s(type=0x%x)", func, type);
+		return GL_FALSE;
+	}
+	return GL_TRUE;
+}
+
+
+/**
+ * Return the address of an index array.  With an element array buffer
+ * bound, \p indices is an offset into it.
+ */
+static const GLushort *
+elements_address(struct gl_context *ctx, const GLvoid *indices)
+{
+	struct gl_buffer_object *ibo = ctx->Array.VAO->IndexBufferObj;
+
+	if (_mesa_is_bufferobj(ibo))
+		return (const GLushort *) (ibo->Data + (GLintptr) indices);
+	return (const GLushort *) indices;
+}
+
+
+/**
+ * Return the offset of an index array from the attribute base address.
+ */
+static u32 *
+elements_offset(struct gl_context *ctx, const GLvoid *indices)
+{
+	struct gl_buffer_object *ibo = ctx->Array.VAO->IndexBufferObj;
+
+	if (_mesa_is_bufferobj(ibo))
+		_gl3ds_bufferobj_use(ctx, ibo);
+
+	return (u32 *) ((u32) elements_address(ctx, indices) - __linear_heap);
+}
+
+
+/**
+ * Widen [*min, *max] to cover the vertices referenced by an index array.
+ */
+static void
+elements_range(struct gl_context *ctx, GLsizei count, const GLvoid *indices,
+			   GLuint *min, GLuint *max)
+{
+	const GLushort *idx = elements_address(ctx, indices);
+	GLsizei i;
+
+	for (i = 0; i < count; i++) {
+		if (idx[i] < *min)
+			*min = idx[i];
+		if (idx[i] > *max)
+			*max = idx[i];
 	}
-	return index;
 }
 
 
 void glDrawArrays(GLenum mode, GLint first, GLsizei count)
 {
-	// TODO: properly set up VAOs before drawing
 	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+
+	if (!valid_prim_mode(ctx, mode, "glDrawArrays"))
+		return;
+
+	if (first < 0 || count < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE,
+					"glDrawArrays(first=%d, count=%d)", first, count);
+		return;
+	}
+
+	if (count == 0)
+		return;
+
+	if (skip)
+		return;
+
 	update_context(ctx);
-	GPU_DrawArray((GPU_Primitive_t)mode, 0, count);
-//	GPU_FinishDrawing();
-//	GPUCMD_Finalize();
-////	GPUCMD_Run(NULL);
-//	GPUCMD_FlushAndRun(NULL);
-//	gspWaitForP3D();
-//	ctx->CommandBufferOffset = 0;
-//	GPUCMD_SetBufferOffset(0);
-	return;
 
-	int i = 0;
-	u8 sizeTable[0xC];
+	if (ctx->Array._StreamArrays &&
+		!stream_arrays(ctx, first, first + count - 1, "glDrawArrays"))
+		return;
+
+	instance_attribs(ctx, 0);
+	GPU_DrawArray((GPU_Primitive_t) mode, first, count);
+}
+
+
+/* GL_EXT_multi_draw_arrays */
+void glMultiDrawArrays( GLenum mode, const GLint *first,
+const GLsizei *count, GLsizei primcount )
+{
+	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+	GLint i;
+
+	FLUSH_VERTICES(ctx, 0);
+
+	if (!valid_prim_mode(ctx, mode, "glMultiDrawArrays"))
+		return;
+
+	if (primcount < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE,
+					"glMultiDrawArrays(primcount=%d)", primcount);
+		return;
+	}
+
+	for (i = 0; i < primcount; i++) {
+		if (first[i] < 0 || count[i] < 0) {
+			_mesa_error(ctx, GL_INVALID_VALUE,
+						"glMultiDrawArrays(first[%d]=%d, count[%d]=%d)",
+						i, first[i], i, count[i]);
+			return;
+		}
+	}
+
+	if (skip)
+		return;
+
+	/* State is validated and emitted once for all of the ranges */
+	update_context(ctx);
+
+	if (ctx->Array._StreamArrays) {
+		GLuint min = ~0u, max = 0;
+		for (i = 0; i < primcount; i++) {
+			if (count[i] > 0) {
+				min = MIN2(min, (GLuint) first[i]);
+				max = MAX2(max, (GLuint) (first[i] + count[i] - 1));
+			}
+		}
+		if (min <= max && !stream_arrays(ctx, min, max, "glMultiDrawArrays"))
+			return;
+	}
+
+	instance_attribs(ctx, 0);
+
+	for (i = 0; i < primcount; i++) {
+		if (count[i] > 0)
+			GPU_DrawArray((GPU_Primitive_t) mode, first[i], count[i]);
+	}
+}
+
+
+/* GL_IBM_multimode_draw_arrays */
+void glMultiModeDrawArraysIBM( const GLenum * mode, const GLint * first,
+									  const GLsizei * count,
+									  GLsizei primcount, GLint modestride )
+{
+	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+	GLint i;
+
+	FLUSH_VERTICES(ctx, 0);
+
+	for ( i = 0 ; i < primcount ; i++ ) {
+		GLenum m = *((GLenum *) ((GLubyte *) mode + i * modestride));
+		if (!valid_prim_mode(ctx, m, "glMultiModeDrawArraysIBM"))
+			return;
+		if (first[i] < 0 || count[i] < 0) {
+			_mesa_error(ctx, GL_INVALID_VALUE,
+						"glMultiModeDrawArraysIBM(first[%d]=%d, count[%d]=%d)",
+						i, first[i], i, count[i]);
+			return;
+		}
+	}
+
+	if (skip)
+		return;
+
+	update_context(ctx);
+
+	if (ctx->Array._StreamArrays) {
+		GLuint min = ~0u, max = 0;
+		for ( i = 0 ; i < primcount ; i++ ) {
+			if ( count[i] > 0 ) {
+				min = MIN2(min, (GLuint) first[i]);
+				max = MAX2(max, (GLuint) (first[i] + count[i] - 1));
+			}
+		}
+		if (min <= max && !stream_arrays(ctx, min, max, "glMultiModeDrawArraysIBM"))
+			return;
+	}
+
+	instance_attribs(ctx, 0);
+
+	for ( i = 0 ; i < primcount ; i++ ) {
+		if ( count[i] > 0 ) {
+			GLenum m = *((GLenum *) ((GLubyte *) mode + i * modestride));
+			GPU_DrawArray((GPU_Primitive_t) m, first[i], count[i]);
+		}
+	}
+}
+
+
+void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+
+	if (!valid_prim_mode(ctx, mode, "glDrawElements") ||
+		!valid_elements_type(ctx, type, "glDrawElements"))
+		return;
+
+	if (count < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE, "glDrawElements(count=%d)", count);
+		return;
+	}
+
+	if (count == 0)
+		return;
+
+	if (skip)
+		return;
+
+	update_context(ctx);
+
+	if (ctx->Array._StreamArrays) {
+		GLuint min = ~0u, max = 0;
+		elements_range(ctx, count, indices, &min, &max);
+		if (!stream_arrays(ctx, min, max, "glDrawElements"))
+			return;
+	}
+
+	instance_attribs(ctx, 0);
+	GPU_DrawElements((GPU_Primitive_t) mode, elements_offset(ctx, indices), count);
+}
+
+
+/**
+ * Instances are drawn one after the other, with the per-instance arrays
+ * reloaded between them.
+ */
+void glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count,
+						   GLsizei primcount)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+	GLsizei i;
+
+	if (!valid_prim_mode(ctx, mode, "glDrawArraysInstanced"))
+		return;
+
+	if (first < 0 || count < 0 || primcount < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE,
+					"glDrawArraysInstanced(first=%d, count=%d, primcount=%d)",
+					first, count, primcount);
+		return;
+	}
+
+	if (count == 0 || primcount == 0)
+		return;
+
+	if (skip)
+		return;
+
+	update_context(ctx);
+
+	if (ctx->Array._StreamArrays &&
+		!stream_arrays(ctx, first, first + count - 1, "glDrawArraysInstanced"))
+		return;
+
+	for (i = 0; i < primcount; i++) {
+		instance_attribs(ctx, i);
+		GPU_DrawArray((GPU_Primitive_t) mode, first, count);
+	}
+}
+
+
+void glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type,
+							 const GLvoid *indices, GLsizei primcount)
+{
+	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+	GLsizei i;
+
+	if (!valid_prim_mode(ctx, mode, "glDrawElementsInstanced") ||
+		!valid_elements_type(ctx, type, "glDrawElementsInstanced"))
+		return;
+
+	if (count < 0 || primcount < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE,
+					"glDrawElementsInstanced(count=%d, primcount=%d)",
+					count, primcount);
+		return;
+	}
+
+	if (count == 0 || primcount == 0)
+		return;
+
+	if (skip)
+		return;
+
+	update_context(ctx);
+
+	if (ctx->Array._StreamArrays) {
+		GLuint min = ~0u, max = 0;
+		elements_range(ctx, count, indices, &min, &max);
+		if (!stream_arrays(ctx, min, max, "glDrawElementsInstanced"))
+			return;
+	}
+
+	for (i = 0; i < primcount; i++) {
+		instance_attribs(ctx, i);
+		GPU_DrawElements((GPU_Primitive_t) mode, elements_offset(ctx, indices), count);
+	}
+}
+
+
+void glMultiDrawElements( GLenum mode, const GLsizei *count, GLenum type,
+						  const GLvoid * const *indices, GLsizei primcount )
+{
+	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+	GLint i;
 
-	struct gl_vertex_array_object* vao = ctx->Array.VAO;
-	unsigned char attrib_count = update_attrib_format(vao);
+	FLUSH_VERTICES(ctx, 0);
 
+	if (!valid_prim_mode(ctx, mode, "glMultiDrawElements") ||
+		!valid_elements_type(ctx, type, "glMultiDrawElements"))
+		return;
 
-	int numBuffers = 3;
-	uint16_t attributeMask = 0xFF8; //0xFFF << 3;
+	if (primcount < 0) {
+		_mesa_error(ctx, GL_INVALID_VALUE,
+					"glMultiDrawElements(primcount=%d)", primcount);
+		return;
+	}
 
-	u32 param[28];
+	for (i = 0; i < primcount; i++) {
+		if (count[i] < 0) {
+			_mesa_error(ctx, GL_INVALID_VALUE,
+						"glMultiDrawElements(count[%d]=%d)", i, count[i]);
+			return;
+		}
+	}
 
-	memset(param, 0x00, 28*4);
+	if (skip)
+		return;
 
-	param[0x0]=(osConvertVirtToPhys(__linear_heap))>>3;
-	param[0x1]=vao->AttributeFormats&0xFFFFFFFF;
-	param[0x2]=((attrib_count-1)<<28)|((attributeMask&0xFFF)<<16)|((vao->AttributeFormats>>32)&0xFFFF);
+	/* State is validated and emitted once for all of the ranges */
+	update_context(ctx);
 
-	int j;
+	if (ctx->Array._StreamArrays) {
+		GLuint min = ~0u, max = 0;
+		for (i = 0; i < primcount; i++)
+			elements_range(ctx, count[i], indices[i], &min, &max);
+		if (min <= max && !stream_arrays(ctx, min, max, "glMultiDrawElements"))
+			return;
+	}
 
-	u8  bufferNumAttributes[] = {1, 1, 1};
-	const u8 GPU_FORMATSIZE[4]={1,1,2,4};
+	instance_attribs(ctx, 0);
 
-	for(i=0;i<attrib_count;i++)
-	{
-		u8 v=vao->AttributeFormats&0xF;
-		sizeTable[i]=GPU_FORMATSIZE[v&3]*((v>>2)+1);
-		vao->AttributeFormats>>=4;
+	for (i = 0; i < primcount; i++) {
+		if (count[i] > 0)
+			GPU_DrawElements((GPU_Primitive_t) mode,
+							 elements_offset(ctx, indices[i]), count[i]);
 	}
-	vao->AttributePermutation = 0x210;
-//printf("permutation:%x", vao->AttributePermutation);
-	for(i=0;i<numBuffers;i++)
-	{
-		u16 stride= vao->BufferStrides[i];
-//		u16 stride=0;
-		param[3*(i+1)+0]=vao->BufferOffsets[i];
-		param[3*(i+1)+1]=vao->BufferPermutations[i]&0xFFFFFFFF;
-//		for(j=0;j<bufferNumAttributes[i];j++)stride+=sizeTable[(vao->BufferPermutations[i]>>(4*j))&0xF];
-//		printf("stride%d:%d\n", i, stride);
-		param[3*(i+1)+2]=(bufferNumAttributes[i]<<28)|((stride&0xFFF)<<16)|((vao->BufferPermutations[i]>>32)&0xFFFF);
+}
+
+
+void glMultiDrawElementsEXT( GLenum mode, const GLsizei *count, GLenum type,
+							 const GLvoid **indices, GLsizei primcount )
+{
+	glMultiDrawElements(mode, count, type, indices, primcount);
+}
+
+
+/* GL_IBM_multimode_draw_arrays */
+void glMultiModeDrawElementsIBM( const GLenum * mode, const GLsizei * count,
+										GLenum type, const GLvoid * const * indices,
+										GLsizei primcount, GLint modestride )
+{
+	GET_CURRENT_CONTEXT(ctx);
+	const GLboolean skip = _gl3ds_cull_draw(ctx);
+	GLint i;
+
+	FLUSH_VERTICES(ctx, 0);
+
+	if (!valid_elements_type(ctx, type, "glMultiModeDrawElementsIBM"))
+		return;
+
+	for ( i = 0 ; i < primcount ; i++ ) {
+		GLenum m = *((GLenum *) ((GLubyte *) mode + i * modestride));
+		if (!valid_prim_mode(ctx, m, "glMultiModeDrawElementsIBM"))
+			return;
+		if (count[i] < 0) {
+			_mesa_error(ctx, GL_INVALID_VALUE,
+						"glMultiModeDrawElementsIBM(count[%d]=%d)", i, count[i]);
+			return;
+		}
 	}
 
-	GPUCMD_AddIncrementalWrites(GPUREG_ATTRIBBUFFERS_LOC, param, 28);
+	if (skip)
+		return;
 
-	GPUCMD_AddMaskedWrite(GPUREG_VSH_INPUTBUFFER_CONFIG, 0xB, 0xA0000000|(attrib_count-1));
-	GPUCMD_AddWrite(GPUREG_VSH_NUM_ATTR, (attrib_count-1));
+	update_context(ctx);
 
-	GPUCMD_AddIncrementalWrites(GPUREG_VSH_ATTRIBUTES_PERMUTATION_LOW, ((u32[]){vao->AttributePermutation&0xFFFFFFFF, (vao->AttributePermutation>>32)&0xFFFF}), 2);
+	if (ctx->Array._StreamArrays) {
+		GLuint min = ~0u, max = 0;
+		for ( i = 0 ; i < primcount ; i++ )
+			elements_range(ctx, count[i], indices[i], &min, &max);
+		if (min <= max && !stream_arrays(ctx, min, max, "glMultiModeDrawElementsIBM"))
+			return;
+	}
 
-    GPU_DrawArray((GPU_Primitive_t)mode, 0, count);
-	GPU_FinishDrawing();
-	GPUCMD_Finalize();
-//	GPUCMD_Run(NULL);
-	GPUCMD_FlushAndRun();
-	GPUCMD_SetBufferOffset(0);
+	instance_attribs(ctx, 0);
+
+	for ( i = 0 ; i < primcount ; i++ ) {
+		if ( count[i] > 0 ) {
+			GLenum m = *((GLenum *) ((GLubyte *) mode + i * modestride));
+			GPU_DrawElements((GPU_Primitive_t) m,
+							 elements_offset(ctx, indices[i]), count[i]);
+		}
+	}
 }
@@ -44,7 +44,7 @@ _mesa_vertex_attrib_address(const struct gl_vertex_attrib_array *array,
 							const struct gl_vertex_buffer_binding *binding)
 {
 	if (_mesa_is_bufferobj(binding->BufferObj))
-		return (const GLubyte *) (binding->Offset + array->RelativeOffset);
+		return (const GLubyte *) (uintptr_t) (binding->Offset + array->RelativeOffset);
 	else
 		return array->Ptr;
 }
@@ -108,6 +108,11 @@ extern void
 extern void
 		_mesa_free_varray_data(struct gl_context *ctx);
 
+/** Number of vertex attribute loaders on the PICA200 */
+#define PICA_MAX_ATTRIBS 12
+
+void _gl3ds_update_arrays(struct gl_context *ctx);
+
 
 //void init_varray(struct gl_context *ctx);
 
@@ -32,6 +32,7 @@
 #include "enums.h"
 #include "macros.h"
 #include "mtypes.h"
+#include "screenbuffer.h"
 #include "viewport.h"
 
 static void
@@ -355,7 +356,6 @@ void _mesa_init_viewport(struct gl_context *ctx)
 {
 	unsigned i;
 
-	ctx->Screen = GFX_TOP;
 //	ctx->Transform.ClipOrigin = GL_LOWER_LEFT;
 //	ctx->Transform.ClipDepthMode = GL_NEGATIVE_ONE_TO_ONE;
 
@@ -468,13 +468,16 @@ static void gpuDepthRange(float nearVal, float farVal)
 
 void _gl3ds_update_viewport(struct gl_context *ctx)
 {
+	const struct gl_viewport_attrib *vp = &ctx->ViewportArray[0];
+	struct gl_screen_rect r;
+
+	_gl3ds_window_rect(ctx, &r, (GLint) vp->X, (GLint) vp->Y, (GLint) vp->Width, (GLint) vp->Height);
 	// TODO: this should probably be a matrix uniform instead?
 	GPU_SetViewport(
 			(u32*) osConvertVirtToPhys((u32) ctx->DepthBuffer),
 			(u32*) osConvertVirtToPhys((u32) ctx->FrameBuffer),
-			(u32)ctx->ViewportArray[0].X,
-			(u32)ctx->ViewportArray[0].Y,
-			ctx->Screen == GFX_TOP ? (u32)ctx->ViewportArray[0].Height : (u32)ctx->ViewportArray[0].Height,
-			(u32)ctx->ViewportArray[0].Width);
+			(u32) r.x0, (u32) r.y0, (u32) (r.x1 - r.x0), (u32) (r.y1 - r.y0));
+	// It sets RGBA8 color and 24 bit depth with stencil up
+	_gl3ds_emit_buffer_formats(ctx);
 	GPU_DepthMap(-1.0f, 0.0f); // calculate the depth value from the Z coordinate in the following way: -1.0*z + 0.0
 }